@@ -10,6 +10,9 @@
 #include "prefab.h"
 #include "gltf_loader.h"
 #include "renderer.h"
+#include "profiler.h"
+#include "memory_report.h"
+#include "texture_residency.h"
 
 #include <cmath>
 #include <string>
@@ -27,7 +30,7 @@ Texture* texture = nullptr;
 
 float cam_speed = 10;
 
-Application::Application(int window_width, int window_height, SDL_Window* window)
+Application::Application(int window_width, int window_height, SDL_Window* window, const char* scene_filename)
 {
 	this->window_width = window_width;
 	this->window_height = window_height;
@@ -67,7 +70,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 	//prefab = GTR::Prefab::Get("data/prefabs/gmc/scene.gltf");
 
 	scene = new GTR::Scene();
-	if (!scene->load("data/scene.json"))
+	if (!scene->load(scene_filename))
 		exit(1);
 
 	scene->environment = GTR::CubemapFromHDRE("data/night.hdre");
@@ -87,6 +90,7 @@ Application::Application(int window_width, int window_height, SDL_Window* window
 //what to do when the image has to be draw
 void Application::render(void)
 {
+	CPU_SCOPE("Application::render");
 	//be sure no errors present in opengl before start
 	checkGLErrors();
 
@@ -110,6 +114,11 @@ void Application::render(void)
 	renderer->renderToFBO(scene, camera);
 	//renderer->renderScene(scene, camera);
 
+	if (GPUProfiler::show_overlay)
+		GPUProfiler::renderOverlay(10, 10);
+	if (RenderStats::show_overlay) //below the GPU profiler
+		RenderStats::renderOverlay(10, GPUProfiler::show_overlay ? 10 + (GPUProfiler::passes.size() + 2) * 18 : 10);
+
 	//Draw the floor grid, helpful to have a reference point
 	//if(render_debug)
 		//drawGrid();
@@ -122,6 +131,7 @@ void Application::render(void)
 
 void Application::update(double seconds_elapsed)
 {
+	CPU_SCOPE("Application::update");
 	float speed = seconds_elapsed * cam_speed; //the speed is defined by the seconds_elapsed so it goes constant
 	float orbit_speed = seconds_elapsed * 0.5;
 
@@ -250,6 +260,18 @@ void Application::renderDebugGUI(void)
 	ImGui::Text(getGPUStats().c_str());					   // Display some text (you can use a format strings too)
 
 	ImGui::Checkbox("Wireframe", &render_wireframe);
+	ImGui::Checkbox("GPU Profiler", &GPUProfiler::show_overlay);
+	if (GPUProfiler::show_overlay) {
+		ImGui::SameLine();
+		if (ImGui::Button("Export")) { GPUProfiler::exportCSV("gpu_profile.csv"); GPUProfiler::exportJSON("gpu_profile.json"); }
+	}
+	ImGui::Checkbox("Render Stats", &RenderStats::show_overlay);
+	if (RenderStats::show_overlay) {
+		ImGui::SameLine();
+		if (ImGui::Button("Export##stats")) RenderStats::exportJSON("render_stats.json");
+	}
+	if (ImGui::Button("Memory Report")) saveMemoryReport();
+	TextureResidency::renderInMenu();
 	ImGui::ColorEdit3("BG color", scene->background_color.v);
 	ImGui::ColorEdit3("Ambient Light", scene->ambient_light.v);
 
@@ -271,6 +293,9 @@ void Application::renderDebugGUI(void)
 		ImGui::Checkbox("Blur SSAO+", &renderer->blur_ssao);
 		ImGui::Checkbox("HDR + Tonemapper", &renderer->hdr);
 		ImGui::Checkbox("Dithering", &renderer->dithering);
+		ImGui::Checkbox("Weighted Blended OIT", &renderer->oit);
+		ImGui::Checkbox("Render Cache", &renderer->render_cache);
+		if (renderer->render_cache) ImGui::Text("Cached frames: %d", renderer->cached_frames);
 		ImGui::Checkbox("Show Probes", &renderer->show_probe);
 		ImGui::Checkbox("Show Ref Probe", &renderer->show_ref_probes);
 		ImGui::Checkbox("Show Volumetric", &renderer->show_volumetric);
@@ -286,6 +311,14 @@ void Application::renderDebugGUI(void)
 		if(renderer->show_glow) ImGui::SliderFloat("Glow Factor", &renderer->glow_factor, 1.0, 4.0);
 		if(renderer->show_chroma) ImGui::SliderFloat("Chromatic Factor", &renderer->chroma_amount, -0.15, 0.15);
 		if(renderer->show_lens) ImGui::SliderFloat("Lens Distortion Power", &renderer->lens_power, -1, 1);
+
+		ImGui::Checkbox("Dynamic Resolution", &renderer->dynamic_resolution);
+		if (renderer->dynamic_resolution) {
+			ImGui::SliderFloat("Target GPU ms", &renderer->target_frame_ms, 4.0, 50.0);
+			ImGui::SliderFloat("Min Scale", &renderer->min_render_scale, 0.25, 1.0);
+			ImGui::SliderFloat("Sharpness", &renderer->upscale_sharpness, 0.0, 1.0);
+			ImGui::Text("Scale %.2f  GPU %.2f ms", renderer->render_scale, renderer->gpu_frame_ms);
+		}
 	}
 
 	//add info to the debug panel about the camera
@@ -352,6 +385,12 @@ void Application::onKeyDown(SDL_KeyboardEvent event)
 			camera->fov = scene->main_camera.fov;
 			break;
 		case SDLK_z: renderer->updateIrradianceCache(scene); break;
+		case SDLK_F7: GPUProfiler::show_overlay = !GPUProfiler::show_overlay; break;
+		case SDLK_F8: GPUProfiler::exportCSV("gpu_profile.csv"); GPUProfiler::exportJSON("gpu_profile.json"); break;
+		case SDLK_F9: CPU_EXPORT_TRACE("cpu_trace.json"); break;
+		case SDLK_F10: RenderStats::show_overlay = !RenderStats::show_overlay; break;
+		case SDLK_F11: RenderStats::exportJSON("render_stats.json"); break;
+		case SDLK_F12: saveMemoryReport(); break;
 	}
 }
 
@@ -0,0 +1,436 @@
+#include "asset_loader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "texture_compressor.h"
+#include "texture_cache.h"
+#include "prefab.h"
+#include "utils.h"
+#include "profiler.h"
+
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+int AssetLoader::max_pending_uploads = 16;
+float AssetLoader::upload_budget = 2.0f;
+
+enum eAssetType { ASSET_TEXTURE, ASSET_MESH, ASSET_PREFAB };
+
+//one request, the worker fills the decoded part and the main thread finishes it
+struct sAssetJob {
+	eAssetType type;
+	std::string filename;
+	void* resource = NULL; //the handle returned by get*Async
+	bool mipmaps = true;
+	bool wrap = true;
+	eTextureCompression compression = TEXTURE_UNCOMPRESSED; //only if the GPU supports it
+	bool srgb = true; //how the mips of the .rbin are filtered, normal maps are not colors
+	bool use_cache = false;
+	std::string mime_type; //for images in memory
+	std::vector<unsigned char> buffer;
+
+	//result
+	bool ok = false;
+	long decode_time = 0; //ms
+	Image image;
+	sCompressedImage compressed; //used instead of the image when it has data
+	sRawImage raw; //the .rbin, used instead of the image when it has data
+	Mesh* mesh = NULL; //loaded apart, its data is swapped into the handle
+	std::ostringstream log;
+
+	~sAssetJob() { delete mesh; }
+};
+
+static std::vector<std::thread> workers;
+static std::mutex queue_mutex;
+static std::condition_variable jobs_ready;
+static std::condition_variable uploads_space;
+static std::condition_variable uploads_ready; //for finishAll
+static std::deque<sAssetJob*> pending_jobs;
+static std::deque<sAssetJob*> pending_uploads;
+static bool stopping = false;
+static std::set<const void*> loading; //only used from the main thread
+
+//worker side, no GL and no managers
+void decodeAsset(sAssetJob* job)
+{
+	long time = getTime();
+	switch (job->type)
+	{
+	case ASSET_TEXTURE:
+		if (job->buffer.size())
+		{
+			if (job->mime_type == "image/png")
+				job->ok = job->image.loadPNG(job->buffer);
+			else if (job->mime_type == "image/jpeg")
+				job->ok = job->image.loadJPG(job->buffer);
+			std::vector<unsigned char>().swap(job->buffer);
+		}
+		else if (job->compression != TEXTURE_UNCOMPRESSED && loadCompressedImage(job->filename.c_str(), job->compression, job->mipmaps, job->compressed))
+			job->ok = true;
+		else if (job->use_cache && loadRawImage(job->filename.c_str(), job->mipmaps, job->srgb, job->raw))
+		{
+			//the upload reads the mapping, its pages are brought now so it does not wait for the disk
+			job->raw.file.prefetch();
+			job->ok = true;
+		}
+		else
+			job->ok = job->image.load(job->filename.c_str());
+		break;
+	case ASSET_MESH:
+		job->mesh = new Mesh();
+		job->ok = job->mesh->load(job->filename.c_str(), job->log);
+		break;
+	case ASSET_PREFAB:
+		//nodes, materials and buffers are created in the main thread, here the .pbin is only brought to memory
+		//reading every page so the main thread does not wait for the disk
+		if (GTR::Prefab::use_binary)
+		{
+			MappedFile file;
+			job->ok = file.open((job->filename + ".pbin").c_str());
+			file.prefetch();
+		}
+		break;
+	}
+	job->decode_time = getTime() - time;
+}
+
+void workerLoop(int index)
+{
+	CPU_THREAD_NAME(("asset loader " + std::to_string(index)).c_str());
+	while (true)
+	{
+		sAssetJob* job = NULL;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			jobs_ready.wait(lock, [] { return stopping || pending_jobs.size(); });
+			if (stopping)
+				return;
+			job = pending_jobs.front();
+			pending_jobs.pop_front();
+		}
+
+		{
+			CPU_SCOPE("decodeAsset");
+			decodeAsset(job);
+		}
+
+		//shutdown deletes it if it is never finished
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		uploads_space.wait(lock, [] { return stopping || (int)pending_uploads.size() < AssetLoader::max_pending_uploads; });
+		pending_uploads.push_back(job);
+		uploads_ready.notify_one();
+		if (stopping)
+			return;
+	}
+}
+
+//main thread side, uploads and fills the handle
+void finishAsset(sAssetJob* job)
+{
+	long time = getTime();
+	switch (job->type)
+	{
+	case ASSET_TEXTURE:
+	{
+		if (!job->ok)
+		{
+			std::cout << "[ERROR] async texture not found or unsupported format: " << job->filename << std::endl;
+			break;
+		}
+		//replacing the placeholder removes the name from the manager
+		Texture* texture = (Texture*)job->resource;
+		std::string name = texture->filename;
+		if (job->compressed.data.size())
+			texture->loadFromCompressedImage(&job->compressed, job->wrap);
+		else if (job->raw.data)
+			texture->loadFromRawImage(&job->raw, job->wrap);
+		else
+			texture->loadFromImage(&job->image, job->mipmaps, job->wrap);
+		texture->residency.streamable = (job->compressed.data.size() || job->raw.data) && texture->residency.num_levels > 1;
+		texture->residency.compression = job->compressed.data.size() ? job->compression : (job->srgb ? TEXTURE_UNCOMPRESSED : TEXTURE_COMPRESS_NORMALMAP);
+		if (name.size())
+			texture->setName(name.c_str());
+		std::cout << " + Texture loaded async: " << job->filename << " ... [" << (job->compressed.data.size() ? getCompressionName(job->compressed.format) : "OK") << "] Size: " << texture->width << "x" << texture->height << " Decode: " << job->decode_time * 0.001 << "sec" << std::endl;
+		break;
+	}
+	case ASSET_MESH:
+	{
+		if (!job->ok)
+		{
+			std::cout << "[ERROR] async mesh not found: " << job->filename << std::endl;
+			break;
+		}
+		Mesh* mesh = (Mesh*)job->resource;
+		mesh->swapData(*job->mesh);
+		if (Mesh::auto_upload_to_vram)
+		{
+			job->log << "[VRAM] ";
+			mesh->uploadToVRAM();
+		}
+		std::cout << " + Mesh loaded async: " << job->filename << " ... " << job->log.str() << "[OK]  Faces: " << (mesh->getNumIndices() ? mesh->getNumIndices() : mesh->getNumVertices()) / 3 << " Decode: " << job->decode_time * 0.001 << "sec" << std::endl;
+		break;
+	}
+	case ASSET_PREFAB:
+	{
+		//without a valid .pbin the glTF is imported here, it only happens until the .pbin is written
+		GTR::Prefab* loaded = GTR::Prefab::Load(job->filename.c_str(), true);
+		if (!loaded)
+			break;
+		std::cout << " + Prefab loaded async: " << job->filename << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+
+		//the registered prefab gets the nodes, whoever holds it sees them from now on
+		GTR::Prefab* prefab = (GTR::Prefab*)job->resource;
+		GTR::Node& root = loaded->root;
+		prefab->root.name = root.name;
+		prefab->root.visible = root.visible;
+		prefab->root.layers = root.layers;
+		prefab->root.mesh = root.mesh;
+		prefab->root.material = root.material;
+		prefab->root.model = root.model;
+		std::vector<GTR::Node*> children;
+		children.swap(root.children);
+		for (size_t i = 0; i < children.size(); ++i)
+		{
+			children[i]->parent = NULL;
+			prefab->root.addChild(children[i]);
+		}
+		prefab->source_files.swap(loaded->source_files);
+		delete loaded;
+
+		prefab->updateNodesByName();
+		prefab->updateBounding();
+		break;
+	}
+	}
+
+	//the handle keeps its pointer, frames cached with the placeholder are outdated
+	markResourcesChanged();
+
+	long elapsed = getTime() - time;
+	if (elapsed > 50)
+		std::cout << "[WARN] finishing " << job->filename << " took " << elapsed << "ms in the main thread" << std::endl;
+}
+
+void AssetLoader::init(int num_threads)
+{
+	if (workers.size())
+		return;
+	if (num_threads <= 0)
+		num_threads = std::max(getNumWorkerThreads() - 1, 1);
+	stopping = false;
+	for (int i = 0; i < num_threads; ++i)
+		workers.push_back(std::thread(workerLoop, i));
+}
+
+void AssetLoader::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	jobs_ready.notify_all();
+	uploads_space.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+
+	for (size_t i = 0; i < pending_jobs.size(); ++i)
+		delete pending_jobs[i];
+	for (size_t i = 0; i < pending_uploads.size(); ++i)
+		delete pending_uploads[i];
+	pending_jobs.clear();
+	pending_uploads.clear();
+	loading.clear();
+	stopping = false;
+}
+
+void addAssetJob(sAssetJob* job)
+{
+	AssetLoader::init();
+	loading.insert(job->resource);
+	{
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		pending_jobs.push_back(job);
+	}
+	jobs_ready.notify_one();
+}
+
+Texture* createTexturePlaceholder()
+{
+	Uint8 white[3] = { 255, 255, 255 };
+	Texture* texture = new Texture();
+	texture->create(1, 1, GL_RGB, GL_UNSIGNED_BYTE, false, white);
+	return texture;
+}
+
+Texture* AssetLoader::getTextureAsync(const char* filename, bool mipmaps, bool wrap, eTextureCompression compression)
+{
+	assert(filename);
+	Texture* texture = Texture::Find(filename);
+	if (texture)
+		return texture;
+
+	texture = createTexturePlaceholder();
+	texture->setName(filename);
+
+	sAssetJob* job = new sAssetJob();
+	job->type = ASSET_TEXTURE;
+	job->filename = filename;
+	job->resource = texture;
+	job->mipmaps = mipmaps;
+	job->wrap = wrap;
+	job->compression = Texture::canCompress() ? compression : TEXTURE_UNCOMPRESSED;
+	job->srgb = compression != TEXTURE_COMPRESS_NORMALMAP;
+	job->use_cache = Texture::use_cache;
+	addAssetJob(job);
+	return texture;
+}
+
+Texture* AssetLoader::getTextureAsync(const char* name, const std::string& mime_type, const unsigned char* data, size_t size)
+{
+	assert(name && data);
+	Texture* texture = name[0] ? Texture::Find(name) : NULL;
+	if (texture)
+		return texture;
+
+	texture = createTexturePlaceholder();
+	if (name[0])
+		texture->setName(name);
+
+	sAssetJob* job = new sAssetJob();
+	job->type = ASSET_TEXTURE;
+	job->filename = name[0] ? name : "embedded image";
+	job->resource = texture;
+	job->mime_type = mime_type;
+	job->buffer.assign(data, data + size);
+	addAssetJob(job);
+	return texture;
+}
+
+Mesh* AssetLoader::getMeshAsync(const char* filename)
+{
+	assert(filename);
+	Mesh* mesh = Mesh::Get(filename, false, true);
+	if (mesh)
+		return mesh;
+
+	//empty until it is finished, the renderer skips meshes without vertices
+	mesh = new Mesh();
+	mesh->registerMesh(filename);
+
+	sAssetJob* job = new sAssetJob();
+	job->type = ASSET_MESH;
+	job->filename = filename;
+	job->resource = mesh;
+	addAssetJob(job);
+	return mesh;
+}
+
+GTR::Prefab* AssetLoader::getPrefabAsync(const char* filename)
+{
+	assert(filename);
+	auto it = GTR::Prefab::sPrefabsLoaded.find(filename);
+	if (it != GTR::Prefab::sPrefabsLoaded.end())
+		return it->second;
+
+	//without nodes until it is finished
+	GTR::Prefab* prefab = new GTR::Prefab();
+	prefab->registerPrefab(filename);
+
+	sAssetJob* job = new sAssetJob();
+	job->type = ASSET_PREFAB;
+	job->filename = filename;
+	job->resource = prefab;
+	addAssetJob(job);
+	return prefab;
+}
+
+void AssetLoader::update()
+{
+	if (loading.empty())
+		return;
+	CPU_SCOPE("AssetLoader::update");
+
+	//at least one per frame, so a small budget cannot stall the loading
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	do
+	{
+		sAssetJob* job = NULL;
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			if (pending_uploads.empty())
+				break;
+			job = pending_uploads.front();
+			pending_uploads.pop_front();
+		}
+		uploads_space.notify_one();
+
+		finishAsset(job);
+		loading.erase(job->resource);
+		delete job;
+	} while (std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() < upload_budget);
+}
+
+void AssetLoader::finishAll()
+{
+	CPU_SCOPE("AssetLoader::finishAll");
+	long time = getTime();
+	int count = 0;
+
+	//finishing a prefab can request its textures, so it goes on until nothing is loading
+	while (loading.size())
+	{
+		sAssetJob* job = NULL;
+		bool decoded = true;
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			uploads_ready.wait(lock, [] { return pending_uploads.size() || pending_jobs.size(); });
+			if (pending_uploads.size())
+			{
+				job = pending_uploads.front();
+				pending_uploads.pop_front();
+			}
+			else
+			{
+				job = pending_jobs.front();
+				pending_jobs.pop_front();
+				decoded = false;
+			}
+		}
+
+		if (decoded)
+			uploads_space.notify_one();
+		else
+		{
+			CPU_SCOPE("decodeAsset");
+			decodeAsset(job);
+		}
+
+		finishAsset(job);
+		loading.erase(job->resource);
+		delete job;
+		count++;
+	}
+
+	if (count)
+		std::cout << " + Assets finished: " << count << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+}
+
+int AssetLoader::getNumPending()
+{
+	return (int)loading.size();
+}
+
+bool AssetLoader::isLoading(const void* resource)
+{
+	return loading.count(resource) != 0;
+}
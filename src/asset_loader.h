@@ -0,0 +1,41 @@
+/*  Asset loader, reads and decodes meshes, textures and prefabs in worker threads while the application keeps rendering.
+	The get*Async functions return at once a resource already registered in its manager with placeholder content:
+	a white texture, an empty mesh (the renderer skips meshes without vertices) or a prefab without nodes.
+	GL is only used from the main thread: decoded assets wait in a bounded queue that update() drains every frame
+	within a time budget, workers stop when the queue is full so the decoded data does not pile up in RAM.
+	The managers (Mesh, Texture, Prefab maps) are only touched from the main thread, workers get the file names
+	and fill objects nobody else sees, so the maps need no locks.
+*/
+
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <string>
+
+#include "texture.h"
+
+class Mesh;
+namespace GTR { class Prefab; }
+
+class AssetLoader
+{
+public:
+	static int max_pending_uploads; //decoded assets waiting for the main thread, workers wait when it is full
+	static float upload_budget; //ms per frame spent by update, at least one asset is finished every frame
+
+	static void init(int num_threads = 0); //0 uses one thread per core but the main one, get*Async calls it if needed
+	static void shutdown(); //waits for the workers, assets not finished keep their placeholders
+
+	//they return the resource if it was already loaded or requested
+	static Texture* getTextureAsync(const char* filename, bool mipmaps = true, bool wrap = true, eTextureCompression compression = TEXTURE_UNCOMPRESSED);
+	static Texture* getTextureAsync(const char* name, const std::string& mime_type, const unsigned char* data, size_t size); //png or jpg in memory, name can be empty
+	static Mesh* getMeshAsync(const char* filename);
+	static GTR::Prefab* getPrefabAsync(const char* filename);
+
+	static void update(); //main thread, once per frame
+	static void finishAll(); //main thread, waits for every request and finishes it without budget, it decodes too meanwhile
+	static int getNumPending(); //requested and not finished yet
+	static bool isLoading(const void* resource);
+};
+
+#endif
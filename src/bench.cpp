@@ -0,0 +1,418 @@
+#include "bench.h"
+#include "includes.h"
+#include "application.h"
+#include "renderer.h"
+#include "camera.h"
+#include "mesh.h"
+#include "utils.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef USE_EGL
+	#include <EGL/egl.h>
+	#include <EGL/eglext.h>
+#elif defined(USE_OSMESA)
+	#include <GL/osmesa.h>
+#endif
+
+extern GTR::Renderer* renderer; //created by the application
+
+const char* pipeline_names[NUM_PIPELINE_MODES] = { "deferred", "forward" };
+const char* render_mode_names[NUM_RENDER_MODES] = { "default", "texture", "normal", "ao", "uvs", "multi", "gbuffers", "deferred", "ssao", "irradiance", "downsampling" };
+
+struct sCameraKey {
+	Vector3 eye;
+	Vector3 center;
+	float fov;
+};
+
+struct sBenchOptions {
+	std::string scene = "data/scene.json"; //data/stress_*.json from scenegen to measure big scenes
+	std::string path = "data/bench_path.json";
+	std::string output = "bench.json";
+	std::string stats = "bench_stats.json"; //render stats of every frame, empty to skip it
+	int width = -1; //-1 means use the value of the path file
+	int height = -1;
+	int frames = -1;
+	int warmup = 10; //frames rendered before measuring, shaders and caches get ready
+	GTR::ePipelineMode pipeline = GTR::DEFERRED;
+	GTR::eRenderMode render_mode = GTR::DEFAULT;
+};
+
+#ifdef USE_EGL
+
+bool createOffscreenContext(int width, int height)
+{
+	EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+	{
+		std::cout << "[ERROR] cannot open the EGL display" << std::endl;
+		return false;
+	}
+
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+		EGL_NONE };
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || !num_configs)
+	{
+		std::cout << "[ERROR] no EGL config with pbuffer support" << std::endl;
+		return false;
+	}
+
+	const EGLint surface_attribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attribs);
+
+	//timer queries need 3.3, compatibility because the camera and the FBOs still use the fixed function matrices and attribs
+	eglBindAPI(EGL_OPENGL_API);
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+		EGL_NONE };
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+	{
+		std::cout << "[ERROR] cannot create the EGL context" << std::endl;
+		return false;
+	}
+
+	std::cout << " * OpenGL Version: " << glGetString(GL_VERSION) << " (" << glGetString(GL_RENDERER) << ")" << std::endl;
+	return true;
+}
+
+void swapOffscreen()
+{
+	eglSwapBuffers(eglGetCurrentDisplay(), eglGetCurrentSurface(EGL_DRAW));
+}
+
+#elif defined(USE_OSMESA)
+
+static std::vector<unsigned char> osmesa_buffer;
+
+bool createOffscreenContext(int width, int height)
+{
+	const int attribs[] = {
+		OSMESA_FORMAT, OSMESA_RGBA,
+		OSMESA_DEPTH_BITS, 24, OSMESA_STENCIL_BITS, 8,
+		OSMESA_PROFILE, OSMESA_COMPAT_PROFILE, //the camera and the FBOs still use the fixed function matrices and attribs
+		OSMESA_CONTEXT_MAJOR_VERSION, 3, OSMESA_CONTEXT_MINOR_VERSION, 3,
+		0 };
+	OSMesaContext context = OSMesaCreateContextAttribs(attribs, NULL);
+	osmesa_buffer.resize(width * height * 4);
+	if (!context || !OSMesaMakeCurrent(context, &osmesa_buffer[0], GL_UNSIGNED_BYTE, width, height))
+	{
+		std::cout << "[ERROR] cannot create the OSMesa context" << std::endl;
+		return false;
+	}
+
+	std::cout << " * OpenGL Version: " << glGetString(GL_VERSION) << " (" << glGetString(GL_RENDERER) << ")" << std::endl;
+	return true;
+}
+
+void swapOffscreen()
+{
+	glFinish();
+}
+
+#else
+
+bool createOffscreenContext(int width, int height)
+{
+	std::cout << "[ERROR] headless mode needs USE_EGL or USE_OSMESA" << std::endl;
+	return false;
+}
+
+void swapOffscreen()
+{
+}
+
+#endif
+
+int findName(const char* name, const char** names, int num)
+{
+	for (int i = 0; i < num; ++i)
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	return -1;
+}
+
+Application* createHeadlessApplication(int width, int height, const char* scene_filename)
+{
+	if (!createOffscreenContext(width, height))
+		return NULL;
+
+	//the application loads the scene and creates the renderer, there is no window
+	Application* app = new Application(width, height, NULL, scene_filename);
+	app->render_gui = false;
+	renderer->render_cache = false; //every frame must be rendered
+	renderer->dynamic_resolution = false; //same work in every run
+	return app;
+}
+
+static bool parseBenchOptions(int argc, char** argv, sBenchOptions& options)
+{
+	for (int i = 2; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!value)
+		{
+			std::cout << "[ERROR] missing value for " << arg << std::endl;
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--scene") == 0)
+			options.scene = value;
+		else if (strcmp(arg, "--path") == 0)
+			options.path = value;
+		else if (strcmp(arg, "--out") == 0)
+			options.output = value;
+		else if (strcmp(arg, "--stats") == 0)
+			options.stats = value;
+		else if (strcmp(arg, "--width") == 0)
+			options.width = atoi(value);
+		else if (strcmp(arg, "--height") == 0)
+			options.height = atoi(value);
+		else if (strcmp(arg, "--frames") == 0)
+			options.frames = atoi(value);
+		else if (strcmp(arg, "--warmup") == 0)
+			options.warmup = atoi(value);
+		else if (strcmp(arg, "--pipeline") == 0)
+		{
+			int index = findName(value, pipeline_names, NUM_PIPELINE_MODES);
+			if (index == -1)
+			{
+				std::cout << "[ERROR] unknown pipeline: " << value << " (deferred, forward)" << std::endl;
+				return false;
+			}
+			options.pipeline = (GTR::ePipelineMode)index;
+		}
+		else if (strcmp(arg, "--mode") == 0)
+		{
+			int index = findName(value, render_mode_names, NUM_RENDER_MODES);
+			if (index == -1)
+			{
+				std::cout << "[ERROR] unknown render mode: " << value << std::endl;
+				return false;
+			}
+			options.render_mode = (GTR::eRenderMode)index;
+		}
+		else
+		{
+			std::cout << "[ERROR] unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+//the path file has the keys of the camera, they are spread evenly over the frames
+static bool loadCameraPath(sBenchOptions& options, std::vector<sCameraKey>& keys)
+{
+	std::string content;
+	if (!readFile(options.path, content))
+	{
+		std::cout << "[ERROR] camera path not found: " << options.path << std::endl;
+		return false;
+	}
+
+	cJSON* json = cJSON_Parse(content.c_str());
+	if (!json)
+	{
+		std::cout << "[ERROR] camera path is not a valid JSON: " << options.path << std::endl;
+		return false;
+	}
+
+	if (options.width == -1)
+		options.width = readJSONNumber(json, "width", 1280);
+	if (options.height == -1)
+		options.height = readJSONNumber(json, "height", 720);
+	if (options.frames == -1)
+		options.frames = readJSONNumber(json, "frames", 300);
+
+	cJSON* keys_json = cJSON_GetObjectItemCaseSensitive(json, "keys");
+	cJSON* key_json;
+	cJSON_ArrayForEach(key_json, keys_json)
+	{
+		sCameraKey key;
+		key.eye = readJSONVector3(key_json, "eye", Vector3(0, 100, 100));
+		key.center = readJSONVector3(key_json, "center", Vector3(0, 0, 0));
+		key.fov = readJSONNumber(key_json, "fov", 60);
+		keys.push_back(key);
+	}
+	cJSON_Delete(json);
+
+	if (keys.empty())
+	{
+		std::cout << "[ERROR] camera path has no keys: " << options.path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static void applyCameraPath(Camera* camera, std::vector<sCameraKey>& keys, float t, float aspect)
+{
+	sCameraKey key = keys[0];
+	if (keys.size() > 1)
+	{
+		float f = t * (keys.size() - 1);
+		int i = std::min((int)f, (int)keys.size() - 2);
+		float w = f - i;
+		key.eye = lerp(keys[i].eye, keys[i + 1].eye, w);
+		key.center = lerp(keys[i].center, keys[i + 1].center, w);
+		key.fov = lerp(keys[i].fov, keys[i + 1].fov, w);
+	}
+	camera->lookAt(key.eye, key.center, Vector3(0, 1, 0));
+	camera->setPerspective(key.fov, aspect, camera->near_plane, camera->far_plane);
+}
+
+static bool saveText(const std::string& filename, const char* text, const char* what)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write " << what << ": " << filename << std::endl;
+		return false;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	std::cout << " + " << what << " saved: " << filename << std::endl;
+	return true;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	int index = (int)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(std::max(index, 0), (int)sorted.size() - 1)];
+}
+
+static cJSON* createStats(std::vector<double> values)
+{
+	cJSON* stats = cJSON_CreateObject();
+	if (values.empty())
+		return stats;
+	std::sort(values.begin(), values.end());
+	double sum = 0;
+	for (int i = 0; i < values.size(); ++i)
+		sum += values[i];
+	cJSON_AddNumberToObject(stats, "mean", sum / values.size());
+	cJSON_AddNumberToObject(stats, "p50", percentile(values, 0.5));
+	cJSON_AddNumberToObject(stats, "p95", percentile(values, 0.95));
+	cJSON_AddNumberToObject(stats, "p99", percentile(values, 0.99));
+	cJSON_AddNumberToObject(stats, "min", values.front());
+	cJSON_AddNumberToObject(stats, "max", values.back());
+	return stats;
+}
+
+int runBenchmark(int argc, char** argv)
+{
+	sBenchOptions options;
+	std::vector<sCameraKey> keys;
+	if (!parseBenchOptions(argc, argv, options) || !loadCameraPath(options, keys))
+		return 1;
+
+	std::cout << " * Benchmark: " << options.frames << " frames at " << options.width << " x " << options.height
+		<< ", pipeline " << pipeline_names[options.pipeline] << ", mode " << render_mode_names[options.render_mode] << std::endl;
+
+	Application* app = createHeadlessApplication(options.width, options.height, options.scene.c_str());
+	if (!app)
+		return 1;
+	renderer->pipeline_mode = options.pipeline;
+	renderer->render_mode = options.render_mode;
+	Camera* camera = app->scene_camera;
+	float aspect = options.width / (float)options.height;
+
+	int total_frames = options.warmup + options.frames;
+	std::vector<GLuint> queries(total_frames * 2);
+	glGenQueries(queries.size(), &queries[0]);
+	std::vector<double> cpu_ms, gpu_ms, draw_calls, triangles;
+	cJSON* frame_stats = cJSON_CreateArray();
+
+	for (int i = 0; i < total_frames; ++i)
+	{
+		//warmup frames stay at the first key
+		int frame = std::max(i - options.warmup, 0);
+		applyCameraPath(camera, keys, options.frames > 1 ? frame / (float)(options.frames - 1) : 0.0f, aspect);
+
+		//fixed timestep so animated things do the same in every run
+		app->time = i / 60.0f;
+		app->elapsed_time = 1 / 60.0f;
+		app->frame = i;
+		Mesh::num_meshes_rendered = 0;
+		Mesh::num_triangles_rendered = 0;
+
+		glQueryCounter(queries[i * 2], GL_TIMESTAMP);
+		auto start = std::chrono::steady_clock::now();
+		app->render();
+		auto end = std::chrono::steady_clock::now();
+		glQueryCounter(queries[i * 2 + 1], GL_TIMESTAMP);
+		swapOffscreen();
+
+		if (i < options.warmup)
+			continue;
+		cpu_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+		draw_calls.push_back(Mesh::num_meshes_rendered);
+		triangles.push_back(Mesh::num_triangles_rendered);
+
+		cJSON* stats = RenderStats::toJSON();
+		cJSON_AddNumberToObject(stats, "frame", frame);
+		cJSON_AddItemToArray(frame_stats, stats);
+	}
+
+	//all frames are done, reading the queries now does not disturb the timings
+	glFinish();
+	for (int i = options.warmup; i < total_frames; ++i)
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		gpu_ms.push_back((end - start) / 1000000.0);
+	}
+	glDeleteQueries(queries.size(), &queries[0]);
+	checkGLErrors();
+
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddStringToObject(root, "renderer", (const char*)glGetString(GL_RENDERER));
+	cJSON_AddStringToObject(root, "scene", options.scene.c_str());
+	cJSON_AddStringToObject(root, "camera_path", options.path.c_str());
+	cJSON_AddStringToObject(root, "pipeline", pipeline_names[options.pipeline]);
+	cJSON_AddStringToObject(root, "render_mode", render_mode_names[options.render_mode]);
+	cJSON_AddNumberToObject(root, "width", options.width);
+	cJSON_AddNumberToObject(root, "height", options.height);
+	cJSON_AddNumberToObject(root, "frames", options.frames);
+	cJSON_AddNumberToObject(root, "warmup", options.warmup);
+	cJSON_AddItemToObject(root, "cpu_ms", createStats(cpu_ms));
+	cJSON_AddItemToObject(root, "gpu_ms", createStats(gpu_ms));
+	cJSON_AddItemToObject(root, "draw_calls", createStats(draw_calls));
+	cJSON_AddItemToObject(root, "triangles", createStats(triangles));
+	if (options.stats.size())
+		cJSON_AddStringToObject(root, "stats", options.stats.c_str());
+
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+	std::cout << text << std::endl;
+	bool saved = saveText(options.output, text, "Benchmark report");
+	free(text);
+
+	//kept apart from the report, it is too big to print
+	if (saved && options.stats.size())
+	{
+		text = cJSON_Print(frame_stats);
+		saved = saveText(options.stats, text, "Render stats");
+		free(text);
+	}
+	cJSON_Delete(frame_stats);
+	return saved ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+/*  Headless benchmark, renders data/scene.json with an offscreen context along a camera path
+	and saves the frame timings as JSON so runs can be compared. Launched with "main --bench [options]".
+	The offscreen context uses EGL (USE_EGL) or OSMesa (USE_OSMESA), so it also runs on Mesa llvmpipe.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+class Application;
+
+#define NUM_PIPELINE_MODES 2
+#define NUM_RENDER_MODES 11
+
+//names used in the command line, in the same order as the enums
+extern const char* pipeline_names[NUM_PIPELINE_MODES];
+extern const char* render_mode_names[NUM_RENDER_MODES];
+int findName(const char* name, const char** names, int num); //-1 if not found
+
+//creates a context with a default framebuffer of that size and makes it current
+bool createOffscreenContext(int width, int height);
+void swapOffscreen();
+
+//offscreen context plus the application with the scene, set to render the same in every run
+Application* createHeadlessApplication(int width, int height, const char* scene_filename = "data/scene.json");
+
+//returns the exit code
+int runBenchmark(int argc, char** argv);
+
+#endif
@@ -1,9 +1,13 @@
 #include "fbo.h"
 #include <cassert>
 #include "utils.h"
+#include "stats.h"
+
+std::set<FBO*> FBO::sAllFBOs;
 
 FBO::FBO()
 {
+	sAllFBOs.insert(this);
 	fbo_id = 0;
 	color_textures[0] = color_textures[1] = color_textures[2] = color_textures[3] = NULL;
 	depth_texture = NULL;
@@ -18,6 +22,7 @@ FBO::FBO()
 
 FBO::~FBO()
 {
+	sAllFBOs.erase(this);
 	freeTextures();
 	if (fbo_id)
 		glDeleteFramebuffers(1, &fbo_id);
@@ -228,6 +233,7 @@ void FBO::bind()
 	assert(tex && "framebuffer without texture");
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo_id);
 	checkGLErrors();
+	RENDER_STATS_ADD(fbo_binds, 1);
 	glPushAttrib(GL_VIEWPORT_BIT);
 	glDrawBuffers(4, bufs);
 	glViewport(0, 0, (int)tex->width, (int)tex->height);
@@ -9,6 +9,9 @@
 
 class FBO {
 public:
+	static std::set<FBO*> sAllFBOs; //every FBO alive, for the memory report
+
+	std::string name; //only used to identify it in reports
 	GLuint fbo_id; 
 	Texture* color_textures[4];
 	Texture* depth_texture;
@@ -10,6 +10,53 @@
 #include <algorithm>
 #include <iostream>
 
+#ifdef USE_SSE_MATH
+	#include <emmintrin.h>
+	#ifdef __AVX__
+		#include <immintrin.h>
+	#endif
+
+//sum of the four lanes of a * b
+static inline float dot4(__m128 a, __m128 b)
+{
+	__m128 d = _mm_mul_ps(a, b);
+	d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+	d = _mm_add_ss(d, _mm_movehl_ps(d, d));
+	return _mm_cvtss_f32(d);
+}
+
+//only xyz, the w lanes must be 0 and stay 0
+static inline __m128 cross3(__m128 a, __m128 b)
+{
+	__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+//v.x * row0 + v.y * row1 + v.z * row2 + w * row3, rows of a row-major matrix
+static inline __m128 transformRows(const float* m, float x, float y, float z, float w)
+{
+	__m128 r = _mm_mul_ps(_mm_loadu_ps(m), _mm_set1_ps(x));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_set1_ps(y)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 8), _mm_set1_ps(z)));
+	return _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 12), _mm_set1_ps(w)));
+}
+#endif
+
+const char* getMathBackend()
+{
+#ifdef USE_SSE_MATH
+	#ifdef __AVX__
+		return "AVX";
+	#else
+		return "SSE";
+	#endif
+#else
+	return "scalar";
+#endif
+}
+
 #define M_PI_2 1.57079632679489661923
 
 //**************************************
@@ -72,23 +119,25 @@ Vector2 operator - (const Vector2& a, const Vector2& b) { return Vector2(a.x - b
 
 // **************************************
 
+//computed in float, it still returns a double to keep the API
 double Vector3::length() 
 {
-	return sqrt(x*x + y*y + z*z);
+	return sqrtf(x*x + y*y + z*z);
 }
 
 double Vector3::length() const
 {
-	return sqrt(x*x + y*y + z*z);
+	return sqrtf(x*x + y*y + z*z);
 }
 
 Vector3& Vector3::normalize()
 {
-	double len = length();
+	float len = sqrtf(x*x + y*y + z*z);
 	assert(len > 0.00000000001 && "Cannot normalize a vector with module 0");
-	x = (float)(x / len);
-	y = (float)(y / len);
-	z = (float)(z / len);
+	float inv_len = 1.0f / len;
+	x *= inv_len;
+	y *= inv_len;
+	z *= inv_len;
 	return *this;
 }
 
@@ -438,6 +487,32 @@ Vector3 Matrix44::project(const Vector3& v)
 
 //Multiply a matrix by another and returns the result
 Matrix44 Matrix44::operator*(const Matrix44& matrix) const
+{
+#ifdef USE_SSE_MATH
+	Matrix44 ret;
+	#ifdef __AVX__
+		//two rows at once, every row of the result is the rows of the other matrix weighted by this row
+		for (int i = 0; i < 16; i += 8)
+		{
+			__m256 a = _mm256_loadu_ps(m + i);
+			__m256 r = _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x00), _mm256_broadcast_ps((const __m128*)(matrix.m)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x55), _mm256_broadcast_ps((const __m128*)(matrix.m + 4))));
+			r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xAA), _mm256_broadcast_ps((const __m128*)(matrix.m + 8))));
+			r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xFF), _mm256_broadcast_ps((const __m128*)(matrix.m + 12))));
+			_mm256_storeu_ps(ret.m + i, r);
+		}
+	#else
+		//every row of the result is the rows of the other matrix weighted by this row
+		for (int i = 0; i < 16; i += 4)
+			_mm_storeu_ps(ret.m + i, transformRows(matrix.m, m[i], m[i + 1], m[i + 2], m[i + 3]));
+	#endif
+	return ret;
+#else
+	return multiplyScalar(*this, matrix);
+#endif
+}
+
+Matrix44 multiplyScalar(const Matrix44& a, const Matrix44& b)
 {
 	Matrix44 ret;
 
@@ -448,7 +523,7 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 		{
 			ret.M[i][j]=0.0;
 			for (k=0;k<4;k++) 
-				ret.M[i][j] += M[i][k] * matrix.M[k][j];
+				ret.M[i][j] += a.M[i][k] * b.M[k][j];
 		}
 	}
 
@@ -548,13 +623,85 @@ void Matrix44::setFrontAndOrthonormalize(Vector3 front)
 }
 
 bool Matrix44::inverse()
+{
+	//model matrices are affine, only the projections need the general inverse
+	if (isAffine())
+		return inverseAffine();
+	return inverseScalar(*this);
+}
+
+//the inverse of [A 0; t 1] is [inv(A) 0; -t*inv(A) 1], inv(A) comes from the cross products of its rows
+bool Matrix44::inverseAffine()
+{
+#ifdef USE_SSE_MATH
+	__m128 r0 = _mm_loadu_ps(m);
+	__m128 r1 = _mm_loadu_ps(m + 4);
+	__m128 r2 = _mm_loadu_ps(m + 8);
+	__m128 c0 = cross3(r1, r2);
+	__m128 c1 = cross3(r2, r0);
+	__m128 c2 = cross3(r0, r1);
+	float det = dot4(r0, c0);
+	if (fabsf(det) <= 1e-15f || !std::isfinite(det))
+		return false;
+
+	__m128 inv_det = _mm_set1_ps(1.0f / det);
+	c0 = _mm_mul_ps(c0, inv_det);
+	c1 = _mm_mul_ps(c1, inv_det);
+	c2 = _mm_mul_ps(c2, inv_det);
+	__m128 c3 = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3); //now they are the rows of inv(A)
+
+	__m128 t = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(m[12])), _mm_add_ps(_mm_mul_ps(c1, _mm_set1_ps(m[13])), _mm_mul_ps(c2, _mm_set1_ps(m[14]))));
+	_mm_storeu_ps(m, c0);
+	_mm_storeu_ps(m + 4, c1);
+	_mm_storeu_ps(m + 8, c2);
+	_mm_storeu_ps(m + 12, _mm_sub_ps(_mm_setzero_ps(), t));
+	m[15] = 1.0f;
+	return true;
+#else
+	return inverseAffineScalar(*this);
+#endif
+}
+
+bool inverseAffineScalar(Matrix44& matrix)
+{
+	Vector3 r0(matrix.m[0], matrix.m[1], matrix.m[2]);
+	Vector3 r1(matrix.m[4], matrix.m[5], matrix.m[6]);
+	Vector3 r2(matrix.m[8], matrix.m[9], matrix.m[10]);
+	Vector3 t(matrix.m[12], matrix.m[13], matrix.m[14]);
+	Vector3 c0 = r1.cross(r2);
+	Vector3 c1 = r2.cross(r0);
+	Vector3 c2 = r0.cross(r1);
+	float det = r0.dot(c0);
+	if (fabsf(det) <= 1e-15f || !std::isfinite(det))
+		return false;
+
+	float inv_det = 1.0f / det;
+	c0 *= inv_det;
+	c1 *= inv_det;
+	c2 *= inv_det;
+	for (int i = 0; i < 3; ++i)
+	{
+		matrix.M[i][0] = c0.v[i];
+		matrix.M[i][1] = c1.v[i];
+		matrix.M[i][2] = c2.v[i];
+		matrix.M[i][3] = 0.0f;
+	}
+	matrix.m[12] = -t.dot(c0);
+	matrix.m[13] = -t.dot(c1);
+	matrix.m[14] = -t.dot(c2);
+	matrix.m[15] = 1.0f;
+	return true;
+}
+
+bool inverseScalar(Matrix44& matrix)
 {
    unsigned int i, j, k, swap;
    float t;
    Matrix44 temp, final;
    final.setIdentity();
 
-   temp = (*this);
+   temp = matrix;
 
    unsigned int m,n;
    m = n = 4;
@@ -615,7 +762,7 @@ bool Matrix44::inverse()
       }
    }
 
-   *this = final;
+   matrix = final;
 
    return true;
 }
@@ -1309,6 +1456,33 @@ float signedDistanceToPlane( const Vector4& plane, const Vector3& point )
 const Vector3 corners[] = { {1,1,1},  {1,1,-1},  {1,-1,1},  {1,-1,-1},  {-1,1,1},  {-1,1,-1},  {-1,-1,1},  {-1,-1,-1} };
 
 BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box)
+{
+	if (m.isAffine())
+		return transformAABB(m, box);
+	return transformBoundingBoxScalar(m, box);
+}
+
+//the center is transformed and every axis of the matrix adds its extent to the halfsize
+BoundingBox transformAABB(const Matrix44& m, const BoundingBox& box)
+{
+#ifdef USE_SSE_MATH
+	__m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	float c[4], h[4];
+	_mm_storeu_ps(c, transformRows(m.m, box.center.x, box.center.y, box.center.z, 1.0f));
+	__m128 half = _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(m.m), abs_mask), _mm_set1_ps(box.halfsize.x));
+	half = _mm_add_ps(half, _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(m.m + 4), abs_mask), _mm_set1_ps(box.halfsize.y)));
+	half = _mm_add_ps(half, _mm_mul_ps(_mm_and_ps(_mm_loadu_ps(m.m + 8), abs_mask), _mm_set1_ps(box.halfsize.z)));
+	_mm_storeu_ps(h, half);
+	return BoundingBox(Vector3(c[0], c[1], c[2]), Vector3(h[0], h[1], h[2]));
+#else
+	Vector3 halfsize;
+	for (int j = 0; j < 3; ++j)
+		halfsize.v[j] = fabsf(m.M[0][j]) * box.halfsize.x + fabsf(m.M[1][j]) * box.halfsize.y + fabsf(m.M[2][j]) * box.halfsize.z;
+	return BoundingBox(m * box.center, halfsize);
+#endif
+}
+
+BoundingBox transformBoundingBoxScalar(const Matrix44& m, const BoundingBox& box)
 {
 	Vector3 box_min(10000000.0f,1000000.0f, 1000000.0f);
 	Vector3 box_max(-10000000.0f, -1000000.0f, -1000000.0f);
@@ -14,6 +14,13 @@
 #define DEG2RAD 0.0174532925
 #define RAD2DEG 57.295779513
 
+//the matrix product, the affine inverse and the bounding box transform use SSE when the compiler targets it,
+//which is always on x86-64, AVX is used too when enabled (-mavx). Define NO_SIMD_MATH to use only the scalar code
+//vectors and quaternions stay scalar, with 3 or 4 floats the shuffles cost more than they save
+#if !defined(NO_SIMD_MATH) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define USE_SSE_MATH
+#endif
+
 //more standard type definition
 typedef char int8;
 typedef unsigned char uint8;
@@ -228,7 +235,9 @@ class Matrix44
 		Vector3 topVector() { return Vector3(m[4],m[5],m[6]); }
 		Vector3 frontVector() { return Vector3(m[8],m[9],m[10]); }
 
-		bool inverse();
+		bool inverse(); //uses inverseAffine when the last column is (0,0,0,1)
+		bool inverseAffine(); //only for rotation, scale and translation (no projection)
+		bool isAffine() const { return m[3] == 0.0f && m[7] == 0.0f && m[11] == 0.0f && m[15] == 1.0f; }
 		void setUpAndOrthonormalize(Vector3 up);
 		void setFrontAndOrthonormalize(Vector3 front);
 
@@ -373,6 +382,14 @@ public:
 //applies a transform to a AABB from object to world
 BoundingBox mergeBoundingBoxes(const BoundingBox& a, const BoundingBox& b);
 BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
+BoundingBox transformAABB(const Matrix44& m, const BoundingBox& box); //only for affine matrices, no need to transform the 8 corners
+
+//scalar versions of the SIMD paths, kept as reference to check them (tools/microbench)
+const char* getMathBackend(); //"AVX", "SSE" or "scalar"
+Matrix44 multiplyScalar(const Matrix44& a, const Matrix44& b);
+bool inverseScalar(Matrix44& m); //gauss-jordan, works with any matrix
+bool inverseAffineScalar(Matrix44& m);
+BoundingBox transformBoundingBoxScalar(const Matrix44& m, const BoundingBox& box); //transforms the 8 corners
 
 float signedDistanceToPlane(const Vector4& plane, const Vector3& point);
 int planeBoxOverlap( const Vector4& plane, const Vector3& center, const Vector3& halfsize );
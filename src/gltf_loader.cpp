@@ -6,12 +6,24 @@
 #include "extra/cgltf.h"
 
 #include "mesh.h"
+#include "mesh_optimizer.h"
 #include "texture.h"
+#include "texture_compressor.h"
+#include "texture_cache.h"
 #include "material.h"
 #include "prefab.h"
 #include "utils.h"
+#include "profiler.h"
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+
+#ifdef USE_SSE_MATH
+	#include <emmintrin.h>
+#endif
 
 //** PARSING GLTF IS UGLY
 std::string base_folder;
@@ -22,217 +34,414 @@ std::string base_folder;
 	bool load_textures = true; //must textures be loadead?
 #endif
 
-void parseGLTFBufferVector3(std::vector<Vector3>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+//reads an accessor as floats: packed floats are copied as they are, integers are converted (normalized ones to [0,1] or [-1,1])
+//sparse accessors and accessors with a different number of components go through cgltf
+bool readGLTFAccessor(cgltf_accessor* acc, float* output, int components)
 {
-	int i = 0;
+	size_t count = acc->count;
+	if (!count)
+		return true;
 
-	assert(acc->buffer_view->buffer->data);
-	unsigned char* data = (unsigned char*)(acc->buffer_view->buffer->data) + acc->buffer_view->offset + acc->offset;
-	if (acc->normalized)
+	if (acc->sparse.count || !acc->buffer_view || !acc->buffer_view->buffer->data || cgltf_num_components(acc->type) != components)
 	{
-		//denormalize
-		assert(!"TO DO");
+		if (acc->sparse.count && cgltf_num_components(acc->type) == components)
+			return cgltf_accessor_unpack_floats(acc, output, count * components) != 0;
+		for (size_t i = 0; i < count; ++i)
+			if (!cgltf_accessor_read_float(acc, i, output + i * components, components))
+				return false;
+		return true;
 	}
-	int num_elements = acc->count;
-	std::vector<Vector3> unindexed;
-	unindexed.resize(num_elements);
-	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec3);
-	if (acc->stride == sizeof(Vector3))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector3));
-	else
+
+	const unsigned char* data = (const unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+	size_t component_size = cgltf_component_size(acc->component_type);
+	size_t element_size = component_size * components;
+	size_t stride = acc->stride ? acc->stride : element_size;
+
+	if (acc->component_type == cgltf_component_type_r_32f)
 	{
-		for (int i = 0; i < num_elements; ++i)
+		if (stride == element_size)
+			memcpy(output, data, count * element_size);
+		else
+			for (size_t i = 0; i < count; ++i)
+				memcpy(output + i * components, data + i * stride, element_size);
+		return true;
+	}
+
+	float scale = 1.0f;
+	if (acc->normalized)
+		switch (acc->component_type)
 		{
-			memcpy(&unindexed[i], data, sizeof(Vector3));
-			data += acc->stride;
+		case cgltf_component_type_r_8: scale = 1.0f / 127.0f; break;
+		case cgltf_component_type_r_8u: scale = 1.0f / 255.0f; break;
+		case cgltf_component_type_r_16: scale = 1.0f / 32767.0f; break;
+		case cgltf_component_type_r_16u: scale = 1.0f / 65535.0f; break;
+		default: break;
 		}
-	}
+	bool is_signed = acc->component_type == cgltf_component_type_r_8 || acc->component_type == cgltf_component_type_r_16;
 
-	if (!indices_acc)
+	size_t done = 0;
+#ifdef USE_SSE_MATH
+	//packed unsigned shorts, the usual quantized uvs and positions, 8 values at a time
+	if (stride == element_size && acc->component_type == cgltf_component_type_r_16u)
 	{
-		container = unindexed;
-		return;
+		size_t total = count * components;
+		__m128 mult = _mm_set1_ps(scale);
+		__m128i zero = _mm_setzero_si128();
+		for (; done + 8 <= total; done += 8)
+		{
+			__m128i values = _mm_loadu_si128((const __m128i*)(data + done * 2));
+			_mm_storeu_ps(output + done, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero)), mult));
+			_mm_storeu_ps(output + done + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero)), mult));
+		}
 	}
+#endif
 
-	container.resize(indices_acc->count);
-
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (int i = 0; i < indices_acc->count; ++i)
+	for (size_t i = done / components; i < count; ++i) //an element converted in part is done again
 	{
-		int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
+		const unsigned char* element = data + i * stride;
+		float* out = output + i * components;
+		for (int j = 0; j < components; ++j)
 		{
-		case cgltf_component_type_r_8u: index = (int)*pos; break;
-		case cgltf_component_type_r_16u: index = (int)*(unsigned short*)pos; break;
-		case cgltf_component_type_r_32u: index = (int)*(unsigned int*)pos; break;
+			float value = 0;
+			switch (acc->component_type)
+			{
+			case cgltf_component_type_r_8: value = (float)((const signed char*)element)[j]; break;
+			case cgltf_component_type_r_8u: value = (float)element[j]; break;
+			case cgltf_component_type_r_16: value = (float)((const short*)element)[j]; break;
+			case cgltf_component_type_r_16u: value = (float)((const unsigned short*)element)[j]; break;
+			case cgltf_component_type_r_32u: value = (float)((const unsigned int*)element)[j]; break;
+			default: break;
+			}
+			value *= scale;
+			out[j] = (is_signed && acc->normalized && value < -1.0f) ? -1.0f : value;
 		}
-		if (index < unindexed.size()) //sometimes indices are out of bounds
-			container[i] = unindexed[index];
-		else
-			std::cout << "index out of bounds:" << index << std::endl;
 	}
+	return true;
 }
 
-void parseGLTFBufferVector2(std::vector<Vector2>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor* acc)
 {
-	assert(acc->buffer_view->buffer->data);
-	unsigned char* data = (unsigned char*)(acc->buffer_view->buffer->data) + acc->offset + acc->buffer_view->offset;
-	if (acc->normalized)
-	{
-		//denormalize
-		assert(!"TO DO");
-	}
-	int num_elements = acc->count;
-	std::vector<Vector2> unindexed;
-	unindexed.resize(num_elements);
-	assert(acc->component_type == cgltf_component_type_r_32f && acc->type == cgltf_type_vec2);
-	if (acc->stride == sizeof(Vector2))
-		memcpy(&unindexed[0], data, num_elements * sizeof(Vector2));
-	else
+	container.resize(acc->count);
+	if (!acc->count)
+		return;
+	unsigned int *final_indices = (unsigned int*)&container[0];
+
+	assert(acc->sparse.count == 0); //sparse not supported yet
+
+	const unsigned char* indices = (const unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
+	size_t stride = acc->stride;
+	size_t count = acc->count;
+	size_t i = 0;
+	switch (acc->component_type)
 	{
-		for (int i = 0; i < num_elements; ++i)
-		{
-			memcpy(&unindexed[i], data, sizeof(Vector2));
-			data += acc->stride;
-		}
+	case cgltf_component_type_r_32u:
+		if (stride == sizeof(unsigned int))
+			memcpy(final_indices, indices, count * sizeof(unsigned int));
+		else
+			for (; i < count; ++i)
+				final_indices[i] = *(const unsigned int*)(indices + i * stride);
+		break;
+	case cgltf_component_type_r_16u:
+#ifdef USE_SSE_MATH
+		if (stride == sizeof(unsigned short))
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128i values = _mm_loadu_si128((const __m128i*)(indices + i * 2));
+				_mm_storeu_si128((__m128i*)(final_indices + i), _mm_unpacklo_epi16(values, _mm_setzero_si128()));
+				_mm_storeu_si128((__m128i*)(final_indices + i + 4), _mm_unpackhi_epi16(values, _mm_setzero_si128()));
+			}
+#endif
+		for (; i < count; ++i)
+			final_indices[i] = *(const unsigned short*)(indices + i * stride);
+		break;
+	case cgltf_component_type_r_8u:
+		for (; i < count; ++i)
+			final_indices[i] = indices[i * stride];
+		break;
+	default:
+		assert(!"wrong index type");
 	}
+}
+
+//decodes the accessor and, if indices are passed, unindexes it
+template<typename T> void parseGLTFBuffer(std::vector<T>& container, cgltf_accessor* acc, int components, cgltf_accessor* indices_acc = NULL)
+{
+	std::vector<T> unindexed(acc->count);
+	if (acc->count && !readGLTFAccessor(acc, (float*)&unindexed[0], components))
+		std::cout << "[ERROR] cannot read glTF accessor" << std::endl;
 
 	if (!indices_acc)
 	{
-		container = unindexed;
+		container.swap(unindexed);
 		return;
 	}
 
-	container.resize(indices_acc->count);
-
-	assert(indices_acc->sparse.count == 0); //sparse not supported yet
-
-	unsigned char* indices = (unsigned char*)indices_acc->buffer_view->buffer->data + indices_acc->offset;
-	int stride = indices_acc->stride;
-	for (int i = 0; i < indices_acc->count; ++i)
+	std::vector<unsigned int> indices;
+	parseGLTFBufferIndices(indices, indices_acc);
+	container.resize(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i)
 	{
-		unsigned int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (indices_acc->component_type)
-		{
-		case cgltf_component_type_r_8u: index = static_cast<unsigned int>(*pos); break;
-		case cgltf_component_type_r_16u: index = static_cast<unsigned int>(*(unsigned short*)pos); break;
-		case cgltf_component_type_r_32u: index = static_cast<unsigned int>(*(unsigned int*)pos); break;
-		}
-		if (index < unindexed.size())  //sometimes indices are out of bounds
-			container[i] = unindexed[index];
+		if (indices[i] < unindexed.size()) //sometimes indices are out of bounds
+			container[i] = unindexed[indices[i]];
 		else
-			std::cout << "index out of bounds:" << index << std::endl;
+			std::cout << "index out of bounds:" << indices[i] << std::endl;
 	}
+}
 
+void parseGLTFBufferVector3(std::vector<Vector3>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
+{
+	parseGLTFBuffer(container, acc, 3, indices_acc);
 }
 
-void parseGLTFBufferIndices(std::vector<unsigned int>& container, cgltf_accessor* acc)
+void parseGLTFBufferVector2(std::vector<Vector2>& container, cgltf_accessor* acc, cgltf_accessor* indices_acc = NULL)
 {
-	container.resize(acc->count);
-	unsigned int *final_indices = (unsigned int*)&container[0];
+	parseGLTFBuffer(container, acc, 2, indices_acc);
+}
 
-	assert(acc->sparse.count == 0); //sparse not supported yet
+//one primitive to import, decoding only touches the CPU so it can run in any thread
+struct sGLTFPrimitiveJob {
+	cgltf_primitive* primitive;
+	Mesh* mesh;
+	std::string name; //empty if the mesh has no name
+	bool optimized;
+	sMeshOptimizationStats optimization;
+};
+
+void decodeGLTFPrimitive(sGLTFPrimitiveJob& job)
+{
+	cgltf_primitive* primitive = job.primitive;
+	Mesh* mesh = job.mesh;
 
-	unsigned char* indices = (unsigned char*)acc->buffer_view->buffer->data + acc->buffer_view->offset + acc->offset;
-	int stride = acc->stride;
-	for (int i = 0; i < acc->count; ++i)
+	//streams
+	for (int j = 0; j < primitive->attributes_count; ++j)
 	{
-		unsigned int index = 0;
-		unsigned char* pos = indices + i * stride;
-		switch (acc->component_type)
+		cgltf_attribute* attr = &primitive->attributes[j];
+
+		//std::string attrname = attr->name;
+		if (attr->type == cgltf_attribute_type_position)
 		{
-		case cgltf_component_type_r_8u: index = static_cast<unsigned int>(*pos); break;
-		case cgltf_component_type_r_16u: index = static_cast<unsigned int>(*(unsigned short*)pos); break;
-		case cgltf_component_type_r_32u: index = static_cast<unsigned int>(*(unsigned int*)pos); break;
+			parseGLTFBufferVector3(mesh->vertices, attr->data);
+			if (attr->data->has_min && attr->data->has_max)
+			{
+				mesh->aabb_min = attr->data->min;
+				mesh->aabb_max = attr->data->max;
+				mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
+				mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
+			}
+			else
+				mesh->updateBoundingBox();
+		}
+		else
+		if (attr->type == cgltf_attribute_type_normal)
+			parseGLTFBufferVector3(mesh->normals, attr->data);
+		else
+		if (attr->type == cgltf_attribute_type_texcoord)
+		{
+			if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
+				parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
+			else
+				parseGLTFBufferVector2(mesh->uvs, attr->data);
 		}
-		final_indices[i] = index;
 	}
+
+	if (primitive->indices && primitive->indices->count)
+		parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
+
+	//imported meshes are never baked, so they are optimized here
+	job.optimized = optimizeMesh(mesh, &job.optimization);
 }
 
-std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
+//decodes in worker threads, then uploads and registers in the main thread (GL and the mesh registry are not thread safe)
+void importGLTFPrimitives(std::vector<sGLTFPrimitiveJob>& jobs)
 {
-	std::vector<Mesh*> result;
+	{
+		CPU_SCOPE("decodeGLTF");
+		std::atomic<int> next(0);
+		parallelFor(std::min(getNumWorkerThreads(), (int)jobs.size()), [&](int thread) {
+			for (int i = next++; i < (int)jobs.size(); i = next++)
+				decodeGLTFPrimitive(jobs[i]);
+		});
+	}
 
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		sGLTFPrimitiveJob& job = jobs[i];
+		if (job.optimized)
+			stdlog("\t\tACMR " + std::to_string(job.optimization.acmr_before) + " -> " + std::to_string(job.optimization.acmr_after));
+		job.mesh->setQuantization(Mesh::quantize_meshes);
+		job.mesh->uploadToVRAM();
+		if (job.name.size())
+			job.mesh->registerMesh(job.name);
+	}
+}
+
+//primitives of every mesh of the file, filled by parseGLTFMeshes so the nodes do not decode them again
+std::map<cgltf_mesh*, std::vector<Mesh*>> gltf_meshes;
+
+//finds the primitives already loaded and adds a job for the others
+void addGLTFMeshJobs(cgltf_mesh* meshdata, std::vector<Mesh*>& result, std::vector<sGLTFPrimitiveJob>& jobs)
+{
 	if (meshdata->name)
 		stdlog( std::string("\t<- MESH: ") + meshdata->name);
 
-    //submeshes
+	//submeshes
+	result.resize(meshdata->primitives_count);
 	for (int i = 0; i < meshdata->primitives_count; ++i)
 	{
-		cgltf_primitive* primitive = &meshdata->primitives[i];
-		Mesh* mesh = NULL;
-
-		std::string submesh_name;
+		sGLTFPrimitiveJob job;
+		job.primitive = &meshdata->primitives[i];
+		job.optimized = false;
 		if (meshdata->name)
 		{
-			submesh_name = std::string(meshdata->name) + std::string("::") + std::to_string(i);
-			mesh = Mesh::Get(submesh_name.c_str(), true);
-			if (mesh)
-			{
-				result.push_back(mesh);
+			job.name = std::string(meshdata->name) + std::string("::") + std::to_string(i);
+			result[i] = Mesh::Get(job.name.c_str(), true);
+			if (result[i])
 				continue;
-			}
 		}
+		job.mesh = result[i] = new Mesh();
+		jobs.push_back(job);
+	}
+}
 
-		mesh = new Mesh();
-
-        //streams
-		for (int j = 0; j < primitive->attributes_count; ++j)
-		{
-			cgltf_attribute* attr = &primitive->attributes[j];
-
-            //std::string attrname = attr->name;
-			if (attr->type == cgltf_attribute_type_position)
-			{
-				parseGLTFBufferVector3(mesh->vertices, attr->data);
-				if (attr->data->has_min && attr->data->has_max)
-				{
-					mesh->aabb_min = attr->data->min;
-					mesh->aabb_max = attr->data->max;
-					mesh->box.center = (mesh->aabb_max + mesh->aabb_min) * 0.5f;
-					mesh->box.halfsize = mesh->aabb_max - mesh->box.center;
-				}
-				else
-					mesh->updateBoundingBox();
-			}
-			else
-			if (attr->type == cgltf_attribute_type_normal)
-				parseGLTFBufferVector3(mesh->normals, attr->data);
-			else
-			if (attr->type == cgltf_attribute_type_texcoord)
-			{
-				if (strcmp(attr->name,"TEXCOORD_1") == 0) //secondary UV set
-					parseGLTFBufferVector2(mesh->m_uvs1, attr->data);
-				else
-					parseGLTFBufferVector2(mesh->uvs, attr->data);
-			}
+//imports all the meshes of the file at once, so primitives of different meshes are decoded in parallel too
+void parseGLTFMeshes(cgltf_data* data)
+{
+	CPU_SCOPE("parseGLTFMeshes");
+	gltf_meshes.clear();
+	std::vector<sGLTFPrimitiveJob> jobs;
+	for (int i = 0; i < data->meshes_count; ++i)
+		addGLTFMeshJobs(&data->meshes[i], gltf_meshes[&data->meshes[i]], jobs);
+	importGLTFPrimitives(jobs);
+}
 
-			if (primitive->indices && primitive->indices->count)
-				parseGLTFBufferIndices(mesh->m_indices, primitive->indices);
-		}
-		mesh->uploadToVRAM();
-		if (meshdata->name)
-			mesh->registerMesh(submesh_name);
-		result.push_back(mesh);
-	}
+std::vector<Mesh*> parseGLTFMesh(cgltf_mesh* meshdata)
+{
+	auto it = gltf_meshes.find(meshdata);
+	if (it != gltf_meshes.end())
+		return it->second;
 
+	std::vector<Mesh*> result;
+	std::vector<sGLTFPrimitiveJob> jobs;
+	addGLTFMeshJobs(meshdata, result, jobs);
+	importGLTFPrimitives(jobs);
 	return result;
 }
 
 int GLTF_TEXTURE_LAST_ID = 1;
+GTR::Prefab* gltf_prefab = NULL; //the one being loaded, it keeps the embedded images for its .pbin
+
+//an image of the file decoded by parseGLTFImages, parseGLTFTexture only uploads it
+struct sGLTFImageJob {
+	cgltf_image* image = NULL;
+	std::string path; //for images with a file, empty if embedded
+	std::vector<unsigned char> buffer; //embedded bytes, the .pbin keeps them
+	eTextureCompression compression = TEXTURE_UNCOMPRESSED; //only images with a file, the .tbin is next to it
+	sCompressedImage compressed;
+	bool srgb = true; //false for normal maps, how the mips of the .rbin are filtered
+	sRawImage raw; //the .rbin of images with a file that are not compressed
+	Image decoded;
+	bool ok = false;
+	long time = 0; //ms decoding
+};
+
+std::map<cgltf_image*, sGLTFImageJob> gltf_images;
+
+void decodeGLTFImage(sGLTFImageJob& job)
+{
+	long time = getTime();
+	if (job.compression != TEXTURE_UNCOMPRESSED && loadCompressedImage(job.path.c_str(), job.compression, true, job.compressed))
+		job.ok = true;
+	else if (job.path.size() && Texture::use_cache && loadRawImage(job.path.c_str(), true, job.srgb, job.raw))
+		job.ok = true;
+	else if (job.path.size())
+		job.ok = job.decoded.load(job.path.c_str());
+	else
+	{
+		cgltf_buffer_view* view = job.image->buffer_view;
+		const unsigned char* data = (const unsigned char*)view->buffer->data + view->offset;
+		job.buffer.assign(data, data + view->size);
+		if (!strcmp(job.image->mime_type, "image/png"))
+			job.ok = job.decoded.loadPNG(job.buffer);
+		else if (!strcmp(job.image->mime_type, "image/jpeg"))
+			job.ok = job.decoded.loadJPG(job.buffer);
+	}
+	job.ok = job.ok && (job.decoded.width || job.compressed.data.size() || job.raw.data);
+	job.time = getTime() - time;
+}
 
-Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
+//decodes at once, in worker threads, the images the materials will use and that are not loaded yet
+void parseGLTFImages(cgltf_data* data)
+{
+	CPU_SCOPE("parseGLTFImages");
+	gltf_images.clear();
+	if (!load_textures)
+		return;
+
+	//normal maps get their own compression and their mips are not filtered as colors
+	std::set<cgltf_image*> normal_images;
+	bool compress = Texture::canCompress();
+	for (int i = 0; i < data->materials_count; ++i)
+		if (data->materials[i].normal_texture.texture)
+			normal_images.insert(data->materials[i].normal_texture.texture->image);
+
+	std::vector<sGLTFImageJob*> jobs;
+	for (int i = 0; i < data->textures_count; ++i)
+	{
+		cgltf_texture* texture = &data->textures[i];
+		cgltf_image* image = texture->image;
+		if (!image || gltf_images.count(image))
+			continue;
+		std::string path;
+		if (image->uri)
+			path = base_folder + "/" + image->uri;
+		else if (!image->buffer_view || !image->mime_type)
+			continue;
+		if (Texture::Find(path.size() ? path.c_str() : (base_folder + "/" + (texture->name ? texture->name : "")).c_str()))
+			continue;
+		sGLTFImageJob& job = gltf_images[image];
+		job.image = image;
+		job.path = path;
+		job.srgb = !normal_images.count(image);
+		if (compress && path.size())
+			job.compression = job.srgb ? TEXTURE_COMPRESS_COLOR : TEXTURE_COMPRESS_NORMALMAP;
+		jobs.push_back(&job);
+	}
+
+	std::atomic<int> next(0);
+	parallelFor(std::min(getNumWorkerThreads(), (int)jobs.size()), [&](int thread) {
+		for (int i = next++; i < (int)jobs.size(); i = next++)
+			decodeGLTFImage(*jobs[i]);
+	});
+}
+
+Texture* parseGLTFTexture(cgltf_image* image, const char* filename, eTextureCompression compression = TEXTURE_COMPRESS_COLOR)
 {
 	if (!load_textures || !image )
 		return NULL;
 
 	std::string fullpath = filename ? filename : "";
+	auto it = gltf_images.find(image);
+	sGLTFImageJob* job = it != gltf_images.end() && it->second.ok ? &it->second : NULL;
 
 	if (image->uri)
-		return Texture::Get((std::string(base_folder) + "/" + image->uri).c_str());
+	{
+		fullpath = std::string(base_folder) + "/" + image->uri;
+		Texture* tex = Texture::Find(fullpath.c_str());
+		if (tex || !job)
+			return tex ? tex : Texture::Get(fullpath.c_str(), true, true, compression);
+		tex = new Texture();
+		if (job->compressed.data.size())
+			tex->loadFromCompressedImage(&job->compressed);
+		else if (job->raw.data)
+			tex->loadFromRawImage(&job->raw);
+		else
+			tex->loadFromImage(&job->decoded);
+		tex->residency.streamable = (job->compressed.data.size() || job->raw.data) && tex->residency.num_levels > 1;
+		tex->residency.compression = job->compressed.data.size() ? job->compression : (job->srgb ? TEXTURE_UNCOMPRESSED : TEXTURE_COMPRESS_NORMALMAP);
+		tex->setName(fullpath.c_str());
+		stdlog(std::string("\t<- TEXTURE: ") + fullpath + (job->compressed.data.size() ? std::string(" [") + getCompressionName(job->compressed.format) + "]" : std::string()) + " decoded in " + std::to_string(job->time) + "ms");
+		return tex;
+	}
 	else
 	if (filename)
 	{
@@ -251,26 +460,41 @@ Texture* parseGLTFTexture(cgltf_image* image, const char* filename)
 	if (image->buffer_view)
 	{
 		Image img;
+		Image* decoded = &img;
 		std::vector<unsigned char> buffer;
-		buffer.resize(image->buffer_view->size);
-		memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
-
-		if (!strcmp(image->mime_type, "image/png"))
-			img.loadPNG(buffer);
-		else if (!strcmp(image->mime_type, "image/jpeg"))
-			img.loadJPG(buffer);
+		if (job) //already decoded by parseGLTFImages, the bytes are copied as the image can be used by several textures
+		{
+			decoded = &job->decoded;
+			buffer = job->buffer;
+		}
 		else
 		{
-			stdlog(std::string("image format not supported: ") + image->mime_type);
-			return NULL;
+			buffer.resize(image->buffer_view->size);
+			memcpy(&buffer[0], (char*)image->buffer_view->buffer->data + image->buffer_view->offset, image->buffer_view->size);
+
+			if (!strcmp(image->mime_type, "image/png"))
+				img.loadPNG(buffer);
+			else if (!strcmp(image->mime_type, "image/jpeg"))
+				img.loadJPG(buffer);
+			else
+			{
+				stdlog(std::string("image format not supported: ") + image->mime_type);
+				return NULL;
+			}
 		}
-		if (!img.width)
+		if (!decoded->width)
 		{
 			stdlog(std::string("image encoding has error: ") + image->mime_type);
 			return NULL;
 		}
 		Texture* tex = new Texture();
-		tex->loadFromImage(&img);
+		tex->loadFromImage(decoded);
+		if (gltf_prefab)
+		{
+			GTR::sEmbeddedImage& embedded = gltf_prefab->embedded_images[tex];
+			embedded.mime_type = image->mime_type;
+			embedded.data.swap(buffer);
+		}
 		if (filename)
 		{
 			tex->setName(fullpath.c_str());
@@ -303,7 +527,7 @@ GTR::Material* parseGLTFMaterial(cgltf_material* matdata)
 	//normalmap
 	if (matdata->normal_texture.texture)
 	{
-		material->normal_texture.texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name);
+		material->normal_texture.texture = parseGLTFTexture( matdata->normal_texture.texture->image, matdata->normal_texture.texture->name, TEXTURE_COMPRESS_NORMALMAP);
 		material->normal_texture.uv_channel = matdata->normal_texture.texcoord;
 	}
 
@@ -459,6 +683,7 @@ cgltf_result internalOpenMemory(const struct cgltf_memory_options* memory_option
 
 GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& options)
 {
+	CPU_SCOPE("loadGLTF");
 	cgltf_result result;
 
 	if (data->scenes_count > 1)
@@ -481,7 +706,17 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 		}
 	}
 
+	parseGLTFMeshes(data);
+	parseGLTFImages(data);
+
 	GTR::Prefab* prefab = new GTR::Prefab();
+	gltf_prefab = prefab;
+
+	//what the .pbin depends on, images with a file are loaded from it anyway
+	prefab->source_files.push_back(filename);
+	for (int i = 0; i < data->buffers_count; ++i)
+		if (data->buffers[i].uri && strncmp(data->buffers[i].uri, "data:", 5) != 0)
+			prefab->source_files.push_back(base_folder + "/" + data->buffers[i].uri);
 
 	{
 		if (scene->nodes_count > 1)
@@ -500,6 +735,9 @@ GTR::Prefab* loadGLTF(const char *filename, cgltf_data *data, cgltf_options& opt
 			parseGLTFNode(scene->nodes[0], &prefab->root);
 		}
 	}
+	gltf_meshes.clear(); //the cgltf data is freed after this
+	gltf_images.clear();
+	gltf_prefab = NULL;
 
 
 	//fetch first valid node (glTF sometime have lots of nested empty nodes 
@@ -0,0 +1,430 @@
+#include "golden.h"
+#include "bench.h"
+#include "includes.h"
+#include "application.h"
+#include "renderer.h"
+#include "camera.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef WIN32
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
+#endif
+
+extern GTR::Renderer* renderer; //created by the application
+
+struct sGoldenView {
+	std::string name;
+	Vector3 eye;
+	Vector3 center;
+	float fov;
+};
+
+struct sGoldenOptions {
+	std::string views = "data/golden_views.json";
+	std::string refs = "data/golden";
+	std::string output = "golden_report.json";
+	bool update = false; //store the images as the new references
+	int pipeline = -1; //-1 means all
+	int render_mode = -1;
+	float tolerance = 3.0; //delta E, around 2.3 is the smallest difference people notice
+	float max_failed_percent = 0.1; //of the pixels in the view
+	int frames = 5; //timed frames per view
+	int warmup = 2;
+	int width = 320;
+	int height = 240;
+};
+
+static void createFolder(const std::string& path)
+{
+#ifdef WIN32
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+//srgb 8 bits to CIE Lab (D65)
+static void toLab(const uint8* pixel, float* lab)
+{
+	static float linear[256];
+	static bool init = false;
+	if (!init)
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			linear[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		init = true;
+	}
+
+	float r = linear[pixel[0]], g = linear[pixel[1]], b = linear[pixel[2]];
+	float xyz[3] = {
+		(0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f,
+		0.2126f * r + 0.7152f * g + 0.0722f * b,
+		(0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f };
+	for (int i = 0; i < 3; ++i)
+		xyz[i] = xyz[i] > 0.008856f ? cbrt(xyz[i]) : 7.787f * xyz[i] + 16.0f / 116.0f;
+	lab[0] = 116.0f * xyz[1] - 16.0f;
+	lab[1] = 500.0f * (xyz[0] - xyz[1]);
+	lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+static void toLab(Image& image, std::vector<float>& lab)
+{
+	int num_pixels = image.width * image.height;
+	lab.resize(num_pixels * 3);
+	for (int i = 0; i < num_pixels; ++i)
+		toLab(image.data + i * image.num_channels, &lab[i * 3]);
+}
+
+static float deltaE(const float* a, const float* b)
+{
+	float l = a[0] - b[0], u = a[1] - b[1], v = a[2] - b[2];
+	return sqrt(l * l + u * u + v * v);
+}
+
+sImageDiff compareImages(Image& image, Image& reference, float tolerance, Image* diff_image)
+{
+	sImageDiff result;
+	memset(&result, 0, sizeof(result));
+	result.same_size = image.width == reference.width && image.height == reference.height;
+	if (!result.same_size || !image.data || !reference.data)
+	{
+		result.same_size = false;
+		result.failed_pixels = image.width * image.height;
+		result.failed_percent = 100;
+		return result;
+	}
+
+	int w = image.width, h = image.height;
+	std::vector<float> lab, ref_lab;
+	toLab(image, lab);
+	toLab(reference, ref_lab);
+
+	if (diff_image)
+		diff_image->resize(w, h, 4);
+
+	double sum = 0;
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x)
+		{
+			int i = y * w + x;
+			float d = deltaE(&lab[i * 3], &ref_lab[i * 3]);
+			sum += d;
+			result.max_delta_e = std::max(result.max_delta_e, d);
+
+			bool failed = false;
+			if (d > tolerance)
+			{
+				failed = true;
+				for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, h - 1) && failed; ++ny)
+					for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, w - 1) && failed; ++nx)
+						if (deltaE(&lab[i * 3], &ref_lab[(ny * w + nx) * 3]) <= tolerance)
+							failed = false;
+			}
+			if (failed)
+				result.failed_pixels++;
+
+			//failed pixels in red over the dimmed reference
+			if (diff_image)
+			{
+				uint8* p = diff_image->data + i * 4;
+				uint8 l = (uint8)clamp(ref_lab[i * 3] * 0.8f, 0.0f, 255.0f);
+				p[0] = failed ? 255 : l;
+				p[1] = failed ? 0 : l;
+				p[2] = failed ? 0 : l;
+				p[3] = 255;
+			}
+		}
+
+	result.mean_delta_e = sum / (w * h);
+	result.failed_percent = 100.0f * result.failed_pixels / (w * h);
+	return result;
+}
+
+static bool parseGoldenOptions(int argc, char** argv, sGoldenOptions& options)
+{
+	for (int i = 2; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		if (strcmp(arg, "--update") == 0)
+		{
+			options.update = true;
+			continue;
+		}
+
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!value)
+		{
+			std::cout << "[ERROR] missing value for " << arg << std::endl;
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--views") == 0)
+			options.views = value;
+		else if (strcmp(arg, "--refs") == 0)
+			options.refs = value;
+		else if (strcmp(arg, "--out") == 0)
+			options.output = value;
+		else if (strcmp(arg, "--tolerance") == 0)
+			options.tolerance = atof(value);
+		else if (strcmp(arg, "--max-failed") == 0)
+			options.max_failed_percent = atof(value);
+		else if (strcmp(arg, "--frames") == 0)
+			options.frames = std::max(atoi(value), 1);
+		else if (strcmp(arg, "--pipeline") == 0)
+		{
+			options.pipeline = findName(value, pipeline_names, NUM_PIPELINE_MODES);
+			if (options.pipeline == -1)
+			{
+				std::cout << "[ERROR] unknown pipeline: " << value << std::endl;
+				return false;
+			}
+		}
+		else if (strcmp(arg, "--mode") == 0)
+		{
+			options.render_mode = findName(value, render_mode_names, NUM_RENDER_MODES);
+			if (options.render_mode == -1)
+			{
+				std::cout << "[ERROR] unknown render mode: " << value << std::endl;
+				return false;
+			}
+		}
+		else
+		{
+			std::cout << "[ERROR] unknown option: " << arg << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool loadGoldenViews(sGoldenOptions& options, std::vector<sGoldenView>& views)
+{
+	std::string content;
+	if (!readFile(options.views, content))
+	{
+		std::cout << "[ERROR] golden views not found: " << options.views << std::endl;
+		return false;
+	}
+
+	cJSON* json = cJSON_Parse(content.c_str());
+	if (!json)
+	{
+		std::cout << "[ERROR] golden views is not a valid JSON: " << options.views << std::endl;
+		return false;
+	}
+
+	options.width = readJSONNumber(json, "width", options.width);
+	options.height = readJSONNumber(json, "height", options.height);
+
+	cJSON* views_json = cJSON_GetObjectItemCaseSensitive(json, "views");
+	cJSON* view_json;
+	cJSON_ArrayForEach(view_json, views_json)
+	{
+		sGoldenView view;
+		view.name = readJSONString(view_json, "name", ("view" + std::to_string(views.size())).c_str());
+		view.eye = readJSONVector3(view_json, "eye", Vector3(0, 100, 100));
+		view.center = readJSONVector3(view_json, "center", Vector3(0, 0, 0));
+		view.fov = readJSONNumber(view_json, "fov", 60);
+		views.push_back(view);
+	}
+	cJSON_Delete(json);
+
+	if (views.empty())
+	{
+		std::cout << "[ERROR] golden views file has no views: " << options.views << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//renders the view several times, the last frame stays in the screen
+static void renderView(Application* app, sGoldenOptions& options, double& cpu_ms, double& gpu_ms)
+{
+	int total = options.warmup + options.frames;
+	std::vector<GLuint> queries(total * 2);
+	glGenQueries(queries.size(), &queries[0]);
+
+	cpu_ms = 0;
+	for (int i = 0; i < total; ++i)
+	{
+		app->time = 0; //same image every frame
+		app->frame = i;
+		glQueryCounter(queries[i * 2], GL_TIMESTAMP);
+		auto start = std::chrono::steady_clock::now();
+		app->render();
+		auto end = std::chrono::steady_clock::now();
+		glQueryCounter(queries[i * 2 + 1], GL_TIMESTAMP);
+		if (i >= options.warmup)
+			cpu_ms += std::chrono::duration<double, std::milli>(end - start).count();
+	}
+	glFinish();
+
+	gpu_ms = 0;
+	for (int i = options.warmup; i < total; ++i)
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(queries[i * 2], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		gpu_ms += (end - start) / 1000000.0;
+	}
+	glDeleteQueries(queries.size(), &queries[0]);
+
+	cpu_ms /= options.frames;
+	gpu_ms /= options.frames;
+}
+
+int runGoldenTests(int argc, char** argv)
+{
+	sGoldenOptions options;
+	std::vector<sGoldenView> views;
+	if (!parseGoldenOptions(argc, argv, options) || !loadGoldenViews(options, views))
+		return 1;
+
+	Application* app = createHeadlessApplication(options.width, options.height);
+	if (!app)
+		return 1;
+	Camera* camera = app->scene_camera;
+
+	createFolder(options.refs);
+	std::string diff_folder = options.refs + "/diff";
+	if (!options.update)
+		createFolder(diff_folder);
+
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddStringToObject(root, "renderer", (const char*)glGetString(GL_RENDERER));
+	cJSON_AddNumberToObject(root, "width", options.width);
+	cJSON_AddNumberToObject(root, "height", options.height);
+	cJSON_AddNumberToObject(root, "tolerance", options.tolerance);
+	cJSON_AddNumberToObject(root, "max_failed_percent", options.max_failed_percent);
+	cJSON* list = cJSON_AddArrayToObject(root, "views");
+
+	int num_passed = 0, num_failed = 0, num_missing = 0, num_updated = 0;
+	printf("%-40s %-8s %9s %9s %9s %9s %9s\n", "view", "result", "failed%", "meanDE", "maxDE", "cpu ms", "gpu ms");
+
+	Image image, reference, diff;
+	for (int p = 0; p < NUM_PIPELINE_MODES; ++p)
+	{
+		if (options.pipeline != -1 && options.pipeline != p)
+			continue;
+		for (int m = 0; m < NUM_RENDER_MODES; ++m)
+		{
+			if (options.render_mode != -1 && options.render_mode != m)
+				continue;
+			renderer->pipeline_mode = (GTR::ePipelineMode)p;
+			renderer->render_mode = (GTR::eRenderMode)m;
+
+			for (int v = 0; v < views.size(); ++v)
+			{
+				sGoldenView& view = views[v];
+				camera->lookAt(view.eye, view.center, Vector3(0, 1, 0));
+				camera->setPerspective(view.fov, options.width / (float)options.height, camera->near_plane, camera->far_plane);
+
+				double cpu_ms, gpu_ms;
+				renderView(app, options, cpu_ms, gpu_ms);
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				image.fromScreen(options.width, options.height);
+				swapOffscreen();
+
+				std::string name = view.name + "_" + pipeline_names[p] + "_" + render_mode_names[m];
+				std::string filename = options.refs + "/" + name + ".tga";
+				const char* status = NULL;
+				sImageDiff result;
+				memset(&result, 0, sizeof(result));
+
+				if (options.update)
+				{
+					if (!image.saveTGA(filename.c_str(), true))
+					{
+						std::cout << "[ERROR] cannot write reference: " << filename << std::endl;
+						cJSON_Delete(root);
+						return 1;
+					}
+					status = "updated";
+					num_updated++;
+				}
+				else if (!reference.loadTGA(filename.c_str()))
+				{
+					status = "missing";
+					num_missing++;
+				}
+				else
+				{
+					result = compareImages(image, reference, options.tolerance, &diff);
+					reference.clear();
+					if (result.same_size && result.failed_percent <= options.max_failed_percent)
+					{
+						status = "pass";
+						num_passed++;
+					}
+					else
+					{
+						status = "FAIL";
+						num_failed++;
+						diff.saveTGA((diff_folder + "/" + name + ".tga").c_str(), true);
+					}
+				}
+
+				printf("%-40s %-8s %9.3f %9.3f %9.3f %9.3f %9.3f\n", name.c_str(), status, result.failed_percent, result.mean_delta_e, result.max_delta_e, cpu_ms, gpu_ms);
+				fflush(stdout);
+
+				cJSON* item = cJSON_CreateObject();
+				cJSON_AddStringToObject(item, "name", name.c_str());
+				cJSON_AddStringToObject(item, "view", view.name.c_str());
+				cJSON_AddStringToObject(item, "pipeline", pipeline_names[p]);
+				cJSON_AddStringToObject(item, "render_mode", render_mode_names[m]);
+				cJSON_AddStringToObject(item, "result", status);
+				cJSON_AddNumberToObject(item, "failed_pixels", result.failed_pixels);
+				cJSON_AddNumberToObject(item, "failed_percent", result.failed_percent);
+				cJSON_AddNumberToObject(item, "mean_delta_e", result.mean_delta_e);
+				cJSON_AddNumberToObject(item, "max_delta_e", result.max_delta_e);
+				cJSON_AddNumberToObject(item, "cpu_ms", cpu_ms);
+				cJSON_AddNumberToObject(item, "gpu_ms", gpu_ms);
+				cJSON_AddItemToArray(list, item);
+			}
+		}
+	}
+
+	cJSON_AddNumberToObject(root, "passed", num_passed);
+	cJSON_AddNumberToObject(root, "failed", num_failed);
+	cJSON_AddNumberToObject(root, "missing", num_missing);
+	cJSON_AddNumberToObject(root, "updated", num_updated);
+
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+	FILE* file = fopen(options.output.c_str(), "wb");
+	if (file)
+	{
+		fwrite(text, 1, strlen(text), file);
+		fclose(file);
+		std::cout << " + Golden report saved: " << options.output << std::endl;
+	}
+	else
+		std::cout << "[ERROR] cannot write golden report: " << options.output << std::endl;
+	free(text);
+
+	if (options.update)
+	{
+		std::cout << " + " << num_updated << " references saved in " << options.refs << std::endl;
+		return 0;
+	}
+
+	std::cout << " * Golden images: " << num_passed << " passed, " << num_failed << " failed, " << num_missing << " missing" << std::endl;
+	if (num_missing)
+		std::cout << "[WARN] the references are made on each machine, create the missing ones with make golden-update (--update) on a known good build" << std::endl;
+	return (num_failed || num_missing) ? 1 : 0;
+}
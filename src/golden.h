@@ -0,0 +1,30 @@
+/*  Golden image tests, renders fixed views of data/scene.json in every pipeline and render mode
+	with the offscreen context and compares them with the reference TGAs using a perceptual diff.
+	Launched with "main --golden [options]", use --update to store the current images as references.
+	The references are not in the repository, the images depend on the GPU, the driver and the assets
+	(data/night.hdre is not versioned): make them with "make golden-update" on a known good build of
+	the machine that runs the tests (Mesa llvmpipe for headless runs) before changing the renderer.
+*/
+
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include "texture.h"
+
+//result of comparing two images, delta E is the CIE76 distance in Lab space
+struct sImageDiff {
+	bool same_size;
+	int failed_pixels; //pixels over the tolerance that do not match any neighbour either
+	float failed_percent;
+	float mean_delta_e;
+	float max_delta_e;
+};
+
+//pixels differing less than tolerance (delta E) are equal, a pixel also passes if it matches
+//one of its neighbours in the reference so one pixel shifts in the rasterization are ignored
+sImageDiff compareImages(Image& image, Image& reference, float tolerance, Image* diff_image = NULL);
+
+//returns the exit code, 0 if every view matches its reference
+int runGoldenTests(int argc, char** argv);
+
+#endif
@@ -15,6 +15,11 @@
 #include "utils.h"
 #include "input.h"
 #include "application.h"
+#include "profiler.h"
+#include "bench.h"
+#include "golden.h"
+#include "asset_loader.h"
+#include "texture_residency.h"
 
 #include <iostream> //to output
 
@@ -125,14 +130,21 @@ void mainLoop(SDL_Window* window)
 	long now = start_time;
 	long frames_this_second = 0;
 
+	CPU_THREAD_NAME("main");
+
 	while (!app->must_exit)
 	{
+		CPU_SCOPE("frame");
+
 		//render frame
 		app->render();
 		if (app->render_gui)
 			renderDebug(window, app);
 		// swap between front buffer and back buffer
-		SDL_GL_SwapWindow(window);
+		{
+			CPU_SCOPE("swap");
+			SDL_GL_SwapWindow(window);
+		}
 
 		//update events
 		while(SDL_PollEvent(&sdlEvent))
@@ -194,6 +206,12 @@ void mainLoop(SDL_Window* window)
 			frames_this_second = 0;
 		}
 
+		//finish the assets loaded in the background, within its time budget
+		AssetLoader::update();
+
+		//fit the textures used in the frame rendered into the VRAM budget
+		TextureResidency::update();
+
 		//update app logic
 		app->update(elapsed_time);
 
@@ -210,6 +228,15 @@ int main(int argc, char **argv)
 {
 	std::cout << "Initiating app..." << std::endl;
 
+	//headless benchmark, it creates its own context without a window
+	//the asset loader threads must end before the globals are destroyed
+	if (argc > 1 && (strcmp(argv[1], "--bench") == 0 || strcmp(argv[1], "--golden") == 0))
+	{
+		int result = strcmp(argv[1], "--bench") == 0 ? runBenchmark(argc, argv) : runGoldenTests(argc, argv);
+		AssetLoader::shutdown();
+		return result;
+	}
+
 	//prepare SDL
 	SDL_Init(SDL_INIT_EVERYTHING);
 
@@ -249,6 +276,7 @@ int main(int argc, char **argv)
 
 	//main loop, application gets inside here till user closes it
 	mainLoop(window);
+	AssetLoader::shutdown();
 
 	//save state and free memory
 	// Cleanup
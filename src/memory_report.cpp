@@ -0,0 +1,408 @@
+#include "memory_report.h"
+#include "includes.h"
+#include "mesh.h"
+#include "texture.h"
+#include "texture_compressor.h"
+#include "texture_residency.h"
+#include "fbo.h"
+#include "prefab.h"
+#include "material.h"
+#include "animation.h"
+#include "extra/cJSON.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+template <typename T> size_t vectorBytes(const std::vector<T>& v) { return v.capacity() * sizeof(T); }
+
+size_t getMeshCPUBytes(Mesh* mesh)
+{
+	return sizeof(Mesh) + vectorBytes(mesh->submeshes) + vectorBytes(mesh->vertices) + vectorBytes(mesh->normals) +
+		vectorBytes(mesh->uvs) + vectorBytes(mesh->m_uvs1) + vectorBytes(mesh->colors) + vectorBytes(mesh->interleaved) +
+		vectorBytes(mesh->m_indices) + vectorBytes(mesh->bones) + vectorBytes(mesh->weights) + vectorBytes(mesh->bones_info);
+}
+
+size_t getMeshGPUBytes(Mesh* mesh)
+{
+	//every stream has one element per vertex, the counts are kept also for meshes uploaded without CPU copies
+	size_t bytes = 0;
+	size_t num_vertices = mesh->getNumVertices();
+	int q = mesh->quantization;
+	if (mesh->interleaved_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_VERTICES, q, true);
+	if (mesh->vertices_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_VERTICES, q, false);
+	if (mesh->normals_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_NORMALS, q, false);
+	if (mesh->uvs_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_UVS, q, false);
+	if (mesh->uvs1_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_UVS1, q, false);
+	if (mesh->colors_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_COLORS, q, false);
+	if (mesh->bones_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_BONES, q, false);
+	if (mesh->weights_vbo_id) bytes += num_vertices * Mesh::getStreamElementSize(STREAM_WEIGHTS, q, false);
+	if (mesh->indices_vbo_id) bytes += mesh->getNumIndices() * Mesh::getStreamElementSize(STREAM_INDICES, q, false);
+	return bytes;
+}
+
+size_t getTextureCPUBytes(Texture* texture)
+{
+	return sizeof(Texture) + (texture->image.data ? texture->image.width * texture->image.height * texture->image.num_channels : 0);
+}
+
+static int getFormatChannels(unsigned int format)
+{
+	switch (format)
+	{
+		case GL_RED: case GL_ALPHA: case GL_LUMINANCE: case GL_DEPTH_COMPONENT: return 1;
+		case GL_RG: case GL_LUMINANCE_ALPHA: return 2;
+		case GL_RGB: case GL_BGR: return 3;
+		default: return 4;
+	}
+}
+
+static int getTypeBytes(unsigned int type)
+{
+	switch (type)
+	{
+		case GL_FLOAT: case GL_UNSIGNED_INT: case GL_INT: return 4;
+		case GL_HALF_FLOAT: case GL_UNSIGNED_SHORT: case GL_SHORT: return 2;
+		default: return 1;
+	}
+}
+
+static size_t getBytesPerPixel(Texture* texture)
+{
+	switch (texture->internal_format)
+	{
+		case GL_RGBA32F: return 16;
+		case GL_RGB32F: return 12;
+		case GL_RGBA16F: return 8;
+		case GL_RGB16F: return 6;
+		case GL_RG32F: return 8;
+		case GL_RG16F: case GL_R32F: return 4;
+		case GL_R16F: return 2;
+		case GL_R8: return 1;
+		case GL_RG8: return 2;
+		case GL_RGB8: case GL_RGBA8: case GL_SRGB8_ALPHA8: return 4;
+		case GL_DEPTH_COMPONENT16: return 2;
+		case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32: case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8: return 4;
+	}
+
+	//without an internal format the upload picks one from the format and type, like Texture::upload does
+	if (texture->format == GL_DEPTH_COMPONENT)
+		return 4; //depth is stored as 24 bits padded to 32
+	int channels = getFormatChannels(texture->format);
+	int type_bytes = getTypeBytes(texture->type);
+	if (type_bytes == 1 && channels == 3)
+		channels = 4; //drivers store RGB8 as RGBA8
+	return channels * type_bytes;
+}
+
+size_t getTextureGPUBytes(Texture* texture)
+{
+	if (!texture->texture_id || !texture->width || !texture->height)
+		return 0;
+
+	//block compressed, the baked mips are always the whole chain
+	if (getCompressedLevelSize(texture->internal_format, 4, 4))
+	{
+		size_t bytes = 0;
+		int w = texture->width, h = texture->height;
+		while (true)
+		{
+			bytes += getCompressedLevelSize(texture->internal_format, w, h);
+			if (!texture->mipmaps || (w == 1 && h == 1))
+				return bytes;
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
+		}
+	}
+
+	size_t level_size = (size_t)texture->width * (size_t)texture->height * getBytesPerPixel(texture);
+	size_t bytes = level_size;
+	if (texture->mipmaps)
+	{
+		int w = texture->width, h = texture->height;
+		while (w > 1 || h > 1)
+		{
+			w = std::max(w / 2, 1);
+			h = std::max(h / 2, 1);
+			bytes += (size_t)w * h * getBytesPerPixel(texture);
+		}
+	}
+
+	if (texture->texture_type == GL_TEXTURE_CUBE_MAP)
+		bytes *= 6;
+	else if (texture->texture_type == GL_TEXTURE_2D_ARRAY || texture->texture_type == GL_TEXTURE_3D)
+		bytes *= std::max((int)texture->depth, 1);
+	return bytes;
+}
+
+size_t getRenderbuffersGPUBytes(FBO* fbo)
+{
+	size_t bytes = 0;
+	if (fbo->renderbuffer_color)
+		bytes += (size_t)fbo->width * fbo->height * 4;
+	if (fbo->renderbuffer_depth)
+		bytes += (size_t)fbo->width * fbo->height * 4;
+	return bytes;
+}
+
+//the owner of a resource is the prefab using it, or "shared" when more than one does
+static void setOwner(std::map<const void*, std::string>& owners, const void* resource, const std::string& owner)
+{
+	if (!resource)
+		return;
+	auto it = owners.find(resource);
+	if (it == owners.end())
+		owners[resource] = owner;
+	else if (it->second != owner)
+		it->second = "shared";
+}
+
+static int collectNodeOwners(GTR::Node* node, const std::string& prefab, std::map<const void*, std::string>& owners, std::set<Mesh*>& meshes)
+{
+	int num_nodes = 1;
+	if (node->mesh)
+	{
+		setOwner(owners, node->mesh, prefab);
+		meshes.insert(node->mesh);
+	}
+	if (node->material)
+	{
+		GTR::Material* material = node->material;
+		setOwner(owners, material, prefab);
+		setOwner(owners, material->color_texture.texture, prefab);
+		setOwner(owners, material->emissive_texture.texture, prefab);
+		setOwner(owners, material->opacity_texture.texture, prefab);
+		setOwner(owners, material->metallic_roughness_texture.texture, prefab);
+		setOwner(owners, material->occlusion_texture.texture, prefab);
+		setOwner(owners, material->normal_texture.texture, prefab);
+	}
+	for (int i = 0; i < node->children.size(); ++i)
+		num_nodes += collectNodeOwners(node->children[i], prefab, owners, meshes);
+	return num_nodes;
+}
+
+void MemoryReport::collect()
+{
+	entries.clear();
+	by_category.clear();
+	by_owner.clear();
+	total = sMemoryTotals();
+	texture_gpu_bytes = 0;
+	texture_budget = TextureResidency::budget;
+	reduced_textures = 0;
+
+	//prefabs first, they tell who owns the meshes and textures
+	std::map<const void*, std::string> owners;
+	std::set<Mesh*> meshes;
+	for (auto it = GTR::Prefab::sPrefabsLoaded.begin(); it != GTR::Prefab::sPrefabsLoaded.end(); ++it)
+	{
+		GTR::Prefab* prefab = it->second;
+		int num_nodes = collectNodeOwners(&prefab->root, it->first, owners, meshes);
+		entries.push_back({ it->first, "prefab", it->first, sizeof(GTR::Prefab) + (num_nodes - 1) * sizeof(GTR::Node), 0 });
+	}
+
+	//meshes created by the loaders are in the manager, the ones of the prefabs may not be
+	for (auto it = Mesh::sMeshesLoaded.begin(); it != Mesh::sMeshesLoaded.end(); ++it)
+		meshes.insert(it->second);
+	for (auto it = meshes.begin(); it != meshes.end(); ++it)
+	{
+		Mesh* mesh = *it;
+		entries.push_back({ mesh->name.size() ? mesh->name : "unnamed mesh", "mesh", owners[mesh], getMeshCPUBytes(mesh), getMeshGPUBytes(mesh) });
+	}
+
+	//textures attached to an FBO belong to it
+	std::map<Texture*, FBO*> attachments;
+	for (auto it = FBO::sAllFBOs.begin(); it != FBO::sAllFBOs.end(); ++it)
+	{
+		FBO* fbo = *it;
+		for (int i = 0; i < 4; ++i)
+			if (fbo->color_textures[i])
+				attachments[fbo->color_textures[i]] = fbo;
+		if (fbo->depth_texture)
+			attachments[fbo->depth_texture] = fbo;
+
+		size_t bytes = getRenderbuffersGPUBytes(fbo);
+		if (bytes)
+			entries.push_back({ (fbo->name.size() ? fbo->name : "fbo " + std::to_string(fbo->fbo_id)) + " renderbuffers", "fbo", fbo->name, 0, bytes });
+	}
+
+	char name[64];
+	for (auto it = Texture::sAllTextures.begin(); it != Texture::sAllTextures.end(); ++it)
+	{
+		Texture* texture = *it;
+		sMemoryEntry entry;
+		snprintf(name, sizeof(name), "unnamed %dx%d", (int)texture->width, (int)texture->height);
+		entry.name = texture->filename.size() ? texture->filename : name;
+		entry.category = "texture";
+		entry.owner = owners[texture];
+		auto attachment = attachments.find(texture);
+		if (attachment != attachments.end())
+		{
+			FBO* fbo = attachment->second;
+			entry.category = "fbo";
+			entry.owner = fbo->name.size() ? fbo->name : "fbo " + std::to_string(fbo->fbo_id);
+		}
+		entry.cpu_bytes = getTextureCPUBytes(texture);
+		entry.gpu_bytes = getTextureGPUBytes(texture);
+		entries.push_back(entry);
+		texture_gpu_bytes += entry.gpu_bytes;
+		if (texture->residency.level > 0)
+			reduced_textures++;
+	}
+
+	for (auto it = GTR::Material::sMaterials.begin(); it != GTR::Material::sMaterials.end(); ++it)
+		entries.push_back({ it->first, "material", owners[it->second], sizeof(GTR::Material), 0 });
+
+	for (auto it = Animation::sAnimationsLoaded.begin(); it != Animation::sAnimationsLoaded.end(); ++it)
+	{
+		Animation* anim = it->second;
+		size_t keyframes = anim->keyframes ? (size_t)anim->num_keyframes * anim->num_animated_bones * sizeof(Matrix44) : 0;
+		entries.push_back({ it->first, "animation", "", sizeof(Animation) + keyframes, 0 });
+	}
+
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		sMemoryEntry& entry = entries[i];
+		sMemoryTotals* groups[3] = { &total, &by_category[entry.category], &by_owner[entry.owner.size() ? entry.owner : "none"] };
+		for (int j = 0; j < 3; ++j)
+		{
+			groups[j]->cpu_bytes += entry.cpu_bytes;
+			groups[j]->gpu_bytes += entry.gpu_bytes;
+			groups[j]->count++;
+		}
+	}
+}
+
+std::vector<const sMemoryEntry*> MemoryReport::getTop(int num, bool gpu) const
+{
+	std::vector<const sMemoryEntry*> top;
+	for (int i = 0; i < entries.size(); ++i)
+		top.push_back(&entries[i]);
+	std::sort(top.begin(), top.end(), [gpu](const sMemoryEntry* a, const sMemoryEntry* b) {
+		return gpu ? a->gpu_bytes > b->gpu_bytes : a->cpu_bytes > b->cpu_bytes;
+	});
+	if (top.size() > num)
+		top.resize(num);
+	return top;
+}
+
+static std::string formatMB(size_t bytes)
+{
+	char str[32];
+	snprintf(str, sizeof(str), "%.2f MB", bytes / (1024.0 * 1024.0));
+	return str;
+}
+
+std::string MemoryReport::getText(int top) const
+{
+	char line[256];
+	std::string str = "Memory            count         RAM        VRAM\n";
+	for (auto it = by_category.begin(); it != by_category.end(); ++it)
+	{
+		snprintf(line, sizeof(line), "%-16s %6d %11s %11s\n", it->first.c_str(), it->second.count, formatMB(it->second.cpu_bytes).c_str(), formatMB(it->second.gpu_bytes).c_str());
+		str += line;
+	}
+	snprintf(line, sizeof(line), "%-16s %6d %11s %11s\n", "total", total.count, formatMB(total.cpu_bytes).c_str(), formatMB(total.gpu_bytes).c_str());
+	str += line;
+	snprintf(line, sizeof(line), "\nTextures VRAM %s of %s budget%s, %d reduced\n", formatMB(texture_gpu_bytes).c_str(), formatMB(texture_budget).c_str(), texture_gpu_bytes > texture_budget ? " (OVER)" : "", reduced_textures);
+	str += line;
+
+	str += "\nBy owner\n";
+	for (auto it = by_owner.begin(); it != by_owner.end(); ++it)
+	{
+		snprintf(line, sizeof(line), "%-40.40s %6d %11s %11s\n", it->first.c_str(), it->second.count, formatMB(it->second.cpu_bytes).c_str(), formatMB(it->second.gpu_bytes).c_str());
+		str += line;
+	}
+
+	str += "\nTop VRAM\n";
+	std::vector<const sMemoryEntry*> list = getTop(top, true);
+	for (int i = 0; i < list.size(); ++i)
+	{
+		snprintf(line, sizeof(line), "%11s  %-8s %-40.40s %s\n", formatMB(list[i]->gpu_bytes).c_str(), list[i]->category.c_str(), list[i]->name.c_str(), list[i]->owner.c_str());
+		str += line;
+	}
+
+	str += "\nTop RAM\n";
+	list = getTop(top, false);
+	for (int i = 0; i < list.size(); ++i)
+	{
+		snprintf(line, sizeof(line), "%11s  %-8s %-40.40s %s\n", formatMB(list[i]->cpu_bytes).c_str(), list[i]->category.c_str(), list[i]->name.c_str(), list[i]->owner.c_str());
+		str += line;
+	}
+	return str;
+}
+
+static cJSON* createTotalsJSON(const sMemoryTotals& totals)
+{
+	cJSON* json = cJSON_CreateObject();
+	cJSON_AddNumberToObject(json, "count", totals.count);
+	cJSON_AddNumberToObject(json, "cpu_bytes", totals.cpu_bytes);
+	cJSON_AddNumberToObject(json, "gpu_bytes", totals.gpu_bytes);
+	return json;
+}
+
+cJSON* MemoryReport::toJSON() const
+{
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "total", createTotalsJSON(total));
+
+	cJSON* textures = cJSON_AddObjectToObject(root, "texture_budget");
+	cJSON_AddNumberToObject(textures, "gpu_bytes", texture_gpu_bytes);
+	cJSON_AddNumberToObject(textures, "budget_bytes", texture_budget);
+	cJSON_AddNumberToObject(textures, "reduced", reduced_textures);
+
+	cJSON* categories = cJSON_AddObjectToObject(root, "by_category");
+	for (auto it = by_category.begin(); it != by_category.end(); ++it)
+		cJSON_AddItemToObject(categories, it->first.c_str(), createTotalsJSON(it->second));
+
+	cJSON* owners = cJSON_AddObjectToObject(root, "by_owner");
+	for (auto it = by_owner.begin(); it != by_owner.end(); ++it)
+		cJSON_AddItemToObject(owners, it->first.c_str(), createTotalsJSON(it->second));
+
+	//sorted by VRAM, the ones to cut come first
+	cJSON* list = cJSON_AddArrayToObject(root, "resources");
+	std::vector<const sMemoryEntry*> sorted = getTop(entries.size(), true);
+	for (int i = 0; i < sorted.size(); ++i)
+	{
+		cJSON* item = cJSON_CreateObject();
+		cJSON_AddStringToObject(item, "name", sorted[i]->name.c_str());
+		cJSON_AddStringToObject(item, "category", sorted[i]->category.c_str());
+		cJSON_AddStringToObject(item, "owner", sorted[i]->owner.c_str());
+		cJSON_AddNumberToObject(item, "cpu_bytes", sorted[i]->cpu_bytes);
+		cJSON_AddNumberToObject(item, "gpu_bytes", sorted[i]->gpu_bytes);
+		cJSON_AddItemToArray(list, item);
+	}
+	return root;
+}
+
+bool MemoryReport::save(const char* filename) const
+{
+	cJSON* root = toJSON();
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write memory report: " << filename << std::endl;
+		free(text);
+		return false;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	free(text);
+
+	std::cout << " + Memory report saved: " << filename << std::endl;
+	return true;
+}
+
+bool saveMemoryReport(const char* filename, int top)
+{
+	MemoryReport report;
+	report.collect();
+	std::cout << report.getText(top);
+	return report.save(filename);
+}
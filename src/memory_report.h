@@ -0,0 +1,67 @@
+/*  Memory report, walks the resource managers and estimates the RAM and VRAM used by every resource.
+	CPU bytes are the copies kept in RAM (vertex arrays, image pixels, keyframes), GPU bytes are estimated from
+	the sizes and formats uploaded (buffers, textures with their mips, renderbuffers), drivers may pad them.
+	Resources are grouped by category and by owner, the prefab that uses them or the FBO they belong to.
+*/
+
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+struct cJSON;
+class Mesh;
+class Texture;
+class FBO;
+
+struct sMemoryEntry {
+	std::string name;
+	std::string category; //mesh, texture, fbo, prefab, material, animation
+	std::string owner; //empty when nothing owns it, "shared" when several prefabs use it
+	size_t cpu_bytes;
+	size_t gpu_bytes;
+};
+
+struct sMemoryTotals {
+	size_t cpu_bytes = 0;
+	size_t gpu_bytes = 0;
+	int count = 0;
+};
+
+//estimates, also used by other systems that need the size of a resource
+size_t getMeshCPUBytes(Mesh* mesh);
+size_t getMeshGPUBytes(Mesh* mesh);
+size_t getTextureCPUBytes(Texture* texture);
+size_t getTextureGPUBytes(Texture* texture);
+size_t getRenderbuffersGPUBytes(FBO* fbo); //textures attached are reported with the textures
+
+class MemoryReport
+{
+public:
+	std::vector<sMemoryEntry> entries;
+	std::map<std::string, sMemoryTotals> by_category;
+	std::map<std::string, sMemoryTotals> by_owner;
+	sMemoryTotals total;
+
+	//every texture, FBO attachments too, against the budget of TextureResidency
+	size_t texture_gpu_bytes = 0;
+	size_t texture_budget = 0;
+	int reduced_textures = 0; //without their top mips to fit in the budget
+
+	//takes a snapshot of every resource alive
+	void collect();
+
+	//biggest entries in VRAM (or RAM)
+	std::vector<const sMemoryEntry*> getTop(int num, bool gpu = true) const;
+
+	std::string getText(int top = 10) const;
+	cJSON* toJSON() const;
+	bool save(const char* filename) const;
+};
+
+//collects a report, prints it and saves it as JSON
+bool saveMemoryReport(const char* filename = "memory_report.json", int top = 10);
+
+#endif
@@ -1,4 +1,5 @@
 #include "mesh.h"
+#include "mesh_optimizer.h"
 #include "extra/textparser.h"
 #include "utils.h"
 #include "shader.h"
@@ -8,10 +9,21 @@
 #include <cassert>
 #include <iostream>
 #include <limits>
+#include <algorithm>
+#include <cstring>
+#ifdef __has_include
+	#if __has_include(<charconv>)
+		#include <charconv>
+	#endif
+#endif
+#ifdef __cpp_lib_to_chars
+	#define OBJ_FROM_CHARS //floats need a recent standard library, older ones use strtof
+#endif
 #include <sys/stat.h>
 
 #include "camera.h"
 #include "texture.h"
+#include "profiler.h"
 //#include "animation.h"
 #include "extra/coldet/coldet.h"
 
@@ -20,6 +32,7 @@
 bool Mesh::use_binary = false;			//checks if there is .wbin, it there is one tries to read it instead of the other file
 bool Mesh::auto_upload_to_vram = true;	//uploads the mesh to the GPU VRAM to speed up rendering
 bool Mesh::interleave_meshes = true;	//places the geometry in an interleaved array
+int Mesh::quantize_meshes = QUANTIZE_ALL;	//stores the streams with less precision in VRAM and .mbin
 
 std::map<std::string, Mesh*> Mesh::sMeshesLoaded;
 long Mesh::num_meshes_rendered = 0;
@@ -102,9 +115,14 @@ void Mesh::clear()
 	bones.clear();
 	weights.clear();
 	m_uvs1.clear();
+	num_vertices = num_indices = 0;
+	bin_filename.clear();
+	bin_offset = 0;
+	quantization = 0;
 
 	if (collision_model)
 		delete (CollisionModel3D*)collision_model;
+	collision_model = NULL;
 }
 
 int vertex_location = -1;
@@ -115,6 +133,43 @@ int color_location = -1;
 int bones_location = -1;
 int weights_location = -1;
 
+struct sAttribFormat {
+	int components;
+	unsigned int type;
+	unsigned char normalized;
+	int bytes;
+};
+
+//format of a vertex attribute in VRAM and .mbin
+static sAttribFormat getAttribFormat(int stream, int quantization)
+{
+	switch (stream)
+	{
+	case STREAM_VERTICES: return quantization & QUANTIZE_POSITIONS ? sAttribFormat{ 4, GL_SHORT, GL_TRUE, 8 } : sAttribFormat{ 3, GL_FLOAT, GL_FALSE, 12 }; //w is padding
+	case STREAM_NORMALS: return quantization & QUANTIZE_NORMALS ? sAttribFormat{ 4, GL_INT_2_10_10_10_REV, GL_TRUE, 4 } : sAttribFormat{ 3, GL_FLOAT, GL_FALSE, 12 };
+	case STREAM_UVS:
+	case STREAM_UVS1: return quantization & QUANTIZE_UVS ? sAttribFormat{ 2, GL_HALF_FLOAT, GL_FALSE, 4 } : sAttribFormat{ 2, GL_FLOAT, GL_FALSE, 8 };
+	case STREAM_COLORS: return quantization & QUANTIZE_COLORS ? sAttribFormat{ 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 } : sAttribFormat{ 4, GL_FLOAT, GL_FALSE, 16 };
+	case STREAM_WEIGHTS: return quantization & QUANTIZE_WEIGHTS ? sAttribFormat{ 4, GL_UNSIGNED_BYTE, GL_TRUE, 4 } : sAttribFormat{ 4, GL_FLOAT, GL_FALSE, 16 };
+	case STREAM_BONES: return sAttribFormat{ 4, GL_UNSIGNED_BYTE, GL_FALSE, 4 };
+	}
+	assert(0 && "not a vertex stream");
+	return sAttribFormat{ 0, GL_FLOAT, GL_FALSE, 0 };
+}
+
+int Mesh::getStreamElementSize(eMeshStream stream, int quantization, bool interleaved)
+{
+	if (stream == STREAM_VERTICES && interleaved)
+		return getAttribFormat(STREAM_VERTICES, quantization).bytes + getAttribFormat(STREAM_NORMALS, quantization).bytes + getAttribFormat(STREAM_UVS, quantization).bytes;
+	if (stream == STREAM_INDICES)
+		return quantization & QUANTIZE_INDICES ? sizeof(unsigned short) : sizeof(unsigned int);
+	if (stream == STREAM_BONES_INFO)
+		return sizeof(BoneInfo);
+	if (stream == STREAM_SUBMESHES)
+		return sizeof(sSubmeshInfo);
+	return getAttribFormat(stream, quantization).bytes;
+}
+
 void Mesh::enableBuffers(Shader* sh)
 {
 	vertex_location = sh->getAttribLocation("a_vertex");
@@ -124,24 +179,35 @@ void Mesh::enableBuffers(Shader* sh)
 		return;
 	*/
 
+	//only the VBOs are quantized, the arrays in RAM are always floats
+	int format = (vertices_vbo_id || interleaved_vbo_id) ? quantization : 0;
+	sAttribFormat position = getAttribFormat(STREAM_VERTICES, format);
+	sAttribFormat normal = getAttribFormat(STREAM_NORMALS, format);
+	sAttribFormat uv = getAttribFormat(STREAM_UVS, format);
+
 	int spacing = 0;
 	int offset_normal = 0;
 	int offset_uv = 0;
 
-	if (interleaved.size())
+	//meshes uploaded from a .mbin only have the VBOs
+	if (interleaved.size() || interleaved_vbo_id)
 	{
-		spacing = sizeof(tInterleaved);
-		offset_normal = sizeof(Vector3);
-		offset_uv = sizeof(Vector3) + sizeof(Vector3);
+		spacing = position.bytes + normal.bytes + uv.bytes;
+		offset_normal = position.bytes;
+		offset_uv = position.bytes + normal.bytes;
 	}
 
+	//quantized positions are relative to the box
+	sh->setUniform("u_vertex_scale", format & QUANTIZE_POSITIONS ? box.halfsize : Vector3(1, 1, 1));
+	sh->setUniform("u_vertex_offset", format & QUANTIZE_POSITIONS ? box.center : Vector3());
+
 	if (vertex_location != -1)
 	{
 		glEnableVertexAttribArray(vertex_location);
 		if (vertices_vbo_id || interleaved_vbo_id)
 		{
 			glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : vertices_vbo_id);
-			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, 0);
+			glVertexAttribPointer(vertex_location, position.components, position.type, position.normalized, spacing, 0);
 		}
 		else
 			glVertexAttribPointer(vertex_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].vertex : &vertices[0]);
@@ -149,7 +215,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	normal_location = -1;
-	if (normals.size() || spacing)
+	if (normals.size() || normals_vbo_id || spacing)
 	{
 		normal_location = sh->getAttribLocation("a_normal");
 		if (normal_location != -1)
@@ -158,7 +224,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (normals_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : normals_vbo_id);
-				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, (void*)offset_normal);
+				glVertexAttribPointer(normal_location, normal.components, normal.type, normal.normalized, spacing, (void*)offset_normal);
 			}
 			else
 				glVertexAttribPointer(normal_location, 3, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].normal : &normals[0]);
@@ -167,7 +233,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv_location = -1;
-	if (uvs.size() || spacing)
+	if (uvs.size() || uvs_vbo_id || spacing)
 	{
 		uv_location = sh->getAttribLocation("a_coord");
 		if (uv_location != -1)
@@ -176,7 +242,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs_vbo_id || interleaved_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, interleaved_vbo_id ? interleaved_vbo_id : uvs_vbo_id);
-				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, (void*)offset_uv);
+				glVertexAttribPointer(uv_location, uv.components, uv.type, uv.normalized, spacing, (void*)offset_uv);
 			}
 			else
 				glVertexAttribPointer(uv_location, 2, GL_FLOAT, GL_FALSE, spacing, interleaved.size() ? &interleaved[0].uv : &uvs[0]);
@@ -185,7 +251,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	uv1_location = -1;
-	if (m_uvs1.size())
+	if (m_uvs1.size() || uvs1_vbo_id)
 	{
 		uv1_location = sh->getAttribLocation("a_coord1");
 		if (uv1_location != -1)
@@ -194,7 +260,7 @@ void Mesh::enableBuffers(Shader* sh)
 			if (uvs1_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, uvs1_vbo_id);
-				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+				glVertexAttribPointer(uv1_location, uv.components, uv.type, uv.normalized, 0, (void*)0);
 			}
 			else
 				glVertexAttribPointer(uv1_location, 2, GL_FLOAT, GL_FALSE, 0, &m_uvs1[0]);
@@ -203,7 +269,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	color_location = -1;
-	if (colors.size())
+	if (colors.size() || colors_vbo_id)
 	{
 		color_location = sh->getAttribLocation("a_color");
 		if (color_location != -1)
@@ -212,7 +278,8 @@ void Mesh::enableBuffers(Shader* sh)
 			if (colors_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, colors_vbo_id);
-				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				sAttribFormat color = getAttribFormat(STREAM_COLORS, format);
+				glVertexAttribPointer(color_location, color.components, color.type, color.normalized, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(color_location, 4, GL_FLOAT, GL_FALSE, 0, &colors[0]);
@@ -221,7 +288,7 @@ void Mesh::enableBuffers(Shader* sh)
 	}
 
 	bones_location = -1;
-	if (bones.size())
+	if (bones.size() || bones_vbo_id)
 	{
 		bones_location = sh->getAttribLocation("a_bones");
 		if (bones_location != -1)
@@ -237,7 +304,7 @@ void Mesh::enableBuffers(Shader* sh)
 		}
 	}
 	weights_location = -1;
-	if (weights.size())
+	if (weights.size() || weights_vbo_id)
 	{
 		weights_location = sh->getAttribLocation("a_weights");
 		if (weights_location != -1)
@@ -246,7 +313,8 @@ void Mesh::enableBuffers(Shader* sh)
 			if (weights_vbo_id)
 			{
 				glBindBuffer(GL_ARRAY_BUFFER, weights_vbo_id);
-				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+				sAttribFormat weight = getAttribFormat(STREAM_WEIGHTS, format);
+				glVertexAttribPointer(weights_location, weight.components, weight.type, weight.normalized, 0, NULL);
 			}
 			else
 				glVertexAttribPointer(weights_location, 4, GL_FLOAT, GL_FALSE, 0, &weights[0]);
@@ -265,7 +333,7 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 		assert(0 && "no shader or shader not compiled or enabled");
 		return;
 	}
-	assert((interleaved.size() || vertices.size()) && "No vertices in this mesh");
+	assert(getNumVertices() && "No vertices in this mesh");
 
 	//bind buffers to attribute locations
 	enableBuffers(shader);
@@ -282,31 +350,30 @@ void Mesh::render(unsigned int primitive, int submesh_id, int num_instances)
 
 void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 {
-	int start = 0; //in primitives
-	int size = (int)vertices.size();
-	if (m_indices.size())
-		size = (int)m_indices.size();
-	else
-	if (interleaved.size())
-		size = (int)interleaved.size();
+	int start = 0; //in indices, or in vertices when it is not indexed
+	int size = (int)getNumVertices();
+	if (getNumIndices())
+		size = (int)getNumIndices();
 
 	if (submesh_id > -1)
 	{
 		assert(submesh_id < submeshes.size() && "this mesh doesnt have as many submeshes");
 		sSubmeshInfo& submesh = submeshes[submesh_id];
 		start = submesh.start;
-		size = submesh.start + submesh.length;
+		size = submesh.length;
 	}
 
 	//DRAW
-	if (m_indices.size())
+	if (m_indices.size() || indices_vbo_id)
 	{
+		unsigned int index_type = (indices_vbo_id && (quantization & QUANTIZE_INDICES)) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		size_t index_size = index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
 		if (num_instances > 0)
 		{
 			assert(indices_vbo_id && "indices must be uploaded to the GPU");
 			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-			#ifdef OPENGL_ES3
-				glDrawElementsInstanced(primitive, size, GL_UNSIGNED_INT, (void*)(start + sizeof(Vector3u)), num_instances);
+			#ifndef OPENGL_ES2
+				glDrawElementsInstanced(primitive, size, index_type, (void*)(start * index_size), num_instances);
             #else
 				assert(0 && "not supported in OpenGL ES2");
             #endif
@@ -318,20 +385,20 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 			{
 				/*if (size != 90)*/ {
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-					glDrawElements(primitive, size, GL_UNSIGNED_INT,(void *) (start * sizeof(Vector3u)));
+					glDrawElements(primitive, size, index_type, (void *) (start * index_size));
 					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 				}
 				checkGLErrors();
 			}
 			else
-				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start)); //no multiply, its a vector3u pointer)
+				glDrawElements(primitive, size, GL_UNSIGNED_INT, (void*)(&m_indices[0] + start));
 		}
 	}
 	else
 	{
 		if (num_instances > 0)
 		{
-			#ifdef OPENGL_ES3
+			#ifndef OPENGL_ES2
 				glDrawArraysInstanced(primitive, start, size, num_instances);
             #else
 				assert(0 && "not supported in OpenGL ES2");
@@ -343,6 +410,9 @@ void Mesh::drawCall(unsigned int primitive, int submesh_id, int num_instances)
 
 	num_triangles_rendered += (size / 3) * (num_instances ? num_instances : 1);
 	num_meshes_rendered++;
+	RENDER_STATS_ADD(draw_calls, 1);
+	RENDER_STATS_ADD(triangles, (size / 3) * (num_instances ? num_instances : 1));
+	RENDER_STATS_ADD(instances, num_instances ? num_instances : 1);
 }
 
 void Mesh::disableBuffers(Shader* shader)
@@ -366,14 +436,15 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 	if (!num_instances)
 		return;
 
-	#ifdef OPENGL_ES3
+	//instancing is core since GL 3.3, only ES2 lacks it
+	#ifndef OPENGL_ES2
 		Shader* shader = Shader::current;
 		assert(shader && "shader must be enabled");
 
 		if (instances_buffer_id == 0)
-			glGenBuffersARB(1, &instances_buffer_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, instances_buffer_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW_ARB);
+			glGenBuffers(1, &instances_buffer_id);
+		glBindBuffer(GL_ARRAY_BUFFER, instances_buffer_id);
+		glBufferData(GL_ARRAY_BUFFER, num_instances * sizeof(Matrix44), instanced_models, GL_STREAM_DRAW);
 
 		int attribLocation = shader->getAttribLocation("u_model");
 		assert(attribLocation != -1 && "shader must have attribute mat4 u_model (not a uniform)");
@@ -390,8 +461,8 @@ void Mesh::renderInstanced(unsigned int primitive, const Matrix44* instanced_mod
 			glVertexAttribDivisor(attribLocation + k, 1); // This makes it instanced!
 		}
 
-		//regular render
-		render(primitive, 0, num_instances);
+		//regular render, the whole mesh
+		render(primitive, -1, num_instances);
 
 		//disable instanced attribs
 		for (int k = 0; k < 4; ++k)
@@ -499,94 +570,285 @@ void Mesh::renderAnimated( unsigned int primitive, Skeleton* skeleton )
 #define GL_ARRAY_BUFFER_ARB GL_ARRAY_BUFFER
 #define GL_STATIC_DRAW_ARB GL_STATIC_DRAW
 
-void Mesh::uploadToVRAM()
+//creates the VBO if needed and fills it
+static void uploadBuffer(unsigned int& vbo_id, unsigned int target, const void* data, size_t bytes)
 {
-	assert(vertices.size() || interleaved.size());
+	if (vbo_id == 0)
+		glGenBuffersARB(1, &vbo_id);
+	glBindBufferARB(target, vbo_id);
+	glBufferDataARB(target, bytes, data, GL_STATIC_DRAW_ARB);
+}
 
-	if (glGenBuffersARB == nullptr)
+static unsigned short floatToHalf(float f)
+{
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+	unsigned int sign = (x >> 16) & 0x8000;
+	int exponent = (int)((x >> 23) & 0xff) - 127 + 15;
+	unsigned int mantissa = x & 0x7fffff;
+	if (((x >> 23) & 0xff) == 0xff) //inf and nan
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	if (exponent >= 31)
+		return sign | 0x7c00;
+	if (exponent <= 0) //subnormal
+	{
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		return sign | ((mantissa >> shift) + ((mantissa >> (shift - 1)) & 1));
+	}
+	//rounding may carry into the exponent, which is still the right value
+	return sign | (((exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
+
+static float halfToFloat(unsigned short h)
+{
+	unsigned int sign = (h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	if (exponent == 0) //zero and subnormal
+		return (sign ? -1.0f : 1.0f) * mantissa * (1.0f / 16777216.0f);
+	unsigned int x = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+//snorm conversions use the rule of GL 4.2, -1 has two codes and 0 is exact
+static int toSnorm(float v, int max) { return (int)roundf(clamp(v, -1.0f, 1.0f) * max); }
+static float fromSnorm(int v, int max) { return std::max(v / (float)max, -1.0f); }
+static unsigned char toUnorm8(float v) { return (unsigned char)roundf(clamp(v, 0.0f, 1.0f) * 255.0f); }
+
+//writes one attribute in its VRAM format and returns where the next one goes
+static unsigned char* packAttrib(unsigned char* dst, int stream, int quantization, const float* v, const BoundingBox& box)
+{
+	sAttribFormat format = getAttribFormat(stream, quantization);
+	if (format.type == GL_FLOAT)
+		memcpy(dst, v, format.bytes);
+	else if (stream == STREAM_VERTICES)
 	{
-		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
-		exit(0);
+		short* q = (short*)dst;
+		for (int i = 0; i < 3; ++i)
+			q[i] = (short)(box.halfsize.v[i] > 0 ? toSnorm((v[i] - box.center.v[i]) / box.halfsize.v[i], 32767) : 0);
+		q[3] = 0;
 	}
-
-	if (interleaved.size())
+	else if (stream == STREAM_NORMALS)
 	{
-		// Vertex,Normal,UV
-		if (interleaved_vbo_id == 0)
-			glGenBuffersARB(1, &interleaved_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, interleaved_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, interleaved.size() * sizeof(tInterleaved), &interleaved[0], GL_STATIC_DRAW_ARB);
+		unsigned int p = (toSnorm(v[0], 511) & 0x3ff) | ((toSnorm(v[1], 511) & 0x3ff) << 10) | ((toSnorm(v[2], 511) & 0x3ff) << 20);
+		memcpy(dst, &p, sizeof(p));
 	}
-	else
+	else if (stream == STREAM_UVS || stream == STREAM_UVS1)
 	{
-		// Vertices
-		if (vertices_vbo_id == 0)
-			glGenBuffersARB(1, &vertices_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, vertices_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, vertices.size() * sizeof(Vector3), &vertices[0], GL_STATIC_DRAW_ARB);
-
-		// UVs
-		if (uvs.size())
+		unsigned short h[2] = { floatToHalf(v[0]), floatToHalf(v[1]) };
+		memcpy(dst, h, sizeof(h));
+	}
+	else if (stream == STREAM_WEIGHTS)
+	{
+		//the rounding error goes to the biggest weight so they still add up to one
+		int w[4], sum = 0, biggest = 0;
+		for (int i = 0; i < 4; ++i)
 		{
-			if (uvs_vbo_id == 0)
-				glGenBuffersARB(1, &uvs_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, uvs.size() * sizeof(Vector2), &uvs[0], GL_STATIC_DRAW_ARB);
+			w[i] = toUnorm8(v[i]);
+			sum += w[i];
+			if (w[i] > w[biggest])
+				biggest = i;
 		}
+		if (sum)
+			w[biggest] = std::min(std::max(w[biggest] + 255 - sum, 0), 255);
+		for (int i = 0; i < 4; ++i)
+			dst[i] = (unsigned char)w[i];
+	}
+	else //colors
+		for (int i = 0; i < 4; ++i)
+			dst[i] = toUnorm8(v[i]);
+	return dst + format.bytes;
+}
+
+//reads one attribute back to floats, for the CPU copies
+static const unsigned char* unpackAttrib(const unsigned char* src, int stream, int quantization, float* v, const BoundingBox& box)
+{
+	sAttribFormat format = getAttribFormat(stream, quantization);
+	if (format.type == GL_FLOAT)
+		memcpy(v, src, format.bytes);
+	else if (stream == STREAM_VERTICES)
+	{
+		short q[3];
+		memcpy(q, src, sizeof(q));
+		for (int i = 0; i < 3; ++i)
+			v[i] = fromSnorm(q[i], 32767) * box.halfsize.v[i] + box.center.v[i];
+	}
+	else if (stream == STREAM_NORMALS)
+	{
+		unsigned int p;
+		memcpy(&p, src, sizeof(p));
+		for (int i = 0; i < 3; ++i)
+			v[i] = fromSnorm((int)((p >> (i * 10)) << 22) >> 22, 511);
+	}
+	else if (stream == STREAM_UVS || stream == STREAM_UVS1)
+	{
+		unsigned short h[2];
+		memcpy(h, src, sizeof(h));
+		v[0] = halfToFloat(h[0]);
+		v[1] = halfToFloat(h[1]);
+	}
+	else //weights and colors
+		for (int i = 0; i < 4; ++i)
+			v[i] = src[i] / 255.0f;
+	return src + format.bytes;
+}
 
-		// Normals
-		if (normals.size())
+//the bytes of a stream as they go to VRAM and .mbin, packed in storage only when they are quantized
+static const void* getStreamData(Mesh& mesh, int stream, std::vector<unsigned char>& storage, size_t& bytes)
+{
+	int q = mesh.quantization;
+	bool is_interleaved = mesh.interleaved.size() > 0;
+	size_t count = 0;
+	const void* data = NULL;
+	switch (stream)
+	{
+	case STREAM_VERTICES: count = mesh.getNumVertices(); data = is_interleaved ? (void*)mesh.interleaved.data() : (void*)mesh.vertices.data(); break;
+	case STREAM_NORMALS: count = mesh.normals.size(); data = mesh.normals.data(); break;
+	case STREAM_UVS: count = mesh.uvs.size(); data = mesh.uvs.data(); break;
+	case STREAM_COLORS: count = mesh.colors.size(); data = mesh.colors.data(); break;
+	case STREAM_INDICES: count = mesh.m_indices.size(); data = mesh.m_indices.data(); break;
+	case STREAM_BONES: count = mesh.bones.size(); data = mesh.bones.data(); break;
+	case STREAM_WEIGHTS: count = mesh.weights.size(); data = mesh.weights.data(); break;
+	case STREAM_BONES_INFO: count = mesh.bones_info.size(); data = mesh.bones_info.data(); break;
+	case STREAM_UVS1: count = mesh.m_uvs1.size(); data = mesh.m_uvs1.data(); break;
+	case STREAM_SUBMESHES: count = mesh.submeshes.size(); data = mesh.submeshes.data(); break;
+	}
+
+	bytes = count * Mesh::getStreamElementSize((eMeshStream)stream, q, is_interleaved);
+	if (!count || bytes == count * Mesh::getStreamElementSize((eMeshStream)stream, 0, is_interleaved))
+		return count ? data : NULL; //same format in RAM
+
+	storage.resize(bytes);
+	unsigned char* dst = &storage[0];
+	if (stream == STREAM_INDICES)
+		for (size_t i = 0; i < count; ++i)
+			((unsigned short*)dst)[i] = (unsigned short)mesh.m_indices[i];
+	else if (stream == STREAM_VERTICES && is_interleaved)
+		for (size_t i = 0; i < count; ++i)
 		{
-			if (normals_vbo_id == 0)
-				glGenBuffersARB(1, &normals_vbo_id);
-			glBindBufferARB(GL_ARRAY_BUFFER_ARB, normals_vbo_id);
-			glBufferDataARB(GL_ARRAY_BUFFER_ARB, normals.size() * sizeof(Vector3), &normals[0], GL_STATIC_DRAW_ARB);
+			Mesh::tInterleaved& vertex = mesh.interleaved[i];
+			dst = packAttrib(dst, STREAM_VERTICES, q, vertex.vertex.v, mesh.box);
+			dst = packAttrib(dst, STREAM_NORMALS, q, vertex.normal.v, mesh.box);
+			dst = packAttrib(dst, STREAM_UVS, q, &vertex.uv.x, mesh.box);
 		}
+	else
+	{
+		size_t float_size = Mesh::getStreamElementSize((eMeshStream)stream, 0, false);
+		for (size_t i = 0; i < count; ++i)
+			dst = packAttrib(dst, stream, q, (const float*)((const unsigned char*)data + i * float_size), mesh.box);
 	}
+	return &storage[0];
+}
 
-	// UVs
-	if (m_uvs1.size())
+//fills the CPU vector of a stream from its VRAM format
+static void unpackStream(Mesh& mesh, int stream, const unsigned char* src, size_t count, bool is_interleaved)
+{
+	int q = mesh.quantization;
+	if (stream == STREAM_INDICES)
 	{
-		if (uvs1_vbo_id == 0)
-			glGenBuffersARB(1, &uvs1_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, uvs1_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_uvs1.size() * sizeof(Vector2), &m_uvs1[0], GL_STATIC_DRAW_ARB);
+		mesh.m_indices.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			mesh.m_indices[i] = q & QUANTIZE_INDICES ? ((const unsigned short*)src)[i] : ((const unsigned int*)src)[i];
+		return;
 	}
-
-	// Colors
-	if (colors.size())
+	if (stream == STREAM_VERTICES && is_interleaved)
 	{
-		if (colors_vbo_id == 0)
-			glGenBuffersARB(1, &colors_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, colors_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, colors.size() * sizeof(Vector4), &colors[0], GL_STATIC_DRAW_ARB);
+		mesh.interleaved.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			Mesh::tInterleaved& vertex = mesh.interleaved[i];
+			src = unpackAttrib(src, STREAM_VERTICES, q, vertex.vertex.v, mesh.box);
+			src = unpackAttrib(src, STREAM_NORMALS, q, vertex.normal.v, mesh.box);
+			src = unpackAttrib(src, STREAM_UVS, q, &vertex.uv.x, mesh.box);
+		}
+		return;
 	}
 
-	if (bones.size())
+	float* dst = NULL;
+	switch (stream)
 	{
-		if (bones_vbo_id == 0)
-			glGenBuffersARB(1, &bones_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, bones_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, bones.size() * sizeof(Vector4ub), &bones[0], GL_STATIC_DRAW_ARB);
+	case STREAM_VERTICES: mesh.vertices.resize(count); dst = count ? mesh.vertices[0].v : NULL; break;
+	case STREAM_NORMALS: mesh.normals.resize(count); dst = count ? mesh.normals[0].v : NULL; break;
+	case STREAM_UVS: mesh.uvs.resize(count); dst = count ? &mesh.uvs[0].x : NULL; break;
+	case STREAM_UVS1: mesh.m_uvs1.resize(count); dst = count ? &mesh.m_uvs1[0].x : NULL; break;
+	case STREAM_COLORS: mesh.colors.resize(count); dst = count ? mesh.colors[0].v : NULL; break;
+	case STREAM_WEIGHTS: mesh.weights.resize(count); dst = count ? mesh.weights[0].v : NULL; break;
+	case STREAM_BONES: mesh.bones.resize(count); if (count) memcpy(&mesh.bones[0], src, count * sizeof(Vector4ub)); return;
 	}
-	if (weights.size())
+	size_t components = Mesh::getStreamElementSize((eMeshStream)stream, 0, false) / sizeof(float);
+	for (size_t i = 0; i < count; ++i)
+		src = unpackAttrib(src, stream, q, dst + i * components, mesh.box);
+}
+
+//the VBO of every stream, NULL for the ones that are not uploaded
+static unsigned int* getStreamVBO(Mesh& mesh, int stream, bool is_interleaved)
+{
+	switch (stream)
+	{
+	case STREAM_VERTICES: return is_interleaved ? &mesh.interleaved_vbo_id : &mesh.vertices_vbo_id;
+	case STREAM_NORMALS: return &mesh.normals_vbo_id;
+	case STREAM_UVS: return &mesh.uvs_vbo_id;
+	case STREAM_COLORS: return &mesh.colors_vbo_id;
+	case STREAM_INDICES: return &mesh.indices_vbo_id;
+	case STREAM_BONES: return &mesh.bones_vbo_id;
+	case STREAM_WEIGHTS: return &mesh.weights_vbo_id;
+	case STREAM_UVS1: return &mesh.uvs1_vbo_id;
+	}
+	return NULL;
+}
+
+void Mesh::setQuantization(int flags)
+{
+	if (getNumVertices() > 65536)
+		flags &= ~QUANTIZE_INDICES;
+
+	//unorm8 only covers [0,1], HDR vertex colors keep the floats
+	for (size_t i = 0; i < colors.size() && (flags & QUANTIZE_COLORS); ++i)
+		for (int j = 0; j < 4; ++j)
+			if (colors[i].v[j] < 0.0f || colors[i].v[j] > 1.0f)
+				flags &= ~QUANTIZE_COLORS;
+
+	//half floats lose texels when the uvs tile a lot
+	float max_uv = 0;
+	for (size_t i = 0; i < interleaved.size(); ++i)
+		max_uv = std::max(max_uv, std::max(fabsf(interleaved[i].uv.x), fabsf(interleaved[i].uv.y)));
+	for (size_t i = 0; i < uvs.size(); ++i)
+		max_uv = std::max(max_uv, std::max(fabsf(uvs[i].x), fabsf(uvs[i].y)));
+	for (size_t i = 0; i < m_uvs1.size(); ++i)
+		max_uv = std::max(max_uv, std::max(fabsf(m_uvs1[i].x), fabsf(m_uvs1[i].y)));
+	if (max_uv > 2.0f)
+		flags &= ~QUANTIZE_UVS;
+
+	quantization = flags;
+}
+
+void Mesh::uploadToVRAM()
+{
+	assert(vertices.size() || interleaved.size());
+
+	if (glGenBuffersARB == nullptr)
 	{
-		if (weights_vbo_id == 0)
-			glGenBuffersARB(1, &weights_vbo_id);
-		glBindBufferARB(GL_ARRAY_BUFFER_ARB, weights_vbo_id);
-		glBufferDataARB(GL_ARRAY_BUFFER_ARB, weights.size() * sizeof(Vector4), &weights[0], GL_STATIC_DRAW_ARB);
+		std::cout << "Error: your graphics cards dont support VBOs. Sorry." << std::endl;
+		exit(0);
 	}
 
-	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
-
-	// Indices
-	if (m_indices.size())
+	//the quantized streams are packed in a temporary buffer, the others go straight from the vectors
+	std::vector<unsigned char> storage;
+	bool is_interleaved = interleaved.size() > 0;
+	for (int i = 0; i < NUM_MESH_STREAMS; ++i)
 	{
-		if (indices_vbo_id == 0)
-			glGenBuffersARB(1, &indices_vbo_id);
-		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, indices_vbo_id);
-		glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW_ARB);
+		unsigned int* vbo_id = getStreamVBO(*this, i, is_interleaved);
+		size_t bytes = 0;
+		const void* data = vbo_id ? getStreamData(*this, i, storage, bytes) : NULL;
+		if (data)
+			uploadBuffer(*vbo_id, i == STREAM_INDICES ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER, data, bytes);
 	}
+	glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 	glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	checkGLErrors();
@@ -597,6 +859,8 @@ bool Mesh::createCollisionModel(bool is_static)
 {
 	if (collision_model)
 		return true;
+	if (!hasCPUData() && !loadCPUData())
+		return false;
 
 	CollisionModel3D* collision_model = newCollisionModel3D(is_static);
 
@@ -735,6 +999,96 @@ bool Mesh::interleaveBuffers()
 	return true;
 }
 
+//hash and comparison of one corner in every stream it has, bitwise so only exact copies are merged
+template<typename T> static unsigned int hashCorner(const std::vector<T>& stream, size_t i, unsigned int hash)
+{
+	if (stream.empty())
+		return hash;
+	const unsigned char* bytes = (const unsigned char*)&stream[i];
+	for (size_t j = 0; j < sizeof(T); ++j)
+		hash = (hash ^ bytes[j]) * 16777619u; //FNV-1a
+	return hash;
+}
+
+template<typename T> static bool sameCorner(const std::vector<T>& stream, size_t a, size_t b)
+{
+	return stream.empty() || memcmp(&stream[a], &stream[b], sizeof(T)) == 0;
+}
+
+template<typename T> static void compactStream(std::vector<T>& stream, const std::vector<unsigned int>& first_corner)
+{
+	if (stream.empty())
+		return;
+	std::vector<T> result(first_corner.size());
+	for (size_t i = 0; i < first_corner.size(); ++i)
+		result[i] = stream[first_corner[i]];
+	stream.swap(result);
+}
+
+bool Mesh::weldVertices()
+{
+	size_t num = vertices.size();
+	if (!num || m_indices.size() || interleaved.size())
+		return false;
+	if ((normals.size() && normals.size() != num) || (uvs.size() && uvs.size() != num) || (m_uvs1.size() && m_uvs1.size() != num) ||
+		(colors.size() && colors.size() != num) || (bones.size() && bones.size() != num) || (weights.size() && weights.size() != num))
+		return false;
+
+	//open addressing, the table stores the new vertex of every slot and first_corner the corner that created it
+	size_t table_size = 1;
+	while (table_size < num * 2)
+		table_size *= 2;
+	const unsigned int empty = 0xFFFFFFFF;
+	std::vector<unsigned int> table(table_size, empty);
+	std::vector<unsigned int> first_corner;
+	first_corner.reserve(num / 4);
+	m_indices.resize(num);
+
+	for (size_t i = 0; i < num; ++i)
+	{
+		unsigned int hash = 2166136261u;
+		hash = hashCorner(vertices, i, hash);
+		hash = hashCorner(normals, i, hash);
+		hash = hashCorner(uvs, i, hash);
+		hash = hashCorner(m_uvs1, i, hash);
+		hash = hashCorner(colors, i, hash);
+		hash = hashCorner(bones, i, hash);
+		hash = hashCorner(weights, i, hash);
+
+		size_t slot = hash & (table_size - 1);
+		while (true)
+		{
+			unsigned int index = table[slot];
+			if (index == empty)
+			{
+				index = table[slot] = (unsigned int)first_corner.size();
+				first_corner.push_back((unsigned int)i);
+				m_indices[i] = index;
+				break;
+			}
+			size_t j = first_corner[index];
+			if (sameCorner(vertices, i, j) && sameCorner(normals, i, j) && sameCorner(uvs, i, j) && sameCorner(m_uvs1, i, j) &&
+				sameCorner(colors, i, j) && sameCorner(bones, i, j) && sameCorner(weights, i, j))
+			{
+				m_indices[i] = index;
+				break;
+			}
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+
+	compactStream(vertices, first_corner);
+	compactStream(normals, first_corner);
+	compactStream(uvs, first_corner);
+	compactStream(m_uvs1, first_corner);
+	compactStream(colors, first_corner);
+	compactStream(bones, first_corner);
+	compactStream(weights, first_corner);
+
+	//submeshes were ranges of corners, now they are the same ranges of indices
+	return true;
+}
+
 typedef struct 
 {
 	int version;
@@ -750,37 +1104,84 @@ typedef struct
 	int num_submeshes;
 	Matrix44 bind_matrix;
 	char streams[8]; //Vertex/Interlaved|Normal|Uvs|Color|Indices|Bones|Weights|Extra|Uvs1
-	char extra[32]; //unused
+	int quantization; //eMeshQuantization flags, the streams are stored in their VRAM format
+	char extra[28]; //unused
 } sMeshInfo;
 
-bool Mesh::readBin(const char* filename, bool bFromNetwork)
+struct sBinStream {
+	size_t offset;
+	size_t bytes; //0 if the stream is not in the file
+};
+
+//finds where every stream starts, in the order writeBin stores them, false if any of them goes past the end of the file
+static bool locateBinStreams(const sMeshInfo& info, size_t file_size, sBinStream* streams)
 {
-	FILE *f;
-	assert(filename);
+	if (info.size < 0 || info.num_indices < 0 || info.num_bones < 0 || info.num_submeshes < 0)
+		return false;
 
-	struct stat stbuffer;
+	size_t pos = 4 + sizeof(sMeshInfo);
+	auto add = [&](eMeshStream stream, bool present, size_t count) {
+		streams[stream].offset = pos;
+		streams[stream].bytes = 0;
+		if (!present)
+			return true;
+		size_t element_size = Mesh::getStreamElementSize(stream, info.quantization, info.streams[0] == 'I');
+		if (count > (file_size - pos) / element_size)
+			return false;
+		streams[stream].bytes = count * element_size;
+		pos += streams[stream].bytes;
+		return true;
+	};
+
+	return add(STREAM_VERTICES, true, info.size) &&
+		add(STREAM_NORMALS, info.streams[1] == 'N', info.size) &&
+		add(STREAM_UVS, info.streams[2] == 'U', info.size) &&
+		add(STREAM_COLORS, info.streams[3] == 'C', info.size) &&
+		add(STREAM_INDICES, info.streams[4] == 'I', info.num_indices) &&
+		add(STREAM_BONES, info.streams[5] == 'B', info.size) &&
+		add(STREAM_WEIGHTS, info.streams[6] == 'W', info.size) &&
+		add(STREAM_BONES_INFO, true, info.num_bones) &&
+		add(STREAM_UVS1, info.streams[7] == 'u', info.size) &&
+		add(STREAM_SUBMESHES, true, info.num_submeshes);
+}
 
-	stat(filename,&stbuffer);
-	f = fopen(filename,"rb");
-	if (f == NULL)
+template<typename T> static void copyBinStream(std::vector<T>& dst, const unsigned char* data, const sBinStream& stream)
+{
+	dst.resize(stream.bytes / sizeof(T));
+	if (stream.bytes)
+		memcpy((void*)&dst[0], data + stream.offset, stream.bytes);
+}
+
+bool Mesh::readBin(const char* filename, bool bFromNetwork, bool upload_only)
+{
+	assert(filename);
+
+	//mapped instead of read, the streams go from the page cache to the driver without a copy of the whole file
+	MappedFile file;
+	if (!file.open(filename))
 		return false;
 
-	unsigned int size = (unsigned int)stbuffer.st_size;
-	char* data = new char[size];
-	fread(data,size,1,f);
-	fclose(f);
+	if (!readBin(file.data, file.size, filename, upload_only))
+		return false;
+	if (!hasCPUData())
+	{
+		bin_filename = filename;
+		bin_offset = 0;
+	}
+	return true;
+}
 
+bool Mesh::readBin(const unsigned char* data, size_t size, const char* filename, bool upload_only)
+{
 	//watermark
-	if ( memcmp(data,"MBIN",4) != 0 )
+	if (size < 4 + sizeof(sMeshInfo) || memcmp(data, "MBIN", 4) != 0)
 	{
 		std::cout << "[ERROR] loading BIN: invalid content: " << filename << std::endl;
 		return false;
 	}
 
-	char* pos = data + 4;
 	sMeshInfo info;
-	memcpy(&info,pos,sizeof(sMeshInfo));
-	pos += sizeof(sMeshInfo);
+	memcpy(&info, data + 4, sizeof(sMeshInfo));
 
 	if(info.version != MESH_BIN_VERSION || info.header_bytes != sizeof(sMeshInfo) )
 	{
@@ -788,93 +1189,84 @@ bool Mesh::readBin(const char* filename, bool bFromNetwork)
 		return false;
 	}
 
-	if (info.streams[0] == 'I')
-	{
-		interleaved.resize(info.size);
-		memcpy((void*)&interleaved[0], pos, sizeof(tInterleaved) * info.size);
-		pos += sizeof(tInterleaved) * info.size;
-	}
-	else if (info.streams[0] == 'V')
-	{
-		vertices.resize(info.size);
-		memcpy((void*)&vertices[0], pos, sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[1] == 'N')
+	sBinStream streams[NUM_MESH_STREAMS];
+	if (!locateBinStreams(info, size, streams))
 	{
-		normals.resize(info.size);
-		memcpy((void*)&normals[0],pos,sizeof(Vector3) * info.size);
-		pos += sizeof(Vector3) * info.size;
-	}
-
-	if (info.streams[2] == 'U')
-	{
-		uvs.resize(info.size);
-		memcpy((void*)&uvs[0],pos,sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
+		std::cout << "[ERROR] loading BIN: streams out of the file, it is truncated or corrupted: " << filename << std::endl;
+		return false;
 	}
 
-	if (info.streams[3] == 'C')
-	{
-		colors.resize(info.size);
-		memcpy((void*)&colors[0],pos,sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
+	//the box is needed to dequantize the positions
+	aabb_max = info.aabb_max;
+	aabb_min = info.aabb_min;
+	box.center = info.center;
+	box.halfsize = info.halfsize;
+	radius = info.radius;
+	bind_matrix = info.bind_matrix;
+	quantization = info.quantization;
 
-	if (info.streams[4] == 'I')
-	{
-		m_indices.resize(info.num_indices);
-		memcpy((void*)&m_indices[0], pos, sizeof(unsigned int) * info.num_indices);
-		pos += sizeof(Vector3u) * info.num_indices;
-	}
+	bool is_interleaved = info.streams[0] == 'I';
 
-	if (info.streams[5] == 'B')
-	{
-		bones.resize(info.size);
-		memcpy((void*)&bones[0], pos, sizeof(Vector4ub) * info.size);
-		pos += sizeof(Vector4ub) * info.size;
-	}
+	//separated streams that are going to be interleaved need the CPU copies
+	if (upload_only && !is_interleaved && interleave_meshes && streams[STREAM_NORMALS].bytes && streams[STREAM_UVS].bytes)
+		upload_only = false;
 
-	if (info.streams[6] == 'W')
+	if (upload_only)
 	{
-		weights.resize(info.size);
-		memcpy((void*)&weights[0], pos, sizeof(Vector4) * info.size);
-		pos += sizeof(Vector4) * info.size;
-	}
+		//the file already has the VRAM format
+		for (int i = 0; i < NUM_MESH_STREAMS; ++i)
+		{
+			unsigned int* vbo_id = getStreamVBO(*this, i, is_interleaved);
+			if (vbo_id && streams[i].bytes)
+				uploadBuffer(*vbo_id, i == STREAM_INDICES ? GL_ELEMENT_ARRAY_BUFFER : GL_ARRAY_BUFFER, data + streams[i].offset, streams[i].bytes);
+		}
+		glBindBufferARB(GL_ARRAY_BUFFER, 0);
+		glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER, 0);
+		checkGLErrors();
 
-	if (info.streams[7] == 'u')
-	{
-		m_uvs1.resize(info.size);
-		memcpy((void*)&m_uvs1[0], pos, sizeof(Vector2) * info.size);
-		pos += sizeof(Vector2) * info.size;
+		num_vertices = info.size;
+		num_indices = info.num_indices;
 	}
-
-	if (info.num_bones)
+	else
 	{
-		bones_info.resize(info.num_bones);
-		memcpy((void*)&bones_info[0], pos, sizeof(BoneInfo) * info.num_bones);
-		pos += sizeof(BoneInfo) * info.num_bones;
+		for (int i = 0; i < NUM_MESH_STREAMS; ++i)
+			if (i != STREAM_BONES_INFO && i != STREAM_SUBMESHES)
+			{
+				size_t count = streams[i].bytes / getStreamElementSize((eMeshStream)i, quantization, is_interleaved);
+				unpackStream(*this, i, data + streams[i].offset, count, is_interleaved);
+			}
 	}
 
-	aabb_max = info.aabb_max;
-	aabb_min = info.aabb_min;
-	box.center = info.center;
-	box.halfsize = info.halfsize;
-	radius = info.radius;
-	bind_matrix = info.bind_matrix;
-
-	submeshes.resize(info.num_submeshes);
-	memcpy(&submeshes[0], pos, sizeof(sSubmeshInfo) * info.num_submeshes);
-	pos += sizeof(sSubmeshInfo) * info.num_submeshes;
+	copyBinStream(bones_info, data, streams[STREAM_BONES_INFO]);
+	copyBinStream(submeshes, data, streams[STREAM_SUBMESHES]);
 
-	createCollisionModel();
+	//the collision model is created the first time it is used
 	return true;
 }
 
+bool Mesh::loadCPUData()
+{
+	if (hasCPUData())
+		return true;
+	if (bin_filename.empty())
+		return false;
+	MappedFile file;
+	if (!file.open(bin_filename.c_str()) || bin_offset >= file.size)
+		return false;
+	return readBin(file.data + bin_offset, file.size - bin_offset, bin_filename.c_str(), false);
+}
+
 bool Mesh::writeBin(const char* filename)
 {
+	if (!hasCPUData() && !loadCPUData())
+		return false;
 	assert( vertices.size() || interleaved.size() );
+
+	//baked meshes are stored in the order the GPU likes, only indexed meshes can be reordered
+	sMeshOptimizationStats optimization;
+	if (optimizeMesh(this, &optimization))
+		std::cout << "[ACMR " << optimization.acmr_before << " -> " << optimization.acmr_after << "] ";
+
 	std::string s_filename = filename;
 	s_filename += ".mbin";
 
@@ -884,6 +1276,15 @@ bool Mesh::writeBin(const char* filename)
 		std::cout << "[ERROR] cannot write mesh BIN: " << s_filename.c_str() << std::endl;
 		return false;
 	}
+	bool written = writeBin(f);
+	fclose(f);
+	return written;
+}
+
+bool Mesh::writeBin(FILE* f)
+{
+	if (!hasCPUData() && !loadCPUData())
+		return false;
 
 	//watermark
 	fwrite("MBIN",sizeof(char),4,f);
@@ -902,6 +1303,7 @@ bool Mesh::writeBin(const char* filename)
 	info.num_bones = bones_info.size();
 	info.bind_matrix = bind_matrix;
 	info.num_submeshes = submeshes.size();
+	info.quantization = quantization;
 
 	info.streams[0] = interleaved.size() ? 'I' : 'V';
 	info.streams[1] = normals.size() ? 'N' : ' ';
@@ -915,36 +1317,16 @@ bool Mesh::writeBin(const char* filename)
 	//write info
 	fwrite((void*)&info, sizeof(sMeshInfo),1, f);
 
-	//write streams
-	if (interleaved.size())
-		fwrite((void*)&interleaved[0], interleaved.size() * sizeof(tInterleaved), 1, f);
-	else
+	//write streams, in the same format they have in VRAM
+	std::vector<unsigned char> storage;
+	for (int i = 0; i < NUM_MESH_STREAMS; ++i)
 	{
-		fwrite((void*)&vertices[0], vertices.size() * sizeof(Vector3), 1, f);
-		if (normals.size())
-			fwrite((void*)&normals[0], normals.size() * sizeof(Vector3), 1, f);
-		if (uvs.size())
-			fwrite((void*)&uvs[0], uvs.size() * sizeof(Vector2), 1, f);
+		size_t bytes = 0;
+		const void* data = getStreamData(*this, i, storage, bytes);
+		if (data)
+			fwrite(data, bytes, 1, f);
 	}
 
-	if (colors.size())
-		fwrite((void*)&colors[0], colors.size() * sizeof(Vector4), 1, f);
-
-	if (m_indices.size())
-		fwrite((void*)&m_indices[0], m_indices.size() * sizeof(unsigned int), 1, f);
-
-	if (bones.size())
-		fwrite((void*)&bones[0], bones.size() * sizeof(Vector4ub), 1, f);
-	if (weights.size())
-		fwrite((void*)&weights[0], weights.size() * sizeof(Vector4), 1, f);
-	if (bones_info.size())
-		fwrite((void*)&bones_info[0], bones_info.size() * sizeof(BoneInfo), 1, f);
-	if (m_uvs1.size())
-		fwrite((void*)&m_uvs1[0], m_uvs1.size() * sizeof(Vector2), 1, f);
-
-	fwrite((void*)&submeshes[0], submeshes.size() * sizeof(sSubmeshInfo), 1, f);
-
-	fclose(f);
 	return true;
 }
 
@@ -1075,136 +1457,346 @@ bool Mesh::loadASE(const char* filename)
 		normals[count*3+2]=Vector3(-nX,nZ,nY);
 	}
 
+	weldVertices();
 	return true;
 }
 
+//OBJ parser: the file is split in chunks at line boundaries, every chunk is parsed in its own thread straight from
+//the mapping and then they are merged in file order, so the result does not depend on the number of threads
+
+#define OBJ_INDEX_MISSING 0x7FFFFFFF
+
+struct sOBJCorner {
+	int v, vt, vn; //0 based, relative ones are still local to the chunk
+	unsigned char relative; //1 v, 2 vt, 4 vn: negative index, the chunk base must be added
+};
+
+struct sOBJEvent {
+	bool is_group; //"g", otherwise "usemtl"
+	std::string name;
+	size_t triangle; //triangles of the chunk before it
+};
+
+struct sOBJChunk {
+	const char* start;
+	const char* end;
+	std::vector<Vector3> positions;
+	std::vector<Vector2> uvs;
+	std::vector<Vector3> normals;
+	std::vector<sOBJCorner> corners; //three per triangle
+	std::vector<sOBJEvent> events;
+	Vector3 aabb_min;
+	Vector3 aabb_max;
+	bool wrong_index;
+};
+
+static inline bool isOBJDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline const char* skipOBJSpaces(const char* pos, const char* end)
+{
+	while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r'))
+		pos++;
+	return pos;
+}
+
+static inline bool parseOBJFloat(const char*& pos, const char* end, float& value)
+{
+	pos = skipOBJSpaces(pos, end);
+	if (pos < end && *pos == '+') //from_chars does not accept it
+		pos++;
+#ifdef OBJ_FROM_CHARS
+	std::from_chars_result result = std::from_chars(pos, end, value);
+	if (result.ec == std::errc::invalid_argument)
+		return false;
+	pos = result.ptr; //out of range values are skipped and left as they were
+#else
+	//strtof needs a terminated string and the mapping has none
+	char number[64];
+	int len = 0;
+	while (pos + len < end && len < 63 && (isOBJDigit(pos[len]) || strchr("+-.eE", pos[len])))
+	{
+		number[len] = pos[len];
+		len++;
+	}
+	number[len] = 0;
+	char* number_end;
+	value = strtof(number, &number_end);
+	if (number_end == number)
+		return false;
+	pos += number_end - number;
+#endif
+	return true;
+}
+
+static inline bool parseOBJIndex(const char*& pos, const char* end, int& value)
+{
+	bool negative = pos < end && *pos == '-';
+	if (negative)
+		pos++;
+	if (pos >= end || !isOBJDigit(*pos))
+		return false;
+	value = 0;
+	while (pos < end && isOBJDigit(*pos))
+		value = value * 10 + (*pos++ - '0');
+	if (negative)
+		value = -value;
+	return value != 0;
+}
+
+//positive indices are absolute, negative ones count back from the elements of the chunk read so far
+static inline void resolveOBJIndex(int index, size_t count, int& value, unsigned char& relative, unsigned char flag)
+{
+	if (index > 0)
+		value = index - 1;
+	else
+	{
+		value = (int)count + index;
+		relative |= flag;
+	}
+}
+
+static void parseOBJLine(sOBJChunk& chunk, const char* pos, const char* end, std::vector<sOBJCorner>& polygon)
+{
+	pos = skipOBJSpaces(pos, end);
+	if (pos >= end || *pos == '#')
+		return;
+
+	const char* keyword = pos;
+	while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\r')
+		pos++;
+	size_t len = pos - keyword;
+
+	if (len == 1 && keyword[0] == 'v')
+	{
+		Vector3 v;
+		if (!parseOBJFloat(pos, end, v.x) || !parseOBJFloat(pos, end, v.y) || !parseOBJFloat(pos, end, v.z))
+			return;
+		chunk.positions.push_back(v);
+		chunk.aabb_min.setMin(v);
+		chunk.aabb_max.setMax(v);
+	}
+	else if (len == 2 && keyword[0] == 'v' && keyword[1] == 't')
+	{
+		Vector2 v;
+		if (!parseOBJFloat(pos, end, v.x))
+			return;
+		if (!parseOBJFloat(pos, end, v.y))
+			v.y = 0;
+		v.y = 1.0f - v.y;
+		chunk.uvs.push_back(v);
+	}
+	else if (len == 2 && keyword[0] == 'v' && keyword[1] == 'n')
+	{
+		Vector3 v;
+		if (!parseOBJFloat(pos, end, v.x) || !parseOBJFloat(pos, end, v.y) || !parseOBJFloat(pos, end, v.z))
+			return;
+		chunk.normals.push_back(v);
+	}
+	else if (len == 1 && keyword[0] == 'f')
+	{
+		//v, v/vt, v//vn or v/vt/vn
+		polygon.clear();
+		while (true)
+		{
+			pos = skipOBJSpaces(pos, end);
+			if (pos >= end)
+				break;
+			sOBJCorner corner;
+			corner.vt = corner.vn = OBJ_INDEX_MISSING;
+			corner.relative = 0;
+			int index;
+			if (!parseOBJIndex(pos, end, index))
+				return; //broken face, skip it
+			resolveOBJIndex(index, chunk.positions.size(), corner.v, corner.relative, 1);
+			if (pos < end && *pos == '/')
+			{
+				pos++;
+				if (pos < end && *pos != '/' && parseOBJIndex(pos, end, index))
+					resolveOBJIndex(index, chunk.uvs.size(), corner.vt, corner.relative, 2);
+				if (pos < end && *pos == '/')
+				{
+					pos++;
+					if (parseOBJIndex(pos, end, index))
+						resolveOBJIndex(index, chunk.normals.size(), corner.vn, corner.relative, 4);
+				}
+			}
+			polygon.push_back(corner);
+		}
+
+		//fan
+		for (size_t i = 2; i < polygon.size(); ++i)
+		{
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[i - 1]);
+			chunk.corners.push_back(polygon[i]);
+		}
+	}
+	else if ((len == 1 && keyword[0] == 'g') || (len == 6 && strncmp(keyword, "usemtl", 6) == 0))
+	{
+		pos = skipOBJSpaces(pos, end);
+		const char* name = pos;
+		while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\r')
+			pos++;
+
+		sOBJEvent event;
+		event.is_group = len == 1;
+		event.name.assign(name, pos - name);
+		event.triangle = chunk.corners.size() / 3;
+		chunk.events.push_back(event);
+	}
+}
+
+static void parseOBJChunk(sOBJChunk& chunk)
+{
+	const float max_float = 10000000;
+	const float min_float = -10000000;
+	chunk.aabb_min.set(max_float, max_float, max_float);
+	chunk.aabb_max.set(min_float, min_float, min_float);
+
+	std::vector<sOBJCorner> polygon;
+	const char* pos = chunk.start;
+	while (pos < chunk.end)
+	{
+		const char* line_end = (const char*)memchr(pos, '\n', chunk.end - pos);
+		if (!line_end)
+			line_end = chunk.end;
+		parseOBJLine(chunk, pos, line_end, polygon);
+		pos = line_end + 1;
+	}
+}
+
+//a new submesh starts when the group or the material changes after some triangles
+static void addOBJSubmesh(Mesh* mesh, sSubmeshInfo& submesh_info, int& last_submesh_vertex, int num_vertices, const sOBJEvent& event)
+{
+	if (last_submesh_vertex != num_vertices)
+	{
+		submesh_info.length = num_vertices - submesh_info.start;
+		last_submesh_vertex = num_vertices;
+		mesh->submeshes.push_back(submesh_info);
+		memset(&submesh_info, 0, sizeof(submesh_info));
+		strncpy(submesh_info.name, event.name.c_str(), sizeof(submesh_info.name) - 1);
+		submesh_info.start = last_submesh_vertex;
+	}
+	else if (!event.is_group)
+		strncpy(submesh_info.material, event.name.c_str(), sizeof(submesh_info.material) - 1);
+}
+
 bool Mesh::loadOBJ(const char* filename)
 {
-	std::string data;
-	if(!readFile(filename,data))
+	MappedFile file;
+	if (!file.open(filename))
 		return false;
-	char* pos = &data[0];
-	char line[255];
-	int i = 0;
+	const char* data = (const char*)file.data;
+	size_t size = file.size;
+
+	//small files are not worth the threads
+	const size_t min_chunk_size = 1 << 20;
+	int num_chunks = (int)std::max((size_t)1, std::min((size_t)getNumWorkerThreads(), size / min_chunk_size));
+	std::vector<sOBJChunk> chunks(num_chunks);
+	const char* pos = data;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		const char* end = i == num_chunks - 1 ? data + size : data + size * (i + 1) / num_chunks;
+		if (end < pos)
+			end = pos;
+		const char* line_end = end < data + size ? (const char*)memchr(end, '\n', data + size - end) : NULL;
+		if (i < num_chunks - 1)
+			end = line_end ? line_end + 1 : data + size;
+		chunks[i].start = pos;
+		chunks[i].end = end;
+		pos = end;
+	}
+
+	parallelFor(num_chunks, [&](int i) { parseOBJChunk(chunks[i]); });
+
+	//where every chunk starts in the merged streams
+	std::vector<size_t> position_base(num_chunks), uv_base(num_chunks), normal_base(num_chunks), triangle_base(num_chunks);
+	size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_triangles = 0;
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		position_base[i] = num_positions;
+		uv_base[i] = num_uvs;
+		normal_base[i] = num_normals;
+		triangle_base[i] = num_triangles;
+		num_positions += chunks[i].positions.size();
+		num_uvs += chunks[i].uvs.size();
+		num_normals += chunks[i].normals.size();
+		num_triangles += chunks[i].corners.size() / 3;
+	}
 
 	std::vector<Vector3> indexed_positions;
 	std::vector<Vector3> indexed_normals;
 	std::vector<Vector2> indexed_uvs;
+	indexed_positions.reserve(num_positions);
+	indexed_uvs.reserve(num_uvs);
+	indexed_normals.reserve(num_normals);
 
 	const float max_float = 10000000;
 	const float min_float = -10000000;
 	aabb_min.set(max_float,max_float,max_float);
 	aabb_max.set(min_float,min_float,min_float);
 
-	unsigned int vertex_i = 0;
-
 	sSubmeshInfo submesh_info;
 	int last_submesh_vertex = 0;
 	memset(&submesh_info, 0, sizeof(submesh_info));
 
-	//parse file
-	while(*pos != 0)
-	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
-
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
-
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
-
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
-
-		if (tokens.empty()) continue;
-
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-
-			aabb_min.setMin( v );
-			aabb_max.setMax( v );
-		}
-		else if (tokens[0] == "vt" && tokens.size() >= 3)
-		{
-			Vector2 v((float)atof(tokens[1].c_str()), 1.0 - (float)atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		sOBJChunk& chunk = chunks[i];
+		indexed_positions.insert(indexed_positions.end(), chunk.positions.begin(), chunk.positions.end());
+		indexed_uvs.insert(indexed_uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+		indexed_normals.insert(indexed_normals.end(), chunk.normals.begin(), chunk.normals.end());
+		aabb_min.setMin(chunk.aabb_min);
+		aabb_max.setMax(chunk.aabb_max);
+		for (size_t j = 0; j < chunk.events.size(); ++j)
+			addOBJSubmesh(this, submesh_info, last_submesh_vertex, (int)(triangle_base[i] + chunk.events[j].triangle) * 3, chunk.events[j]);
+	}
+
+	vertices.resize(num_triangles * 3);
+	if (num_uvs)
+		uvs.resize(num_triangles * 3);
+	if (num_normals)
+		normals.resize(num_triangles * 3);
+
+	//every chunk writes its own range, missing uvs and normals are left to zero
+	parallelFor(num_chunks, [&](int i) {
+		sOBJChunk& chunk = chunks[i];
+		size_t first = triangle_base[i] * 3;
+		chunk.wrong_index = false;
+		for (size_t j = 0; j < chunk.corners.size(); ++j)
 		{
-			Vector3 v((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()), (float)atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
-		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
-		{
-			//process mesh: ????
-			//if (uvs.size() == 0 && indexed_uvs.size() )
-			//	uvs.resize(1);
-		}
-		else if (tokens[0] == "usemtl") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
+			const sOBJCorner& corner = chunk.corners[j];
+			size_t v = corner.v + (corner.relative & 1 ? position_base[i] : 0);
+			if (v >= num_positions)
 			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy(submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
+				chunk.wrong_index = true;
+				continue;
 			}
-			else
-				strcpy(submesh_info.material, tokens[1].c_str());
-		}
-		else if (tokens[0] == "g") //surface? it appears one time before the faces
-		{
-			if (last_submesh_vertex != vertices.size())
+			vertices[first + j] = indexed_positions[v];
+			if (num_uvs && corner.vt != OBJ_INDEX_MISSING)
 			{
-				submesh_info.length = vertices.size() - submesh_info.start;
-				last_submesh_vertex = vertices.size();
-				submeshes.push_back(submesh_info);
-				memset(&submesh_info, 0, sizeof(submesh_info));
-				strcpy( submesh_info.name, tokens[1].c_str());
-				submesh_info.start = last_submesh_vertex;
+				size_t vt = corner.vt + (corner.relative & 2 ? uv_base[i] : 0);
+				if (vt < num_uvs)
+					uvs[first + j] = indexed_uvs[vt];
 			}
-		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
-		{
-			Vector3 v1,v2,v3;
-			v1.parseFromText( tokens[1].c_str(), '/' );
-
-			for (unsigned int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			if (num_normals && corner.vn != OBJ_INDEX_MISSING)
 			{
-				v2.parseFromText( tokens[iPoly].c_str(), '/' );
-				v3.parseFromText( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ (unsigned int)(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v2.x) -1] );
-				vertices.push_back( indexed_positions[ (unsigned int)(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back( indexed_uvs[(unsigned int)(v1.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v2.y) -1] );
-					uvs.push_back( indexed_uvs[(unsigned int)(v3.y) -1] );
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back( indexed_normals[(unsigned int)(v1.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v2.z) -1] );
-					normals.push_back( indexed_normals[(unsigned int)(v3.z) -1] );
-				}
+				size_t vn = corner.vn + (corner.relative & 4 ? normal_base[i] : 0);
+				if (vn < num_normals)
+					normals[first + j] = indexed_normals[vn];
 			}
 		}
-	}
+	});
+
+	for (int i = 0; i < num_chunks; ++i)
+		if (chunks[i].wrong_index)
+		{
+			std::cout << "[ERROR] OBJ face uses a vertex that does not exist: " << filename << std::endl;
+			break;
+		}
 
 	box.center = (aabb_max + aabb_min) * 0.5;
 	box.halfsize = (aabb_max - box.center);
@@ -1212,6 +1804,8 @@ bool Mesh::loadOBJ(const char* filename)
 
 	submesh_info.length = vertices.size() - last_submesh_vertex;
 	submeshes.push_back(submesh_info);
+
+	weldVertices();
 	return true;
 }
 
@@ -1556,6 +2150,21 @@ Mesh* Mesh::getQuad()
 	return quad;
 }
 
+//FORMAT_* of a file name, 0 if it is not a mesh
+char getMeshFileFormat(const std::string& name)
+{
+	std::string ext = name.substr(name.find_last_of(".")+1);
+	if (ext == "ase" || ext == "ASE")
+		return FORMAT_ASE;
+	if (ext == "obj" || ext == "OBJ")
+		return FORMAT_OBJ;
+	if (ext == "mbin" || ext == "MBIN")
+		return FORMAT_MBIN;
+	if (ext == "mesh" || ext == "MESH")
+		return FORMAT_MESH;
+	return 0;
+}
+
 Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 {
 	assert(filename);
@@ -1566,52 +2175,64 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	if (skip_load)
 		return NULL;
 
-	Mesh* m = new Mesh();
-	std::string name = filename;
-
 	//detect format
-	char file_format = 0;
-	std::string ext = name.substr(name.find_last_of(".")+1);
-	if (ext == "ase" || ext == "ASE")
-		file_format = FORMAT_ASE;
-	else if (ext == "obj" || ext == "OBJ")
-		file_format = FORMAT_OBJ;
-	else if (ext == "mbin" || ext == "MBIN")
-		file_format = FORMAT_MBIN;
-	else if (ext == "mesh" || ext == "MESH")
-		file_format = FORMAT_MESH;
-	else 
-	{
-		//if (ext.size()) std::cerr << "Unknown mesh format: " << filename << std::endl;
+	if (!getMeshFileFormat(filename))
+	{
+		//std::cerr << "Unknown mesh format: " << filename << std::endl;
 		return NULL;
 	}
 
+	//only loads are measured, not the lookups
+	CPU_SCOPE("Mesh load");
+
 	//stats
 	double time = getTime();
 	std::cout << " + Mesh loading: " << filename << " ... ";
-	std::string binfilename = filename;
 
+	//when it goes to VRAM the streams of a .mbin are uploaded from the file without CPU copies
+	Mesh* m = new Mesh();
+	if (!m->load(filename, std::cout, bFromNetwork, auto_upload_to_vram))
+	{
+		delete m;
+		std::cout << "[ERROR]: Mesh not found" << std::endl;
+		return NULL;
+	}
+
+	//and upload them to VRAM
+	if (auto_upload_to_vram && m->hasCPUData())
+	{
+		std::cout << "[VRAM] ";
+		m->uploadToVRAM();
+	}
+
+	std::cout << "[OK]  Faces: " << (m->getNumIndices() ? m->getNumIndices() : m->getNumVertices()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+
+	m->registerMesh(filename);
+	return m;
+}
+
+bool Mesh::load(const char* filename, std::ostream& log, bool bFromNetwork, bool map_to_vram)
+{
+	char file_format = getMeshFileFormat(filename);
+	if (!file_format)
+		return false;
+
+	std::string binfilename = filename;
 	if (file_format != FORMAT_MBIN)
 		binfilename = binfilename + ".mbin";
 
 	//try loading the binary version
-	if (use_binary && m->readBin(binfilename.c_str(), bFromNetwork) )
+	if (use_binary && readBin(binfilename.c_str(), bFromNetwork, map_to_vram))
 	{
-		if (interleave_meshes && m->interleaved.size() == 0)
+		log << "[FROM BIN] ";
+		if (!hasCPUData())
+			log << "[VRAM MAPPED] ";
+		else if (interleave_meshes && interleaved.size() == 0)
 		{
-			std::cout << "[INTERL] ";
-			m->interleaveBuffers();
+			log << "[INTERL] ";
+			interleaveBuffers();
 		}
-
-		if (auto_upload_to_vram)
-		{
-			std::cout << "[VRAM] ";
-			m->uploadToVRAM();
-		}
-
-		std::cout << "[OK BIN]  Faces: " << (m->interleaved.size() ? m->interleaved.size() : m->vertices.size()) / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
-		sMeshesLoaded[filename] = m;
-		return m;
+		return true;
 	}
 
 	assert(!bFromNetwork);
@@ -1619,43 +2240,66 @@ Mesh* Mesh::Get(const char* filename, bool bFromNetwork, bool skip_load)
 	//load the ascii version
 	bool loaded = false;
 	if (file_format == FORMAT_OBJ)
-		loaded = m->loadOBJ(filename);
+		loaded = loadOBJ(filename);
 	else if (file_format == FORMAT_ASE)
-		loaded = m->loadASE(filename);
+		loaded = loadASE(filename);
 	else if (file_format == FORMAT_MESH)
-		loaded = m->loadMESH(filename);
-
+		loaded = loadMESH(filename);
 	if (!loaded)
-	{
-		delete m;
-		std::cout << "[ERROR]: Mesh not found" << std::endl;
-		return NULL;
-	}
+		return false;
 
 	//to optimize, interleave the meshes
 	if (interleave_meshes)
 	{
-		std::cout << "[INTERL] ";
-		m->interleaveBuffers();
+		log << "[INTERL] ";
+		interleaveBuffers();
 	}
 
-	//and upload them to VRAM
-	if (auto_upload_to_vram)
-	{
-		std::cout << "[VRAM] ";
-		m->uploadToVRAM();
-	}
+	//the .mbin keeps the quantized streams too
+	setQuantization(quantize_meshes);
 
-	std::cout << "[OK]  Faces: " << m->vertices.size() / 3 << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+	//bake before uploading, writeBin reorders the indices and VRAM must get the same order
 	if (use_binary)
 	{
-		std::cout << "\t\t Writing .BIN ... ";
-		m->writeBin(filename);
-		std::cout << "[OK]" << std::endl;
+		log << "[BIN] ";
+		writeBin(filename);
 	}
+	return true;
+}
 
-	m->registerMesh(name);
-	return m;
+void Mesh::swapData(Mesh& other)
+{
+	submeshes.swap(other.submeshes);
+	vertices.swap(other.vertices);
+	normals.swap(other.normals);
+	uvs.swap(other.uvs);
+	m_uvs1.swap(other.m_uvs1);
+	colors.swap(other.colors);
+	interleaved.swap(other.interleaved);
+	m_indices.swap(other.m_indices);
+	bones.swap(other.bones);
+	weights.swap(other.weights);
+	bones_info.swap(other.bones_info);
+	std::swap(bind_matrix, other.bind_matrix);
+	std::swap(aabb_min, other.aabb_min);
+	std::swap(aabb_max, other.aabb_max);
+	std::swap(box, other.box);
+	std::swap(radius, other.radius);
+	std::swap(vertices_vbo_id, other.vertices_vbo_id);
+	std::swap(uvs_vbo_id, other.uvs_vbo_id);
+	std::swap(normals_vbo_id, other.normals_vbo_id);
+	std::swap(colors_vbo_id, other.colors_vbo_id);
+	std::swap(indices_vbo_id, other.indices_vbo_id);
+	std::swap(interleaved_vbo_id, other.interleaved_vbo_id);
+	std::swap(bones_vbo_id, other.bones_vbo_id);
+	std::swap(weights_vbo_id, other.weights_vbo_id);
+	std::swap(uvs1_vbo_id, other.uvs1_vbo_id);
+	std::swap(num_vertices, other.num_vertices);
+	std::swap(num_indices, other.num_indices);
+	bin_filename.swap(other.bin_filename);
+	std::swap(bin_offset, other.bin_offset);
+	std::swap(quantization, other.quantization);
+	std::swap(collision_model, other.collision_model);
 }
 
 void Mesh::registerMesh( std::string name )
@@ -6,13 +6,29 @@
 
 #include <map>
 #include <string>
+#include <cstdio>
+#include <iosfwd>
 
 class Shader; //for binding
 class Image; //for displace
 class Skeleton; //for skinned meshes
 
-//version from 11/5/2020
-#define MESH_BIN_VERSION 11 //this is used to regenerate bins if the format changes
+//version 12 adds the quantized streams
+#define MESH_BIN_VERSION 13 //this is used to regenerate bins if the format changes
+
+//streams of a mesh, in the order they are stored in the .mbin
+enum eMeshStream { STREAM_VERTICES, STREAM_NORMALS, STREAM_UVS, STREAM_COLORS, STREAM_INDICES, STREAM_BONES, STREAM_WEIGHTS, STREAM_BONES_INFO, STREAM_UVS1, STREAM_SUBMESHES, NUM_MESH_STREAMS };
+
+//streams stored with less precision in VRAM and .mbin, the CPU vectors are always floats
+enum eMeshQuantization {
+	QUANTIZE_POSITIONS = 1, //snorm16 inside the box, shaders do a_vertex * u_vertex_scale + u_vertex_offset
+	QUANTIZE_NORMALS = 2, //snorm 10:10:10:2
+	QUANTIZE_UVS = 4, //half floats, both sets
+	QUANTIZE_WEIGHTS = 8, //unorm8
+	QUANTIZE_COLORS = 16, //unorm8
+	QUANTIZE_INDICES = 32, //16 bits
+	QUANTIZE_ALL = 63
+};
 
 struct BoneInfo {
 	char name[32]; //max 32 chars per bone name
@@ -34,6 +50,7 @@ public:
 	static bool use_binary; //always load the binary version of a mesh when possible
 	static bool interleave_meshes; //loaded meshes will me automatically interleaved
 	static bool auto_upload_to_vram; //loaded meshes will be stored in the VRAM
+	static int quantize_meshes; //eMeshQuantization flags used for the meshes loaded from files
 	static long num_meshes_rendered;
 	static long num_triangles_rendered;
 
@@ -80,6 +97,14 @@ public:
 	unsigned int weights_vbo_id;
 	unsigned int uvs1_vbo_id;
 
+	//counts of the streams uploaded straight from a .mbin, the CPU vectors stay empty until loadCPUData
+	unsigned int num_vertices;
+	unsigned int num_indices;
+	std::string bin_filename;
+	size_t bin_offset; //where the .mbin starts in bin_filename, meshes of a .pbin are inside it
+
+	int quantization; //eMeshQuantization flags of the streams in VRAM
+
 	Mesh();
 	~Mesh();
 
@@ -95,11 +120,17 @@ public:
 	void drawCall(unsigned int primitive, int submesh_id, int num_instances);
 	void disableBuffers(Shader* shader);
 
-	bool readBin(const char* filename, bool bFromNetwork);
+	bool readBin(const char* filename, bool bFromNetwork, bool upload_only = false); //upload_only sends the streams to VRAM from the mapped file without CPU copies
+	bool readBin(const unsigned char* data, size_t size, const char* filename, bool upload_only); //a .mbin already in memory, filename is only for the messages
 	bool writeBin(const char* filename);
+	bool writeBin(FILE* file); //writes the .mbin where the file is, as it is, without optimizing it
+	bool hasCPUData() { return vertices.size() || interleaved.size(); }
+	bool loadCPUData(); //reads the CPU copies back from the .mbin when they were not kept
 
 	unsigned int getNumSubmeshes() { return (unsigned int)submeshes.size(); }
-	unsigned int getNumVertices() { return (unsigned int)interleaved.size() ? (unsigned int)interleaved.size() : (unsigned int)vertices.size(); }
+	unsigned int getNumVertices() { return interleaved.size() ? (unsigned int)interleaved.size() : (vertices.size() ? (unsigned int)vertices.size() : num_vertices); }
+	unsigned int getNumIndices() { return m_indices.size() ? (unsigned int)m_indices.size() : num_indices; }
+	static int getStreamElementSize(eMeshStream stream, int quantization, bool interleaved); //bytes in VRAM and .mbin
 
 	//collision testing
 	void* collision_model;
@@ -110,9 +141,16 @@ public:
 
 	//loader
 	static Mesh* Get(const char* filename, bool bFromNetwork, bool skip_load = false);
+	bool load(const char* filename, std::ostream& log, bool bFromNetwork = false, bool map_to_vram = false); //no GL calls or manager unless map_to_vram, so it can run in a worker thread
+	void swapData(Mesh& other); //everything but the name, to fill a registered mesh with one loaded apart
 	static void Release();
 	void registerMesh(std::string name);
 
+	//file loaders, better use Get so meshes are cached
+	bool loadASE(const char* filename);
+	bool loadOBJ(const char* filename);
+	bool loadMESH(const char* filename); //personal format used for animations
+
 	//create help meshes
 	void createQuad(float center_x, float center_y, float w, float h, bool flip_uvs);
 	void createPlane(float size);
@@ -126,13 +164,10 @@ public:
 	void updateBoundingBox();
 
 	//optimize meshes
+	void setQuantization(int flags); //skips the streams that would lose too much, call it before uploadToVRAM
 	void uploadToVRAM();
 	bool interleaveBuffers();
-
-private:
-	bool loadASE(const char* filename);
-	bool loadOBJ(const char* filename);
-	bool loadMESH(const char* filename); //personal format used for animations
+	bool weldVertices(); //turns the corners of a non indexed mesh into indices, merging the identical ones
 };
 
 #endif
@@ -0,0 +1,353 @@
+#include "mesh_optimizer.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//Forsyth, "Linear-Speed Vertex Cache Optimisation", with his constants
+const int FORSYTH_CACHE_SIZE = 32;
+const int FORSYTH_MAX_VALENCE = 32; //more triangles per vertex use the last score
+
+struct sForsythScores {
+	float cache[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_MAX_VALENCE + 1];
+
+	sForsythScores()
+	{
+		//the last triangle used its 3 vertices, they get the same score so it does not matter which one goes first
+		for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+			cache[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+		//vertices with few triangles left go first, so they do not end alone
+		valence[0] = 0;
+		for (int i = 1; i <= FORSYTH_MAX_VALENCE; ++i)
+			valence[i] = 2.0f * powf((float)i, -0.5f);
+	}
+
+	float get(int cache_position, unsigned int remaining) const
+	{
+		if (remaining == 0)
+			return -1.0f; //nothing left to draw with this vertex
+		return (cache_position >= 0 ? cache[cache_position] : 0.0f) + valence[std::min(remaining, (unsigned int)FORSYTH_MAX_VALENCE)];
+	}
+};
+
+float computeACMR(const unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size)
+{
+	if (num_indices < 3)
+		return 0;
+
+	//a vertex is in the cache if it was loaded less than cache_size misses ago
+	std::vector<unsigned int> timestamps(num_vertices, 0);
+	unsigned int time = cache_size + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (time - timestamps[v] > (unsigned int)cache_size)
+		{
+			timestamps[v] = time++;
+			misses++;
+		}
+	}
+	return misses / (float)(num_indices / 3);
+}
+
+void optimizeVertexCache(unsigned int* indices, size_t num_indices, size_t num_vertices)
+{
+	size_t num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	static const sForsythScores scores;
+
+	//triangles of every vertex, the ones already drawn are moved out of the list
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	for (size_t i = 0; i < num_triangles * 3; ++i)
+		remaining[indices[i]]++;
+	std::vector<unsigned int> offsets(num_vertices, 0);
+	for (size_t v = 1; v < num_vertices; ++v)
+		offsets[v] = offsets[v - 1] + remaining[v - 1];
+	std::vector<unsigned int> adjacency(num_triangles * 3);
+	std::vector<unsigned int> filled(num_vertices, 0);
+	for (size_t i = 0; i < num_triangles * 3; ++i)
+	{
+		unsigned int v = indices[i];
+		adjacency[offsets[v] + filled[v]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (size_t v = 0; v < num_vertices; ++v)
+		vertex_score[v] = scores.get(-1, remaining[v]);
+	std::vector<float> triangle_score(num_triangles);
+	for (size_t t = 0; t < num_triangles; ++t)
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+
+	std::vector<char> emitted(num_triangles, 0);
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+
+	int cache[FORSYTH_CACHE_SIZE + 3];
+	int cache_count = 0;
+	size_t cursor = 0; //first triangle that may not be drawn yet, used when the cache has nothing to offer
+
+	//any start is good, the best one is as good as any other
+	int best = (int)(std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin());
+
+	while (result.size() < num_triangles * 3)
+	{
+		if (best < 0)
+		{
+			while (emitted[cursor])
+				cursor++;
+			best = (int)cursor;
+		}
+
+		emitted[best] = 1;
+		const unsigned int* triangle = indices + best * 3;
+		for (int k = 0; k < 3; ++k)
+		{
+			unsigned int v = triangle[k];
+			result.push_back(v);
+
+			//remove it from the list of the vertex, the order of the list does not matter
+			unsigned int* list = &adjacency[offsets[v]];
+			for (unsigned int i = 0; i < remaining[v]; ++i)
+				if (list[i] == (unsigned int)best)
+				{
+					list[i] = list[remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+		}
+
+		//the vertices of the triangle go to the front of the cache
+		int new_cache[FORSYTH_CACHE_SIZE + 3];
+		int new_count = 0;
+		for (int k = 0; k < 3; ++k)
+			if (std::find(new_cache, new_cache + new_count, (int)triangle[k]) == new_cache + new_count)
+				new_cache[new_count++] = triangle[k];
+		for (int i = 0; i < cache_count; ++i)
+			if (std::find(new_cache, new_cache + new_count, cache[i]) == new_cache + new_count)
+				new_cache[new_count++] = cache[i];
+
+		//vertices pushed out of the cache, then the ones that moved
+		for (int i = 0; i < new_count; ++i)
+		{
+			unsigned int v = new_cache[i];
+			cache_position[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+			float score = scores.get(cache_position[v], remaining[v]);
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+				triangle_score[adjacency[offsets[v] + j]] += delta;
+		}
+		cache_count = std::min(new_count, FORSYTH_CACHE_SIZE);
+		std::copy(new_cache, new_cache + cache_count, cache);
+
+		//the next one is the best triangle that uses a vertex in the cache
+		best = -1;
+		float best_score = -1.0f;
+		for (int i = 0; i < cache_count; ++i)
+		{
+			unsigned int v = cache[i];
+			for (unsigned int j = 0; j < remaining[v]; ++j)
+			{
+				unsigned int t = adjacency[offsets[v] + j];
+				if (triangle_score[t] > best_score)
+				{
+					best_score = triangle_score[t];
+					best = (int)t;
+				}
+			}
+		}
+	}
+
+	std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeOverdraw(unsigned int* indices, size_t num_indices, const float* positions, size_t stride)
+{
+	const float threshold = 1.05f; //clusters can make the cache this much worse
+	const int cache_size = FORSYTH_CACHE_SIZE;
+
+	size_t num_triangles = num_indices / 3;
+	if (num_triangles < 2)
+		return;
+
+	size_t num_vertices = *std::max_element(indices, indices + num_triangles * 3) + 1;
+	float acmr = computeACMR(indices, num_triangles * 3, num_vertices, cache_size);
+
+	//a cluster ends where the cache starts cold anyway, or where it can restart without losing more than the threshold
+	std::vector<size_t> clusters;
+	std::vector<unsigned int> timestamps(num_vertices, 0);
+	unsigned int time = cache_size + 1;
+	size_t cluster_misses = 0;
+	size_t cluster_triangles = 0;
+	for (size_t t = 0; t < num_triangles; ++t)
+	{
+		const unsigned int* triangle = indices + t * 3;
+		bool hard_boundary = true;
+		for (int k = 0; k < 3; ++k)
+			if (time - timestamps[triangle[k]] <= (unsigned int)cache_size)
+				hard_boundary = false;
+		bool soft_boundary = cluster_triangles && cluster_misses <= acmr * threshold * cluster_triangles;
+
+		if (t == 0 || hard_boundary || soft_boundary)
+		{
+			clusters.push_back(t);
+			cluster_misses = 0;
+			cluster_triangles = 0;
+			time += cache_size + 1; //cold cache for the new cluster
+		}
+
+		for (int k = 0; k < 3; ++k)
+			if (time - timestamps[triangle[k]] > (unsigned int)cache_size)
+			{
+				timestamps[triangle[k]] = time++;
+				cluster_misses++;
+			}
+		cluster_triangles++;
+	}
+	if (clusters.size() < 2)
+		return;
+
+	auto position = [&](unsigned int v) { return *(const Vector3*)((const char*)positions + v * stride); };
+
+	//area weighted centroid of the whole range
+	Vector3 mesh_centroid;
+	float mesh_area = 0;
+	std::vector<Vector3> centroids(clusters.size()), normals(clusters.size());
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : num_triangles;
+		float cluster_area = 0;
+		for (size_t t = clusters[c]; t < end; ++t)
+		{
+			Vector3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]), c3 = position(indices[t * 3 + 2]);
+			Vector3 normal = (b - a).cross(c3 - a);
+			float area = (float)normal.length();
+			centroids[c] = centroids[c] + (a + b + c3) * (area / 3.0f);
+			normals[c] = normals[c] + normal;
+			cluster_area += area;
+		}
+		mesh_centroid = mesh_centroid + centroids[c];
+		mesh_area += cluster_area;
+		if (cluster_area > 0)
+			centroids[c] = centroids[c] * (1.0f / cluster_area);
+	}
+	if (mesh_area > 0)
+		mesh_centroid = mesh_centroid * (1.0f / mesh_area);
+
+	//clusters that face outwards occlude the rest, they go first
+	std::vector<float> keys(clusters.size());
+	std::vector<int> order(clusters.size());
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		float length = (float)normals[c].length();
+		keys[c] = length > 0 ? (centroids[c] - mesh_centroid).dot(normals[c]) / length : 0;
+		order[c] = (int)c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] > keys[b]; });
+
+	std::vector<unsigned int> result;
+	result.reserve(num_triangles * 3);
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		int c = order[i];
+		size_t end = c + 1 < (int)clusters.size() ? clusters[c + 1] : num_triangles;
+		result.insert(result.end(), indices + clusters[c] * 3, indices + end * 3);
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+std::vector<unsigned int> optimizeVertexFetch(unsigned int* indices, size_t num_indices, size_t num_vertices)
+{
+	const unsigned int unused = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(num_vertices, unused);
+	std::vector<unsigned int> order;
+	order.reserve(num_vertices);
+	for (size_t i = 0; i < num_indices; ++i)
+	{
+		unsigned int v = indices[i];
+		if (remap[v] == unused)
+		{
+			remap[v] = (unsigned int)order.size();
+			order.push_back(v);
+		}
+		indices[i] = remap[v];
+	}
+
+	//vertices without triangles go at the end, the streams keep their size
+	for (size_t v = 0; v < num_vertices; ++v)
+		if (remap[v] == unused)
+			order.push_back((unsigned int)v);
+	return order;
+}
+
+template<typename T> static void reorderStream(std::vector<T>& stream, const std::vector<unsigned int>& order)
+{
+	if (stream.size() != order.size())
+		return;
+	std::vector<T> result(stream.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		result[i] = stream[order[i]];
+	stream.swap(result);
+}
+
+bool optimizeMesh(Mesh* mesh, sMeshOptimizationStats* stats)
+{
+	if (!mesh->hasCPUData() && !mesh->loadCPUData())
+		return false;
+	if (mesh->m_indices.size() < 6)
+		return false;
+
+	unsigned int* indices = &mesh->m_indices[0];
+	size_t num_indices = mesh->m_indices.size() - mesh->m_indices.size() % 3;
+	size_t num_vertices = mesh->getNumVertices();
+	for (size_t i = 0; i < num_indices; ++i)
+		if (indices[i] >= num_vertices)
+			return false;
+
+	const float* positions = mesh->interleaved.size() ? &mesh->interleaved[0].vertex.x : &mesh->vertices[0].x;
+	size_t stride = mesh->interleaved.size() ? sizeof(Mesh::tInterleaved) : sizeof(Vector3);
+
+	float acmr_before = computeACMR(indices, num_indices, num_vertices);
+
+	//every submesh is a range of indices that must not mix with the others
+	std::vector<std::pair<size_t, size_t>> ranges;
+	for (size_t i = 0; i < mesh->submeshes.size(); ++i)
+	{
+		sSubmeshInfo& submesh = mesh->submeshes[i];
+		if (submesh.start < 0 || submesh.length <= 0 || submesh.start % 3 || (size_t)submesh.start + submesh.length > num_indices)
+			continue;
+		ranges.push_back(std::make_pair((size_t)submesh.start, (size_t)submesh.length));
+	}
+	if (mesh->submeshes.empty())
+		ranges.push_back(std::make_pair((size_t)0, num_indices));
+
+	for (size_t i = 0; i < ranges.size(); ++i)
+	{
+		optimizeVertexCache(indices + ranges[i].first, ranges[i].second, num_vertices);
+		optimizeOverdraw(indices + ranges[i].first, ranges[i].second, positions, stride);
+	}
+
+	std::vector<unsigned int> order = optimizeVertexFetch(indices, num_indices, num_vertices);
+	reorderStream(mesh->interleaved, order);
+	reorderStream(mesh->vertices, order);
+	reorderStream(mesh->normals, order);
+	reorderStream(mesh->uvs, order);
+	reorderStream(mesh->m_uvs1, order);
+	reorderStream(mesh->colors, order);
+	reorderStream(mesh->bones, order);
+	reorderStream(mesh->weights, order);
+
+	if (stats)
+	{
+		stats->acmr_before = acmr_before;
+		stats->acmr_after = computeACMR(&mesh->m_indices[0], num_indices, num_vertices);
+		stats->triangles = (int)(num_indices / 3);
+	}
+	return true;
+}
@@ -0,0 +1,37 @@
+/*  Mesh optimizer, reorders the indices and vertices of indexed meshes so the GPU does less work, it runs when
+	meshes are baked (.mbin) and when glTF primitives are imported, never while rendering.
+	Triangles are sorted for the post-transform vertex cache (Forsyth), then grouped in clusters that are drawn
+	from the outside in to reduce overdraw, and finally the vertices are renumbered in the order they are used.
+	Submesh ranges are optimized independently so they keep their start and length.
+*/
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+class Mesh;
+
+struct sMeshOptimizationStats {
+	float acmr_before; //average cache miss ratio, vertices transformed per triangle (0.5 is ideal, 3 the worst)
+	float acmr_after;
+	int triangles;
+};
+
+//simulates a FIFO post-transform cache over a range of indices
+float computeACMR(const unsigned int* indices, size_t num_indices, size_t num_vertices, int cache_size = 16);
+
+//sorts the triangles of a range for the vertex cache, in place
+void optimizeVertexCache(unsigned int* indices, size_t num_indices, size_t num_vertices);
+
+//splits the range in the clusters where the cache restarts and sorts them so the outer ones are drawn first
+void optimizeOverdraw(unsigned int* indices, size_t num_indices, const float* positions, size_t stride);
+
+//renumbers the vertices in the order of the indices, returns the old index of every new vertex
+std::vector<unsigned int> optimizeVertexFetch(unsigned int* indices, size_t num_indices, size_t num_vertices);
+
+//all the steps on the CPU copies of the mesh, false if it is not indexed
+bool optimizeMesh(Mesh* mesh, sMeshOptimizationStats* stats = NULL);
+
+#endif
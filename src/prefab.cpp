@@ -11,6 +11,8 @@
 #include "utils.h"
 #include "framework.h"
 #include "application.h"
+#include "profiler.h"
+#include "asset_loader.h"
 
 #include <iostream>
 
@@ -197,6 +199,7 @@ void Prefab::updateBounding()
 }
 
 std::map<std::string, Prefab*> Prefab::sPrefabsLoaded;
+bool Prefab::use_binary = true;
 
 Prefab* Prefab::Get(const char* filename)
 {
@@ -205,15 +208,9 @@ Prefab* Prefab::Get(const char* filename)
 	if (it != sPrefabsLoaded.end())
 		return it->second;
 
-	Prefab* prefab = nullptr;
-	{
-		if (!prefab)
-			prefab = loadGLTF(filename);
-		if (!prefab) {
-			std::cout << "[ERROR]: Prefab not found" << std::endl;
-			return NULL;
-		}
-	}
+	Prefab* prefab = Load(filename);
+	if (!prefab)
+		return NULL;
 
 	std::string name = filename;
 	prefab->registerPrefab(name);
@@ -221,6 +218,38 @@ Prefab* Prefab::Get(const char* filename)
 	return prefab;
 }
 
+Prefab* Prefab::Load(const char* filename, bool async_textures)
+{
+	//only loads are measured, not the lookups
+	CPU_SCOPE("Prefab load");
+
+	Prefab* prefab = nullptr;
+	std::string binfilename = std::string(filename) + ".pbin";
+	if (use_binary)
+	{
+		prefab = new Prefab();
+		if (prefab->readBin(binfilename.c_str(), async_textures))
+			std::cout << " + Prefab loaded from BIN: " << binfilename << std::endl;
+		else
+		{
+			delete prefab;
+			prefab = nullptr;
+		}
+	}
+	if (!prefab)
+	{
+		prefab = loadGLTF(filename);
+		if (prefab && use_binary)
+			prefab->writeBin(binfilename.c_str());
+	}
+	if (!prefab) {
+		std::cout << "[ERROR]: Prefab not found" << std::endl;
+		return NULL;
+	}
+	prefab->embedded_images.clear();
+	return prefab;
+}
+
 void Prefab::registerPrefab(std::string name)
 {
 	this->name = name;
@@ -249,3 +278,451 @@ void Prefab::updateNodesByName()
 	nodes_by_name.clear();
 	updateInDepth(nodes_by_name, &root);
 }
+
+//.pbin: "PBIN", sPrefabBinInfo, then the sources, textures, materials, meshes (a whole .mbin each) and nodes (parents first)
+//version 2 adds the compression of every texture
+#define PREFAB_BIN_VERSION 2
+
+struct sPrefabBinInfo {
+	int version;
+	int header_bytes;
+	int num_sources;
+	int num_textures;
+	int num_materials;
+	int num_meshes;
+	int num_nodes;
+	char extra[36]; //unused
+};
+
+struct sPrefabBinSource {
+	unsigned long long size;
+	long long modification_time;
+	unsigned long long hash; //checked only when the time changed, so a touched file does not invalidate it
+};
+
+struct sPrefabBinMaterial {
+	int alpha_mode;
+	float alpha_cutoff;
+	int two_sided;
+	Vector4 color;
+	float roughness_factor;
+	float metallic_factor;
+	Vector3 emissive_factor;
+	int textures[6]; //index in the textures of the file, -1 if none
+	int uv_channels[6];
+};
+
+struct sPrefabBinNode {
+	int parent; //index of a previous node, -1 for the root
+	int mesh; //-1 if none
+	int material;
+	int visible;
+	int layers;
+	Matrix44 model;
+};
+
+static void getMaterialSamplers(Material* material, Sampler** samplers)
+{
+	samplers[0] = &material->color_texture;
+	samplers[1] = &material->emissive_texture;
+	samplers[2] = &material->opacity_texture;
+	samplers[3] = &material->metallic_roughness_texture;
+	samplers[4] = &material->occlusion_texture;
+	samplers[5] = &material->normal_texture;
+}
+
+template<typename T> static int addBinResource(std::vector<T*>& list, std::map<T*, int>& indices, T* resource)
+{
+	if (!resource)
+		return -1;
+	auto it = indices.find(resource);
+	if (it != indices.end())
+		return it->second;
+	indices[resource] = (int)list.size();
+	list.push_back(resource);
+	return (int)list.size() - 1;
+}
+
+static void writeBinString(FILE* f, const std::string& str)
+{
+	int len = (int)str.size();
+	fwrite(&len, sizeof(int), 1, f);
+	fwrite(str.c_str(), 1, len, f);
+}
+
+//reads from the mapped file checking every access, a truncated file just sets ok to false
+struct sBinReader {
+	const unsigned char* data;
+	size_t size;
+	size_t pos;
+	bool ok;
+
+	template<typename T> void read(T& value)
+	{
+		if (!ok || size - pos < sizeof(T))
+		{
+			ok = false;
+			return;
+		}
+		memcpy((void*)&value, data + pos, sizeof(T));
+		pos += sizeof(T);
+	}
+
+	const unsigned char* readBytes(size_t bytes)
+	{
+		if (!ok || size - pos < bytes)
+		{
+			ok = false;
+			return NULL;
+		}
+		pos += bytes;
+		return data + pos - bytes;
+	}
+
+	std::string readString()
+	{
+		int len = 0;
+		read(len);
+		const unsigned char* str = len >= 0 ? readBytes(len) : NULL;
+		return str ? std::string((const char*)str, len) : std::string();
+	}
+};
+
+bool Prefab::writeBin(const char* filename)
+{
+	//the resources used by the nodes, every one stored once
+	std::vector<Node*> nodes;
+	std::vector<int> parents;
+	std::vector<Mesh*> meshes;
+	std::vector<Material*> materials;
+	std::vector<Texture*> textures;
+	std::map<Mesh*, int> mesh_indices;
+	std::map<Material*, int> material_indices;
+	std::map<Texture*, int> texture_indices;
+	std::map<Texture*, int> texture_compressions; //normal maps are compressed differently
+
+	nodes.push_back(&root);
+	parents.push_back(-1);
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		Node* node = nodes[i];
+		addBinResource(meshes, mesh_indices, node->mesh);
+		if (addBinResource(materials, material_indices, node->material) != -1)
+		{
+			Sampler* samplers[6];
+			getMaterialSamplers(node->material, samplers);
+			for (int j = 0; j < 6; ++j)
+				if (addBinResource(textures, texture_indices, samplers[j]->texture) != -1)
+					texture_compressions[samplers[j]->texture] = samplers[j] == &node->material->normal_texture ? TEXTURE_COMPRESS_NORMALMAP : TEXTURE_COMPRESS_COLOR;
+		}
+		for (int j = 0; j < node->children.size(); ++j)
+		{
+			nodes.push_back(node->children[j]);
+			parents.push_back(i);
+		}
+	}
+
+	std::vector<sPrefabBinSource> sources(source_files.size());
+	for (int i = 0; i < source_files.size(); ++i)
+	{
+		if (!getFileStats(source_files[i].c_str(), sources[i].size, sources[i].modification_time))
+		{
+			std::cout << "[ERROR] cannot write prefab BIN, source not found: " << source_files[i] << std::endl;
+			return false;
+		}
+		sources[i].hash = hashFile(source_files[i].c_str());
+	}
+
+	//written aside and renamed, meshes of an old .pbin may still be reading from it
+	std::string temp_filename = std::string(filename) + ".tmp";
+	FILE* f = fopen(temp_filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write prefab BIN: " << filename << std::endl;
+		return false;
+	}
+
+	//watermark
+	fwrite("PBIN", sizeof(char), 4, f);
+
+	sPrefabBinInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = PREFAB_BIN_VERSION;
+	info.header_bytes = sizeof(sPrefabBinInfo);
+	info.num_sources = (int)sources.size();
+	info.num_textures = (int)textures.size();
+	info.num_materials = (int)materials.size();
+	info.num_meshes = (int)meshes.size();
+	info.num_nodes = (int)nodes.size();
+	fwrite(&info, sizeof(info), 1, f);
+
+	for (int i = 0; i < sources.size(); ++i)
+	{
+		writeBinString(f, source_files[i]);
+		fwrite(&sources[i], sizeof(sPrefabBinSource), 1, f);
+	}
+
+	//textures with a file are only referenced, the embedded ones keep their encoded image
+	for (int i = 0; i < textures.size(); ++i)
+	{
+		auto it = embedded_images.find(textures[i]);
+		writeBinString(f, textures[i]->filename);
+		writeBinString(f, it != embedded_images.end() ? it->second.mime_type : std::string());
+		int compression = texture_compressions[textures[i]];
+		fwrite(&compression, sizeof(compression), 1, f);
+		unsigned long long bytes = it != embedded_images.end() ? it->second.data.size() : 0;
+		fwrite(&bytes, sizeof(bytes), 1, f);
+		if (bytes)
+			fwrite(&it->second.data[0], 1, bytes, f);
+	}
+
+	for (int i = 0; i < materials.size(); ++i)
+	{
+		Material* material = materials[i];
+		sPrefabBinMaterial mat{};
+		mat.alpha_mode = material->alpha_mode;
+		mat.alpha_cutoff = material->alpha_cutoff;
+		mat.two_sided = material->two_sided;
+		mat.color = material->color;
+		mat.roughness_factor = material->roughness_factor;
+		mat.metallic_factor = material->metallic_factor;
+		mat.emissive_factor = material->emissive_factor;
+		Sampler* samplers[6];
+		getMaterialSamplers(material, samplers);
+		for (int j = 0; j < 6; ++j)
+		{
+			mat.textures[j] = samplers[j]->texture ? texture_indices[samplers[j]->texture] : -1;
+			mat.uv_channels[j] = samplers[j]->uv_channel;
+		}
+		writeBinString(f, material->name);
+		fwrite(&mat, sizeof(mat), 1, f);
+	}
+
+	//every mesh is a .mbin preceded by its size
+	for (int i = 0; i < meshes.size(); ++i)
+	{
+		writeBinString(f, meshes[i]->name);
+		long start = ftell(f);
+		unsigned long long bytes = 0;
+		fwrite(&bytes, sizeof(bytes), 1, f);
+		if (!meshes[i]->writeBin(f))
+		{
+			std::cout << "[ERROR] cannot write prefab BIN, mesh without data: " << meshes[i]->name << std::endl;
+			fclose(f);
+			remove(temp_filename.c_str());
+			return false;
+		}
+		long end = ftell(f);
+		bytes = end - start - sizeof(bytes);
+		fseek(f, start, SEEK_SET);
+		fwrite(&bytes, sizeof(bytes), 1, f);
+		fseek(f, end, SEEK_SET);
+	}
+
+	for (int i = 0; i < nodes.size(); ++i)
+	{
+		Node* node = nodes[i];
+		sPrefabBinNode bin_node{};
+		bin_node.parent = parents[i];
+		bin_node.mesh = node->mesh ? mesh_indices[node->mesh] : -1;
+		bin_node.material = node->material ? material_indices[node->material] : -1;
+		bin_node.visible = node->visible;
+		bin_node.layers = node->layers;
+		bin_node.model = node->model;
+		writeBinString(f, node->name);
+		fwrite(&bin_node, sizeof(bin_node), 1, f);
+	}
+
+	fclose(f);
+	remove(filename);
+	if (rename(temp_filename.c_str(), filename) != 0)
+	{
+		std::cout << "[ERROR] cannot write prefab BIN: " << filename << std::endl;
+		return false;
+	}
+
+	std::cout << " + Prefab BIN saved: " << filename << std::endl;
+	return true;
+}
+
+bool Prefab::readBin(const char* filename, bool async_textures)
+{
+	MappedFile file;
+	if (!file.open(filename))
+		return false;
+
+	sBinReader reader = { file.data, file.size, 0, true };
+	const unsigned char* watermark = reader.readBytes(4);
+	sPrefabBinInfo info;
+	reader.read(info);
+	if (!reader.ok || memcmp(watermark, "PBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading prefab BIN: invalid content: " << filename << std::endl;
+		return false;
+	}
+	if (info.version != PREFAB_BIN_VERSION || info.header_bytes != sizeof(sPrefabBinInfo))
+	{
+		std::cout << "[WARN] loading prefab BIN: old version: " << filename << std::endl;
+		return false;
+	}
+
+	//outdated if any source changed: size first, then time, and the content only if the time is different
+	for (int i = 0; i < info.num_sources && reader.ok; ++i)
+	{
+		std::string source = reader.readString();
+		sPrefabBinSource stored;
+		reader.read(stored);
+		unsigned long long size;
+		long long modification_time;
+		if (!reader.ok || !getFileStats(source.c_str(), size, modification_time) || size != stored.size ||
+			(modification_time != stored.modification_time && hashFile(source.c_str()) != stored.hash))
+		{
+			std::cout << "[WARN] loading prefab BIN: outdated: " << filename << std::endl;
+			return false;
+		}
+		source_files.push_back(source);
+	}
+
+	std::vector<Texture*> textures(info.num_textures > 0 ? info.num_textures : 0);
+	for (int i = 0; i < textures.size() && reader.ok; ++i)
+	{
+		std::string name = reader.readString();
+		std::string mime_type = reader.readString();
+		int compression = 0;
+		reader.read(compression);
+		unsigned long long bytes = 0;
+		reader.read(bytes);
+		const unsigned char* data = reader.readBytes((size_t)bytes);
+		if (!reader.ok)
+			break;
+
+		if (!bytes)
+		{
+			if (name.size())
+				textures[i] = async_textures ? AssetLoader::getTextureAsync(name.c_str(), true, true, (eTextureCompression)compression) : Texture::Get(name.c_str(), true, true, (eTextureCompression)compression);
+			continue;
+		}
+
+		textures[i] = name.size() ? Texture::Find(name.c_str()) : NULL;
+		if (textures[i])
+			continue;
+		if (async_textures)
+		{
+			textures[i] = AssetLoader::getTextureAsync(name.c_str(), mime_type, data, (size_t)bytes);
+			continue;
+		}
+		std::vector<unsigned char> buffer(data, data + bytes);
+		Image img;
+		if (mime_type == "image/png")
+			img.loadPNG(buffer);
+		else if (mime_type == "image/jpeg")
+			img.loadJPG(buffer);
+		if (!img.width)
+			continue;
+		textures[i] = new Texture();
+		textures[i]->loadFromImage(&img);
+		if (name.size())
+			textures[i]->setName(name.c_str());
+	}
+
+	//materials and meshes already loaded are shared, as glTF does
+	std::vector<Material*> materials(info.num_materials > 0 ? info.num_materials : 0);
+	for (int i = 0; i < materials.size() && reader.ok; ++i)
+	{
+		std::string name = reader.readString();
+		sPrefabBinMaterial mat;
+		reader.read(mat);
+		if (!reader.ok)
+			break;
+		materials[i] = name.size() ? Material::Get(name.c_str()) : NULL;
+		if (materials[i])
+			continue;
+
+		Material* material = materials[i] = new Material();
+		if (name.size())
+			material->registerMaterial(name.c_str());
+		material->alpha_mode = (eAlphaMode)mat.alpha_mode;
+		material->alpha_cutoff = mat.alpha_cutoff;
+		material->two_sided = mat.two_sided != 0;
+		material->color = mat.color;
+		material->roughness_factor = mat.roughness_factor;
+		material->metallic_factor = mat.metallic_factor;
+		material->emissive_factor = mat.emissive_factor;
+		Sampler* samplers[6];
+		getMaterialSamplers(material, samplers);
+		for (int j = 0; j < 6; ++j)
+		{
+			samplers[j]->texture = mat.textures[j] >= 0 && mat.textures[j] < textures.size() ? textures[mat.textures[j]] : NULL;
+			samplers[j]->uv_channel = mat.uv_channels[j];
+		}
+	}
+
+	//the streams go to VRAM straight from the mapping, the mesh reads them again from the .pbin if it needs the CPU copies
+	std::vector<Mesh*> meshes(info.num_meshes > 0 ? info.num_meshes : 0);
+	for (int i = 0; i < meshes.size() && reader.ok; ++i)
+	{
+		std::string name = reader.readString();
+		unsigned long long bytes = 0;
+		reader.read(bytes);
+		size_t offset = reader.pos;
+		const unsigned char* data = reader.readBytes((size_t)bytes);
+		if (!reader.ok)
+			break;
+		meshes[i] = name.size() ? Mesh::Get(name.c_str(), false, true) : NULL;
+		if (meshes[i])
+			continue;
+
+		Mesh* mesh = new Mesh();
+		if (!mesh->readBin(data, (size_t)bytes, filename, Mesh::auto_upload_to_vram))
+		{
+			delete mesh;
+			reader.ok = false;
+			break;
+		}
+		if (mesh->hasCPUData())
+			mesh->uploadToVRAM();
+		else
+		{
+			mesh->bin_filename = filename;
+			mesh->bin_offset = offset;
+		}
+		if (name.size())
+			mesh->registerMesh(name);
+		meshes[i] = mesh;
+	}
+
+	std::vector<Node*> nodes(info.num_nodes > 0 ? info.num_nodes : 0);
+	for (int i = 0; i < nodes.size() && reader.ok; ++i)
+	{
+		std::string name = reader.readString();
+		sPrefabBinNode bin_node;
+		reader.read(bin_node);
+		if (!reader.ok)
+			break;
+		if (i == 0 ? bin_node.parent != -1 : (bin_node.parent < 0 || bin_node.parent >= i))
+		{
+			reader.ok = false;
+			break;
+		}
+
+		Node* node = nodes[i] = i == 0 ? &root : new Node();
+		node->name = name;
+		node->visible = bin_node.visible != 0;
+		node->layers = bin_node.layers;
+		node->model = bin_node.model;
+		node->mesh = bin_node.mesh >= 0 && bin_node.mesh < meshes.size() ? meshes[bin_node.mesh] : NULL;
+		node->material = bin_node.material >= 0 && bin_node.material < materials.size() ? materials[bin_node.material] : NULL;
+		if (i)
+			nodes[bin_node.parent]->addChild(node);
+	}
+
+	if (!reader.ok || nodes.empty())
+	{
+		std::cout << "[ERROR] loading prefab BIN: truncated or corrupted: " << filename << std::endl;
+		root.clear();
+		return false;
+	}
+
+	updateNodesByName();
+	return true;
+}
@@ -88,6 +88,12 @@ namespace GTR {
 		void operator = (const Node& node);
 	};
 
+	//an image stored inside the glTF, the .pbin needs it because there is no file to load it from
+	struct sEmbeddedImage {
+		std::string mime_type;
+		std::vector<unsigned char> data;
+	};
+
 	//a Prefab represent a set of objects in a tree structure
 	//used to load info from GLTF files
 	class Prefab
@@ -102,6 +108,10 @@ namespace GTR {
 		Node root;
 		BoundingBox bounding;
 
+		//to compile it to a .pbin
+		std::vector<std::string> source_files; //the glTF and its buffers, the .pbin is valid while they do not change
+		std::map<Texture*, sEmbeddedImage> embedded_images; //only kept until the .pbin is written
+
 		//dtor
 		Prefab();
 		~Prefab();
@@ -113,7 +123,13 @@ namespace GTR {
 				//Manager to cache loaded prefabs
 		static std::map<std::string, Prefab*> sPrefabsLoaded;
 		static Prefab* Get(const char* filename);
+		static Prefab* Load(const char* filename, bool async_textures = false); //like Get but without the manager, the .pbin or the glTF
 		void registerPrefab(std::string name);
+
+		//compiled version: nodes, materials, texture references and the meshes as .mbin
+		static bool use_binary; //Get loads the .pbin next to the source when it is valid and writes it when it is not
+		bool readBin(const char* filename, bool async_textures = false); //false if it is missing, old or the sources changed
+		bool writeBin(const char* filename);
 	};
 
 };
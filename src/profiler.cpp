@@ -0,0 +1,338 @@
+#include "profiler.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+bool GPUProfiler::enabled = true;
+bool GPUProfiler::show_overlay = false;
+std::vector<sGPUPassStats> GPUProfiler::passes;
+int GPUProfiler::dropped_frames = 0;
+GPUProfiler::sFrame GPUProfiler::frames[GPU_PROFILER_FRAMES];
+int GPUProfiler::frame = 0;
+bool GPUProfiler::recording = false;
+std::vector<int> GPUProfiler::stack;
+std::map<std::string, int> GPUProfiler::pass_index;
+
+float sGPUPassStats::average() const
+{
+	if (!count)
+		return 0;
+	float sum = 0;
+	for (int i = 0; i < count; ++i)
+		sum += samples[i];
+	return sum / count;
+}
+
+float sGPUPassStats::percentile(float p) const
+{
+	if (!count)
+		return 0;
+	std::vector<float> sorted(samples, samples + count);
+	std::sort(sorted.begin(), sorted.end());
+	int index = (int)(p * (count - 1) + 0.5f);
+	return sorted[std::min(std::max(index, 0), count - 1)];
+}
+
+void GPUProfiler::beginFrame()
+{
+	recording = enabled;
+	if (!recording)
+		return;
+
+	//reuse the oldest frame of the ring once its results are read
+	frame++;
+	sFrame& f = frames[frame % GPU_PROFILER_FRAMES];
+	readFrame(f);
+	f.used = 0;
+	f.queries.clear();
+	stack.clear();
+
+	begin("frame");
+}
+
+void GPUProfiler::endFrame()
+{
+	if (!recording)
+		return;
+	while (stack.size())
+		end();
+	recording = false;
+}
+
+GLuint GPUProfiler::getQuery(sFrame& f)
+{
+	if (f.used == f.pool.size())
+	{
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		f.pool.push_back(query);
+	}
+	return f.pool[f.used++];
+}
+
+void GPUProfiler::begin(const char* name)
+{
+	if (!recording)
+		return;
+
+	int pass = 0;
+	auto it = pass_index.find(name);
+	if (it == pass_index.end())
+	{
+		sGPUPassStats stats;
+		stats.name = name;
+		stats.depth = stack.size();
+		stats.count = stats.next = 0;
+		stats.last = 0;
+		pass = passes.size();
+		passes.push_back(stats);
+		pass_index[name] = pass;
+	}
+	else
+		pass = it->second;
+
+	sFrame& f = frames[frame % GPU_PROFILER_FRAMES];
+	sQuery query;
+	query.pass = pass;
+	query.start = getQuery(f);
+	query.end = 0;
+	glQueryCounter(query.start, GL_TIMESTAMP);
+
+	stack.push_back(f.queries.size());
+	f.queries.push_back(query);
+}
+
+void GPUProfiler::end()
+{
+	if (!recording || stack.empty())
+		return;
+
+	sFrame& f = frames[frame % GPU_PROFILER_FRAMES];
+	sQuery& query = f.queries[stack.back()];
+	stack.pop_back();
+	query.end = getQuery(f);
+	glQueryCounter(query.end, GL_TIMESTAMP);
+}
+
+void GPUProfiler::readFrame(sFrame& f)
+{
+	if (f.queries.empty())
+		return;
+
+	//the last query issued is the last one to be ready, never wait for it
+	GLint available = 0;
+	glGetQueryObjectiv(f.pool[f.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		dropped_frames++;
+		return;
+	}
+
+	//a pass may run several times per frame, add them up
+	std::vector<float> frame_ms(passes.size(), 0.0f);
+	std::vector<bool> seen(passes.size(), false);
+	for (int i = 0; i < f.queries.size(); ++i)
+	{
+		sQuery& query = f.queries[i];
+		if (!query.end)
+			continue;
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+		frame_ms[query.pass] += (end - start) / 1000000.0;
+		seen[query.pass] = true;
+	}
+
+	for (int i = 0; i < passes.size(); ++i)
+	{
+		if (!seen[i])
+			continue;
+		sGPUPassStats& stats = passes[i];
+		stats.last = frame_ms[i];
+		stats.samples[stats.next] = frame_ms[i];
+		stats.next = (stats.next + 1) % GPU_PROFILER_HISTORY;
+		if (stats.count < GPU_PROFILER_HISTORY)
+			stats.count++;
+	}
+}
+
+std::string GPUProfiler::getText()
+{
+	std::string str = "GPU (ms)                 avg     p50     p95     p99\n";
+	char line[256];
+	for (int i = 0; i < passes.size(); ++i)
+	{
+		sGPUPassStats& stats = passes[i];
+		int indent = stats.depth * 2;
+		snprintf(line, sizeof(line), "%*s%-*s %7.3f %7.3f %7.3f %7.3f\n", indent, "", 20 - indent, stats.name.c_str(),
+			stats.average(), stats.percentile(0.5), stats.percentile(0.95), stats.percentile(0.99));
+		str += line;
+	}
+	return str;
+}
+
+void GPUProfiler::renderOverlay(float x, float y)
+{
+	drawText(x, y, getText(), Vector3(1, 1, 1), 1.5);
+}
+
+bool GPUProfiler::exportCSV(const char* filename)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write GPU profile: " << filename << std::endl;
+		return false;
+	}
+
+	fprintf(file, "pass,depth,samples,avg_ms,p50_ms,p95_ms,p99_ms,last_ms\n");
+	for (int i = 0; i < passes.size(); ++i)
+	{
+		sGPUPassStats& stats = passes[i];
+		fprintf(file, "%s,%d,%d,%f,%f,%f,%f,%f\n", stats.name.c_str(), stats.depth, stats.count,
+			stats.average(), stats.percentile(0.5), stats.percentile(0.95), stats.percentile(0.99), stats.last);
+	}
+	fclose(file);
+
+	std::cout << " + GPU profile saved: " << filename << std::endl;
+	return true;
+}
+
+bool GPUProfiler::exportJSON(const char* filename)
+{
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddNumberToObject(root, "dropped_frames", dropped_frames);
+	cJSON* list = cJSON_AddArrayToObject(root, "passes");
+	for (int i = 0; i < passes.size(); ++i)
+	{
+		sGPUPassStats& stats = passes[i];
+		cJSON* pass = cJSON_CreateObject();
+		cJSON_AddStringToObject(pass, "name", stats.name.c_str());
+		cJSON_AddNumberToObject(pass, "depth", stats.depth);
+		cJSON_AddNumberToObject(pass, "samples", stats.count);
+		cJSON_AddNumberToObject(pass, "avg_ms", stats.average());
+		cJSON_AddNumberToObject(pass, "p50_ms", stats.percentile(0.5));
+		cJSON_AddNumberToObject(pass, "p95_ms", stats.percentile(0.95));
+		cJSON_AddNumberToObject(pass, "p99_ms", stats.percentile(0.99));
+		cJSON_AddNumberToObject(pass, "last_ms", stats.last);
+		cJSON_AddItemToArray(list, pass);
+	}
+
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write GPU profile: " << filename << std::endl;
+		free(text);
+		return false;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	free(text);
+
+	std::cout << " + GPU profile saved: " << filename << std::endl;
+	return true;
+}
+
+#ifdef USE_CPU_PROFILER
+
+#include <chrono>
+
+bool CPUProfiler::enabled = true;
+std::mutex CPUProfiler::threads_mutex;
+std::vector<sCPUThreadBuffer*> CPUProfiler::threads;
+
+unsigned long long getTimeNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+sCPUThreadBuffer* CPUProfiler::getThreadBuffer()
+{
+	//buffers are never freed so a trace can be saved after the thread ends
+	thread_local sCPUThreadBuffer* buffer = NULL;
+	if (!buffer)
+	{
+		buffer = new sCPUThreadBuffer();
+		buffer->count = 0;
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		buffer->tid = threads.size();
+		buffer->name = buffer->tid == 0 ? "main" : "thread " + std::to_string(buffer->tid);
+		threads.push_back(buffer);
+	}
+	return buffer;
+}
+
+void CPUProfiler::record(const char* name, unsigned long long start, unsigned long long end)
+{
+	if (!enabled)
+		return;
+	sCPUThreadBuffer* buffer = getThreadBuffer();
+	unsigned int index = buffer->count.load(std::memory_order_relaxed);
+	sCPUEvent& event = buffer->events[index % CPU_PROFILER_EVENTS];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	buffer->count.store(index + 1, std::memory_order_release);
+}
+
+void CPUProfiler::setThreadName(const char* name)
+{
+	sCPUThreadBuffer* buffer = getThreadBuffer();
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	buffer->name = name;
+}
+
+bool CPUProfiler::exportTrace(const char* filename)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write CPU trace: " << filename << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(threads_mutex);
+
+	//timestamps in the trace format are microseconds
+	unsigned long long base = ~0ULL;
+	for (int i = 0; i < threads.size(); ++i)
+	{
+		sCPUThreadBuffer* buffer = threads[i];
+		unsigned int count = buffer->count.load(std::memory_order_acquire);
+		unsigned int first = count > CPU_PROFILER_EVENTS ? count - CPU_PROFILER_EVENTS : 0;
+		if (first < count)
+			base = std::min(base, buffer->events[first % CPU_PROFILER_EVENTS].start);
+	}
+
+	int num_events = 0;
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	for (int i = 0; i < threads.size(); ++i)
+	{
+		sCPUThreadBuffer* buffer = threads[i];
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", i ? ",\n" : "", buffer->tid, buffer->name.c_str());
+
+		unsigned int count = buffer->count.load(std::memory_order_acquire);
+		unsigned int first = count > CPU_PROFILER_EVENTS ? count - CPU_PROFILER_EVENTS : 0;
+		for (unsigned int j = first; j < count; ++j)
+		{
+			sCPUEvent& event = buffer->events[j % CPU_PROFILER_EVENTS];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", event.name, buffer->tid,
+				(event.start - base) / 1000.0, (event.end - event.start) / 1000.0);
+			num_events++;
+		}
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	std::cout << " + CPU trace saved: " << filename << " (" << num_events << " events)" << std::endl;
+	return true;
+}
+
+#endif
@@ -0,0 +1,144 @@
+/*  This contains the GPU profiler, it measures how long every render pass takes in the GPU.
+	Passes are wrapped with GPU_SCOPE("name") and results are read some frames later so it never stalls.
+	It also contains the CPU profiler, CPU_SCOPE("name") records scopes of any thread into per-thread
+	ring buffers that can be saved as a Chrome trace (chrome://tracing). Without USE_CPU_PROFILER it compiles to nothing.
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "includes.h"
+#include "stats.h"
+
+#define GPU_PROFILER_FRAMES 4 //frames in flight before reading the queries
+#define GPU_PROFILER_HISTORY 128 //samples used for the rolling stats
+
+//stats of one pass over the last frames, in ms
+struct sGPUPassStats {
+	std::string name;
+	int depth; //nesting level, used to indent
+	float samples[GPU_PROFILER_HISTORY];
+	int count;
+	int next;
+	float last;
+
+	float average() const;
+	float percentile(float p) const;
+};
+
+class GPUProfiler
+{
+public:
+	static bool enabled;
+	static bool show_overlay;
+
+	static std::vector<sGPUPassStats> passes;
+	static int dropped_frames; //frames whose results were not ready in time
+
+	static void beginFrame();
+	static void endFrame();
+	static void begin(const char* name);
+	static void end();
+
+	static std::string getText();
+	static void renderOverlay(float x, float y);
+	static bool exportCSV(const char* filename);
+	static bool exportJSON(const char* filename);
+
+private:
+	struct sQuery {
+		int pass;
+		GLuint start;
+		GLuint end;
+	};
+	struct sFrame {
+		std::vector<GLuint> pool;
+		int used = 0;
+		std::vector<sQuery> queries;
+	};
+
+	static sFrame frames[GPU_PROFILER_FRAMES];
+	static int frame;
+	static bool recording; //enabled state for the current frame
+	static std::vector<int> stack; //open scopes, index in the queries of the frame
+	static std::map<std::string, int> pass_index;
+
+	static GLuint getQuery(sFrame& f);
+	static void readFrame(sFrame& f);
+};
+
+//measures the GPU time until the end of the block, it is also a pass of the render stats
+struct sGPUScope {
+	sGPUScope(const char* name) { GPUProfiler::begin(name); RenderStats::beginPass(name); }
+	~sGPUScope() { RenderStats::endPass(); GPUProfiler::end(); }
+};
+
+#define GPU_SCOPE_CONCAT(a, b) a##b
+#define GPU_SCOPE_NAME(line) GPU_SCOPE_CONCAT(gpu_scope_, line)
+#define GPU_SCOPE(name) sGPUScope GPU_SCOPE_NAME(__LINE__)(name)
+
+#ifdef USE_CPU_PROFILER
+
+#include <atomic>
+#include <mutex>
+
+#define CPU_PROFILER_EVENTS (1 << 16) //events kept per thread
+
+//nanoseconds from a monotonic clock
+unsigned long long getTimeNs();
+
+//one finished scope, name must be a string literal
+struct sCPUEvent {
+	const char* name;
+	unsigned long long start;
+	unsigned long long end;
+};
+
+//only the owner thread writes, readers use the atomic count
+struct sCPUThreadBuffer {
+	int tid;
+	std::string name;
+	sCPUEvent events[CPU_PROFILER_EVENTS];
+	std::atomic<unsigned int> count;
+};
+
+class CPUProfiler
+{
+public:
+	static bool enabled;
+
+	static void record(const char* name, unsigned long long start, unsigned long long end);
+	static void setThreadName(const char* name);
+	static bool exportTrace(const char* filename);
+
+private:
+	static std::mutex threads_mutex; //only used to register threads and export
+	static std::vector<sCPUThreadBuffer*> threads;
+	static sCPUThreadBuffer* getThreadBuffer();
+};
+
+struct sCPUScope {
+	const char* name;
+	unsigned long long start;
+	sCPUScope(const char* name) : name(name), start(getTimeNs()) {}
+	~sCPUScope() { CPUProfiler::record(name, start, getTimeNs()); }
+};
+
+#define CPU_SCOPE_NAME(line) GPU_SCOPE_CONCAT(cpu_scope_, line)
+#define CPU_SCOPE(name) sCPUScope CPU_SCOPE_NAME(__LINE__)(name)
+#define CPU_THREAD_NAME(name) CPUProfiler::setThreadName(name)
+#define CPU_EXPORT_TRACE(filename) CPUProfiler::exportTrace(filename)
+
+#else
+
+#define CPU_SCOPE(name)
+#define CPU_THREAD_NAME(name)
+#define CPU_EXPORT_TRACE(filename)
+
+#endif
+
+#endif
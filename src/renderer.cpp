@@ -9,7 +9,10 @@
 #include "utils.h"
 #include "scene.h"
 #include "extra/hdre.h"
+#include "profiler.h"
+#include "texture_residency.h"
 #include <algorithm>    // std::sort
+#include <map>
 
 #include "application.h"
 
@@ -62,8 +65,9 @@ GTR::Renderer::Renderer()
 	show_ref_probes = false;
 	show_volumetric = true;
 
+	//decals are blended straight into the gbuffer albedo, depth is only sampled
 	decals_fbo = FBO();
-	decals_fbo.create(w, h, 3, GL_RGBA, GL_UNSIGNED_BYTE, true);
+	decals_fbo.setTextures({ gbuffers_fbo.color_textures[0] });
 
 	dof_fbo = FBO();
 	dof_fbo.create(w, h, 3, GL_RGBA, GL_UNSIGNED_BYTE, true);
@@ -87,6 +91,53 @@ GTR::Renderer::Renderer()
 	chroma_amount = 0.002;
 
 	show_lens = false;
+
+	//accumulation (color + revealage in alpha) and weights, sharing the gbuffer depth
+	oit = false;
+	oit_pass = false;
+	oit_fbo = FBO();
+	oit_fbo.setTextures({ new Texture(w, h, GL_RGBA, GL_FLOAT, false), new Texture(w, h, GL_RGBA, GL_FLOAT, false) }, gbuffers_fbo.depth_texture);
+
+	//fbos above are allocated at the max size, the frame uses a corner of them
+	dynamic_resolution = false;
+	render_scale = 1.0;
+	frame_scale = 1.0;
+	min_render_scale = 0.5;
+	max_render_scale = 1.0;
+	target_frame_ms = 16.0;
+	gpu_frame_ms = 0.0;
+	upscale_sharpness = 0.5;
+	glGenQueries(4, frame_queries);
+	for (int i = 0; i < 4; ++i)
+		frame_query_scaled[i] = false;
+	query_frame = 0;
+
+	render_cache = true;
+	cache_valid = false;
+	cached_scene_hash = 0;
+	cached_post_hash = 0;
+	lit_texture = new Texture(w, h, GL_RGB, GL_FLOAT, false);
+	cached_frames = 0;
+	frame_cached = false;
+
+	max_shadowmaps = 8;
+	max_reflection_probes = 4;
+
+	//names shown in the memory report
+	gbuffers_fbo.name = "gbuffers";
+	ssao_fbo.name = "ssao";
+	ssao_blur.name = "ssao_blur";
+	illumination_fbo.name = "illumination";
+	irr_fbo.name = "irradiance";
+	reflections_fbo.name = "reflections";
+	decals_fbo.name = "decals";
+	dof_fbo.name = "dof";
+	downsample_fbo.name = "downsample";
+	postpo_fbo.name = "postfx";
+	oit_fbo.name = "oit";
+	upsample_tex1->filename = "upsample1";
+	upsample_tex2->filename = "upsample2";
+	lit_texture->filename = "lit_texture";
 }
 
 void Renderer::initReflectionProbe(Scene* scene) {
@@ -95,21 +146,38 @@ void Renderer::initReflectionProbe(Scene* scene) {
 
 	reflection_probes.clear();
 
-	//create the probe
-	sReflectionProbe* probe = new sReflectionProbe;
+	//one probe per REFLECTION_PROBE entity, every probe renders the scene six times so they are capped
+	std::vector<Vector3> positions;
+	for (int i = 0; i < scene->entities.size(); ++i)
+		if (scene->entities[i]->entity_type == REFLECTION_PROBE)
+			positions.push_back(scene->entities[i]->model.getTranslation());
+	if (positions.size() > max_reflection_probes)
+	{
+		std::cout << "[WARN] " << positions.size() << " reflection probes in the scene, only the first " << max_reflection_probes << " are used" << std::endl;
+		positions.resize(max_reflection_probes);
+	}
+	if (positions.empty())
+		positions.push_back(Vector3(0, 10, 20));
+
+	for (int i = 0; i < positions.size(); ++i)
+	{
+		//create the probe
+		sReflectionProbe* probe = new sReflectionProbe;
 
-	//set it up
-	probe->pos = Vector3(0, 10, 20);
-	probe->cubemap = new Texture();
-	probe->cubemap->createCubemap(512, 512, NULL, GL_RGB, GL_UNSIGNED_INT, false);
+		//set it up
+		probe->pos = positions[i];
+		probe->cubemap = new Texture();
+		probe->cubemap->createCubemap(512, 512, NULL, GL_RGB, GL_UNSIGNED_INT, false);
 
-	//add it to the list
-	reflection_probes.push_back(probe);
+		//add it to the list
+		reflection_probes.push_back(probe);
+	}
 
 	captureCubemaps(scene);
 }
 
 void Renderer::captureCubemaps(Scene* scene) {
+	CPU_SCOPE("captureCubemaps");
 	//for every reflection probe...
 
 	//define camera with fov 90
@@ -146,9 +214,11 @@ void Renderer::captureCubemaps(Scene* scene) {
 		//generate the mipmaps
 		probe.cubemap->generateMipmaps();
 	}
+	invalidateCache();
 }
 
 void Renderer::renderSkyBox(Texture* environment, Camera* camera) {
+	GPU_SCOPE("skybox");
 	Mesh* sphere = Mesh::Get("data/meshes/sphere.obj", false);
 	Shader* s = Shader::Get("skybox");
 
@@ -227,6 +297,7 @@ void Renderer::updateIrradianceCache(Scene* scene)
 	std::cout << " - Updating Irradiance Cache" << std::endl;
 	computeProbeCoefficients(scene);
 	uploadProbes();
+	invalidateCache();
 }
 
 void Renderer::defineGrid(Scene* scene) {
@@ -263,6 +334,7 @@ void Renderer::defineGrid(Scene* scene) {
 			}
 
 	probes_texture = new Texture(9, probes.size(), GL_RGB, GL_FLOAT);
+	probes_texture->filename = "irradiance probes";
 
 	computeProbeCoefficients(scene);	
 	uploadProbes();
@@ -270,6 +342,7 @@ void Renderer::defineGrid(Scene* scene) {
 
 void Renderer::computeProbeCoefficients(Scene* scene) 
 {
+	CPU_SCOPE("computeProbeCoefficients");
 	FloatImage images[6]; //here we will store the six views
 
 	//set the fov to 90 and the aspect to 1
@@ -358,6 +431,7 @@ RenderCall GTR::Renderer::createRenderCall(Matrix44 model, Mesh* mesh, Material*
 
 void GTR::Renderer::collectRCsandLights(GTR::Scene* scene, Camera* camera)
 {
+	CPU_SCOPE("collectRCsandLights");
 	renderCalls.clear();
 	scene->l_entities.clear();
 
@@ -387,6 +461,8 @@ void GTR::Renderer::collectRCsandLights(GTR::Scene* scene, Camera* camera)
 			//if bounding box is inside the camera frustum then the object is probably visible
 			//if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize)) {
 			scene->l_entities.push_back(lent);
+			if (lent->light_type == DIRECTIONAL || camera->testSphereInFrustum(lent->model.getTranslation(), lent->max_distance) != CLIP_OUTSIDE)
+				RENDER_STATS_ADD(visible_lights, 1);
 			if (lent->light_type == SPOT) // SPOT LIGHT CAMERA
 			{
 				Vector3 eye = lent->model.getTranslation(); // camera position
@@ -409,7 +485,11 @@ void GTR::Renderer::collectRCsandLights(GTR::Scene* scene, Camera* camera)
 
 	//std::sort(std::begin(renderCalls), std::end(renderCalls), less_than_alpha());
 	//std::sort(std::begin(renderCalls), std::end(renderCalls), less_than_depth());
-	std::sort(std::begin(renderCalls), std::end(renderCalls), sort_alpha_depth());
+	CPU_SCOPE("sort");
+	if (oit && pipeline_mode == DEFERRED)
+		std::sort(std::begin(renderCalls), std::end(renderCalls), sort_alpha_material());
+	else
+		std::sort(std::begin(renderCalls), std::end(renderCalls), sort_alpha_depth());
 
 }
 
@@ -419,9 +499,10 @@ void Renderer::renderToFBOForward(GTR::Scene* scene, Camera* camera)
 	float h = Application::instance->window_height;
 
 	// create lights' FBO
-	generateShadowmaps(scene);
+	generateShadowmaps(scene, camera);
 
 	// show scene
+	GPU_SCOPE("forward");
 	glEnable(GL_DEPTH_TEST);
 	glViewport(0, 0, w, h);
 	renderScene(scene, camera);
@@ -429,8 +510,69 @@ void Renderer::renderToFBOForward(GTR::Scene* scene, Camera* camera)
 
 void Renderer::renderToFBODeferred(GTR::Scene* scene, Camera* camera) {
 
-	generateShadowmaps(scene);
+	//the debug views show the whole textures, keep them at full size
+	bool debug_view = render_mode == SHOW_GBUFFERS || render_mode == SHOW_SSAO || render_mode == SHOW_DOWNSAMPLING;
+	frame_scale = 1.0;
+	if (dynamic_resolution && !debug_view)
+		frame_scale = render_scale;
+	float scale = frame_scale;
+
+	//if nothing that affects the frame changed just present the last one,
+	//redoing the post fx from the lit image when only their settings changed
+	bool use_cache = render_cache && !debug_view;
+	unsigned long long scene_hash = 0;
+	unsigned long long post_hash = 0;
+	if (use_cache)
+	{
+		scene_hash = computeSceneHash(scene, camera);
+		post_hash = computePostHash();
+		if (cache_valid && scene_hash == cached_scene_hash)
+		{
+			if (post_hash != cached_post_hash)
+			{
+				if (scale < 1.0)
+				{
+					glScissor(0, 0, ceil(gbuffers_fbo.width * scale), ceil(gbuffers_fbo.height * scale));
+					glEnable(GL_SCISSOR_TEST);
+				}
+				lit_texture->copyTo(illumination_fbo.color_textures[0]);
+				renderPostFX(scene, camera);
+				cached_post_hash = post_hash;
+			}
+			presentFrame(illumination_fbo.color_textures[0]);
+			cached_frames++;
+			frame_cached = true;
+			TextureResidency::frame_cached = true;
+			return;
+		}
+	}
+
+	generateShadowmaps(scene, camera);
+
+	//squeeze the clip space into the bottom-left corner so every pass that
+	//reconstructs positions from the gbuffer keeps working unchanged
+	Camera scaled_camera = *camera;
+	Camera* prev_camera = Camera::current;
+	if (scale < 1.0)
+	{
+		Matrix44 clip_scale;
+		clip_scale.m[0] = scale;
+		clip_scale.m[5] = scale;
+		clip_scale.m[12] = scale - 1.0;
+		clip_scale.m[13] = scale - 1.0;
+		scaled_camera.viewprojection_matrix = camera->viewprojection_matrix * clip_scale;
+		camera = &scaled_camera;
+		Camera::current = camera;
+
+		//and avoid shading the pixels outside the scaled viewport
+		float w = gbuffers_fbo.width;
+		float h = gbuffers_fbo.height;
+		glScissor(0, 0, ceil(w * scale), ceil(h * scale));
+		glEnable(GL_SCISSOR_TEST);
+	}
 
+	GPUProfiler::begin("gbuffer");
+	RenderStats::beginPass("gbuffer");
 	gbuffers_fbo.bind();
 	gbuffers_fbo.enableSingleBuffer(0);
 	
@@ -449,20 +591,10 @@ void Renderer::renderToFBODeferred(GTR::Scene* scene, Camera* camera) {
 	renderScene(scene, camera);
 
 	gbuffers_fbo.unbind();
+	RenderStats::endPass();
+	GPUProfiler::end();
 
-	// PING PONG PARA DECALS
-	gbuffers_fbo.color_textures[0]->copyTo(decals_fbo.color_textures[0]);
-	gbuffers_fbo.color_textures[1]->copyTo(decals_fbo.color_textures[1]);
-	gbuffers_fbo.color_textures[2]->copyTo(decals_fbo.color_textures[2]);
-
-	decals_fbo.bind();
-	gbuffers_fbo.depth_texture->copyTo(NULL);
 	renderDecals(scene, camera);
-	decals_fbo.unbind();
-
-	decals_fbo.color_textures[0]->copyTo(gbuffers_fbo.color_textures[0]);
-	decals_fbo.color_textures[1]->copyTo(gbuffers_fbo.color_textures[1]);
-	decals_fbo.color_textures[2]->copyTo(gbuffers_fbo.color_textures[2]);
 
 	Shader* shader = Shader::Get("depth");
 	shader->enable();
@@ -525,29 +657,29 @@ void Renderer::renderToFBODeferred(GTR::Scene* scene, Camera* camera) {
 		
 		illumination_fbo.unbind();
 
-		// RENDER POSTPROCESSING FX
-		if (render_mode != SHOW_IRRADIANCE)
+		// TRANSPARENCY
+		if (oit) renderTransparentsOIT(scene, camera);
+
+		//keep the lit image so post fx changes do not need a full frame
+		if (use_cache)
 		{
-			// DOF
-			if (show_dof) showDoF(scene, camera);
-			// GLOW
-			if (show_glow) showGlow();
-			// CHROMATIC ABERRATION
-			if (show_chroma) showChromaticAberration();
-			// LENS DISTORTION
-			if (show_lens) showLensDistortion();
+			illumination_fbo.color_textures[0]->copyTo(lit_texture);
+			cached_scene_hash = scene_hash;
+			cached_post_hash = post_hash;
+			cache_valid = true;
 		}
 
-		//be sure blending is not active
-		glDisable(GL_BLEND);
-		Shader* s_final = NULL;
-		if (hdr) s_final = Shader::Get("final");
-		glViewport(0.0f, 0.0f, w, h);
+		// RENDER POSTPROCESSING FX
+		renderPostFX(scene, camera);
 
 		if (render_mode == SHOW_DOWNSAMPLING) {
 			show_glow = true;
 
+			//be sure blending is not active
 			glDisable(GL_BLEND);
+			glDisable(GL_SCISSOR_TEST);
+			Shader* s_final = NULL;
+			if (hdr) s_final = Shader::Get("final");
 			glViewport(0.0f, h / 2, w / 2, h / 2);
 			illumination_fbo.color_textures[0]->toViewport(s_final);
 			glViewport(w / 2, h / 2, w / 2, h / 2);
@@ -557,16 +689,70 @@ void Renderer::renderToFBODeferred(GTR::Scene* scene, Camera* camera) {
 			glViewport(w / 2, 0.0f, w / 2, h / 2);
 			downsample_fbo.color_textures[2]->toViewport(s_final);
 		}
-		else illumination_fbo.color_textures[0]->toViewport(s_final);
+		else presentFrame(illumination_fbo.color_textures[0]);
 	}
 	shader->disable();
 	
 	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	Camera::current = prev_camera;
+
+}
+
+void Renderer::renderPostFX(GTR::Scene* scene, Camera* camera)
+{
+	GPU_SCOPE("post");
+	if (render_mode == SHOW_IRRADIANCE)
+		return;
+
+	// DOF
+	if (show_dof) showDoF(scene, camera);
+	// GLOW
+	if (show_glow) showGlow();
+	// CHROMATIC ABERRATION
+	if (show_chroma) showChromaticAberration();
+	// LENS DISTORTION
+	if (show_lens) showLensDistortion();
+}
+
+void Renderer::presentFrame(Texture* texture)
+{
+	GPU_SCOPE("present");
+	float w = Application::instance->window_width;
+	float h = Application::instance->window_height;
+
+	//be sure blending is not active
+	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	glViewport(0.0f, 0.0f, w, h);
 
+	if (frame_scale < 1.0)
+		showUpscaled(texture, frame_scale);
+	else
+		texture->toViewport(hdr ? Shader::Get("final") : NULL);
+}
+
+void Renderer::showUpscaled(Texture* texture, float scale)
+{
+	Mesh* quad = Mesh::getQuad();
+	Shader* s = Shader::Get("upscale");
+
+	s->enable();
+	s->setUniform("u_texture", texture, 0);
+	s->setUniform("u_uv_scale", Vector2(scale, scale));
+	s->setUniform("u_iRes", Vector2(1.0 / (float)texture->width, 1.0 / (float)texture->height));
+	s->setUniform("u_sharpness", upscale_sharpness);
+	s->setUniform("u_tonemap", hdr);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	quad->render(GL_TRIANGLES);
+	s->disable();
 }
 
 void Renderer::showLensDistortion()
 {
+	GPU_SCOPE("lens");
 	postpo_fbo.bind();
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
@@ -576,7 +762,9 @@ void Renderer::showLensDistortion()
 
 	s->enable();
 	s->setUniform("u_texture", illumination_fbo.color_textures[0], 0);
-	s->setUniform("u_iRes", Vector2(1.0 / (float)w, 1.0 / (float)h));
+	//distort around the center of the scaled viewport
+	s->setUniform("u_iRes", Vector2(1.0 / (w * frame_scale), 1.0 / (h * frame_scale)));
+	s->setUniform("u_uv_scale", frame_scale);
 	s->setUniform("u_power", lens_power);
 
 	glDisable(GL_BLEND);
@@ -589,6 +777,7 @@ void Renderer::showLensDistortion()
 
 void Renderer::showChromaticAberration() 
 {
+	GPU_SCOPE("chromatic");
 	postpo_fbo.bind();
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
@@ -599,7 +788,7 @@ void Renderer::showChromaticAberration()
 	s->enable();
 	s->setUniform("u_texture", illumination_fbo.color_textures[0], 0);
 	s->setUniform("u_iRes", Vector2(1.0 / (float)w, 1.0 / (float)h));
-	s->setUniform("u_amount", (float)chroma_amount);
+	s->setUniform("u_amount", (float)chroma_amount * frame_scale);
 
 	glDisable(GL_BLEND);
 	glDisable(GL_DEPTH_TEST);
@@ -611,6 +800,7 @@ void Renderer::showChromaticAberration()
 
 void Renderer::showGlow()
 {
+	GPU_SCOPE("glow");
 	downsampleGlow();
 	upsampleGlow();
 
@@ -685,6 +875,7 @@ void Renderer::upsampleGlow()
 }
 
 void Renderer::showVolumetric(GTR::Scene* scene, Camera* camera) {
+	GPU_SCOPE("volumetric");
 	Mesh* quad = Mesh::getQuad();
 	Shader* s = Shader::Get("volumetric");
 
@@ -698,17 +889,21 @@ void Renderer::showVolumetric(GTR::Scene* scene, Camera* camera) {
 	s->setUniform("u_depth_texture", gbuffers_fbo.depth_texture, 3);
 	s->setUniform("u_inverse_viewprojection", inv_vp);
 	s->setUniform("u_near", camera->near_plane);
-	LightEntity* light;
+	//the moonlight scatters, any other directional light if the scene has no moon
+	LightEntity* light = NULL;
 	for (int i = 0; i < scene->l_entities.size(); ++i) {
-		if (scene->l_entities[i]->name == "moonlight") {
-			light = scene->l_entities[i];
-			break;
-		}
+		LightEntity* lent = scene->l_entities[i];
+		if (lent->light_type != DIRECTIONAL)
+			continue;
+		if (!light || lent->name == "moonlight")
+			light = lent;
 	}
+	if (!light)
+		return;
 	Matrix44 shadow_proj = light->light_camera->viewprojection_matrix;
 	s->setUniform("u_viewprojection", shadow_proj);
 	
-	Texture* shadowmap = light->shadow_buffer;
+	Texture* shadowmap = light->shadow_buffer ? light->shadow_buffer : Texture::getWhiteTexture();
 	s->setTexture("shadowmap", shadowmap, 5);
 	s->setUniform("u_bias", light->bias);
 	s->setUniform("u_light_color", light->color);
@@ -725,6 +920,7 @@ void Renderer::showVolumetric(GTR::Scene* scene, Camera* camera) {
 
 void Renderer::showIrradiance(GTR::Scene* scene, Camera* camera)
 {
+	GPU_SCOPE("irradiance");
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
 	Matrix44 inv_vp = camera->viewprojection_matrix;
@@ -763,6 +959,7 @@ void Renderer::showIrradiance(GTR::Scene* scene, Camera* camera)
 
 void GTR::Renderer::showDoF(GTR::Scene* scene, Camera* camera)
 {
+	GPU_SCOPE("dof");
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
 
@@ -792,6 +989,7 @@ void GTR::Renderer::showDoF(GTR::Scene* scene, Camera* camera)
 }
 
 void Renderer::illuminationDeferred(GTR::Scene* scene, Camera* camera) {
+	GPU_SCOPE("lighting");
 
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
@@ -874,6 +1072,10 @@ void Renderer::illuminationDeferred(GTR::Scene* scene, Camera* camera) {
 
 		if (lent->light_type == POINT || lent->light_type == SPOT)
 		{
+			//lights whose range does not reach the view add nothing
+			if (camera->testSphereInFrustum(lent->model.getTranslation(), lent->max_distance) == CLIP_OUTSIDE)
+				continue;
+
 			Matrix44 m;
 			m.setTranslation(lent->model.getTranslation().x, lent->model.getTranslation().y, lent->model.getTranslation().z);
 			m.scale(lent->max_distance, lent->max_distance, lent->max_distance); //and scale it according to the max_distance of the light
@@ -928,6 +1130,7 @@ void Renderer::illuminationDeferred(GTR::Scene* scene, Camera* camera) {
 
 void Renderer::showReflection(Camera* camera) 
 {
+	GPU_SCOPE("reflections");
 	float w = Application::instance->window_width;
 	float h = Application::instance->window_height;
 	Matrix44 inv_vp = camera->viewprojection_matrix;
@@ -956,6 +1159,7 @@ void Renderer::showReflection(Camera* camera)
 
 void Renderer::generateSSAO(GTR::Scene* scene, Camera* camera)
 {
+	GPU_SCOPE("ssao");
 	gbuffers_fbo.depth_texture->bind();
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -1044,11 +1248,185 @@ std::vector<Vector3> Renderer::generateSpherePoints(int num, float radius, bool
 }
 
 void Renderer::renderToFBO(GTR::Scene* scene, Camera* camera) {
+	CPU_SCOPE("Renderer::renderToFBO");
+
+	frame_cached = false;
+	beginFrameTimer();
+	GPUProfiler::beginFrame();
+	RenderStats::beginFrame();
 
 	switch (pipeline_mode) {
 	case FORWARD: renderToFBOForward(scene, camera); break;
 	case DEFERRED: renderToFBODeferred(scene, camera); break;
 	}
+
+	RenderStats::endFrame();
+	GPUProfiler::endFrame();
+	endFrameTimer();
+}
+
+void Renderer::beginFrameTimer()
+{
+	glBeginQuery(GL_TIME_ELAPSED, frame_queries[query_frame % 4]);
+}
+
+void Renderer::endFrameTimer()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+
+	//a cached frame only presents, its query is reused by the next one so the idle time never moves the scale
+	if (frame_cached)
+		return;
+
+	//forward and the debug views render at full size, their timings say nothing about the scale
+	frame_query_scaled[query_frame % 4] = pipeline_mode == DEFERRED && frame_scale == render_scale;
+	query_frame++;
+
+	//read the oldest query so we never stall waiting for the gpu
+	if (query_frame < 4)
+		return;
+	GLuint query = frame_queries[query_frame % 4];
+	GLint available = 0;
+	glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+	gpu_frame_ms = elapsed / 1000000.0;
+
+	if (dynamic_resolution && frame_query_scaled[query_frame % 4])
+		updateRenderScale(gpu_frame_ms);
+}
+
+//fnv-1a, used to detect changes in the inputs of a frame
+static void hashBytes(unsigned long long& hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+
+template<typename T> static void hashValue(unsigned long long& hash, const T& value)
+{
+	hashBytes(hash, &value, sizeof(T));
+}
+
+static void hashNode(unsigned long long& hash, GTR::Node* node)
+{
+	hashValue(hash, node->model);
+	hashValue(hash, node->visible);
+	hashValue(hash, node->mesh);
+	hashValue(hash, node->material);
+	if (node->material)
+	{
+		GTR::Material* material = node->material;
+		hashValue(hash, material->color);
+		hashValue(hash, material->emissive_factor);
+		hashValue(hash, material->alpha_mode);
+		hashValue(hash, material->alpha_cutoff);
+		hashValue(hash, material->two_sided);
+	}
+	for (int i = 0; i < node->children.size(); ++i)
+		hashNode(hash, node->children[i]);
+}
+
+unsigned long long Renderer::computeSceneHash(GTR::Scene* scene, Camera* camera)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	hashValue(hash, camera->viewprojection_matrix);
+	hashValue(hash, camera->eye);
+	hashValue(hash, frame_scale);
+
+	//settings used before the post fx
+	hashValue(hash, render_mode);
+	hashValue(hash, blur_ssao);
+	hashValue(hash, dithering);
+	hashValue(hash, show_probe);
+	hashValue(hash, show_ref_probes);
+	hashValue(hash, show_volumetric);
+	hashValue(hash, oit);
+	hashValue(hash, irr_normal_distance);
+
+	//resources filled or changed in place keep their pointers
+	hashValue(hash, getResourcesGeneration());
+
+	hashValue(hash, scene);
+	hashValue(hash, scene->background_color);
+	hashValue(hash, scene->ambient_light);
+	hashValue(hash, scene->environment);
+
+	for (int i = 0; i < scene->entities.size(); ++i)
+	{
+		BaseEntity* ent = scene->entities[i];
+		hashValue(hash, ent);
+		hashValue(hash, ent->model);
+		hashValue(hash, ent->visible);
+
+		if (ent->entity_type == PREFAB)
+		{
+			PrefabEntity* pent = (PrefabEntity*)ent;
+			hashValue(hash, pent->prefab);
+			if (pent->prefab)
+				hashNode(hash, &pent->prefab->root);
+		}
+		else if (ent->entity_type == LIGHT)
+		{
+			LightEntity* lent = (LightEntity*)ent;
+			hashValue(hash, lent->color);
+			hashValue(hash, lent->intensity);
+			hashValue(hash, lent->light_type);
+			hashValue(hash, lent->max_distance);
+			hashValue(hash, lent->cone_angle);
+			hashValue(hash, lent->area_size);
+			hashValue(hash, lent->exponent);
+			hashValue(hash, lent->bias);
+		}
+		else if (ent->entity_type == DECAL)
+			hashValue(hash, ((DecalEntity*)ent)->albedo);
+	}
+
+	return hash;
+}
+
+unsigned long long Renderer::computePostHash()
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	hashValue(hash, show_dof);
+	hashValue(hash, focus_plane);
+	hashValue(hash, aperture);
+	hashValue(hash, show_glow);
+	hashValue(hash, glow_factor);
+	hashValue(hash, show_chroma);
+	hashValue(hash, chroma_amount);
+	hashValue(hash, show_lens);
+	hashValue(hash, lens_power);
+
+	return hash;
+}
+
+void Renderer::invalidateCache()
+{
+	cache_valid = false;
+}
+
+void Renderer::updateRenderScale(float gpu_ms)
+{
+	if (gpu_ms <= 0.0)
+		return;
+
+	//ignore small deviations so the scale does not oscillate
+	float error = (gpu_ms - target_frame_ms) / target_frame_ms;
+	if (fabs(error) < 0.05)
+		return;
+
+	//the cost grows with the pixel count, the square of the scale
+	float ideal = render_scale * sqrt(target_frame_ms / gpu_ms);
+	render_scale = clamp(lerp(render_scale, ideal, 0.2), min_render_scale, max_render_scale);
 }
 
 void Renderer::renderMeshDeferred(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera) {
@@ -1106,6 +1484,7 @@ void Renderer::renderMeshDeferred(const Matrix44 model, Mesh* mesh, GTR::Materia
 
 void GTR::Renderer::renderDecals(GTR::Scene* scene, Camera* camera)
 {
+	GPU_SCOPE("decals");
 	static Mesh* mesh = NULL;
 	if (mesh == NULL)
 	{
@@ -1113,6 +1492,32 @@ void GTR::Renderer::renderDecals(GTR::Scene* scene, Camera* camera)
 		mesh->createCube();
 	}
 
+	//group the visible decals by texture, every group is a single instanced call
+	std::map<Texture*, std::vector<Matrix44>> visible_decals;
+	for (int i = 0; i < scene->entities.size(); ++i) 
+	{
+		BaseEntity* ent = scene->entities[i];
+		if (ent->entity_type != eEntityType::DECAL || !ent->visible)
+			continue;
+		DecalEntity* decal = (DecalEntity*)ent;
+		if (!decal->albedo)
+			continue;
+
+		BoundingBox world_bounding = transformBoundingBox(decal->model, mesh->box);
+		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize) == CLIP_OUTSIDE)
+		{
+			RENDER_STATS_ADD(culled_nodes, 1);
+			continue;
+		}
+
+		RENDER_STATS_ADD(visible_nodes, 1);
+		visible_decals[decal->albedo].push_back(decal->model);
+		TextureResidency::markUsed(decal->albedo, TextureResidency::getScreenSize(world_bounding, camera, Application::instance->window_height));
+	}
+
+	if (visible_decals.empty())
+		return;
+
 	Shader* shader = Shader::Get("decals");
 	shader->enable();
 
@@ -1121,35 +1526,92 @@ void GTR::Renderer::renderDecals(GTR::Scene* scene, Camera* camera)
 
 	shader->setUniform("u_inverse_viewprojection", inv_vp);
 	shader->setUniform("u_viewprojection", camera->viewprojection_matrix);
-
-	shader->setUniform("u_color_texture", gbuffers_fbo.color_textures[0], 0);
-	shader->setUniform("u_normal_texture", gbuffers_fbo.color_textures[1], 1);
-	shader->setUniform("u_extra_texture", gbuffers_fbo.color_textures[2], 1);
 	shader->setUniform("u_depth_texture", gbuffers_fbo.depth_texture, 3);
-
 	shader->setUniform("u_iRes", Vector2(1.0 / (float)gbuffers_fbo.color_textures[0]->width, 1.0 / (float)gbuffers_fbo.color_textures[0]->height));
 
+	decals_fbo.bind();
+
 	glDisable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
+	//back faces so decals still work with the camera inside the box
+	GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_FRONT);
+	//blend the albedo but keep the alpha stored in the gbuffer
+	glEnable(GL_BLEND);
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
 
-	for (int i = 0; i < scene->entities.size(); ++i) 
+	for (auto it = visible_decals.begin(); it != visible_decals.end(); ++it)
 	{
-		BaseEntity* ent = scene->entities[i];
-		if (ent->entity_type != eEntityType::DECAL)
-			continue;
-		DecalEntity* decal = (DecalEntity*)ent;
+		shader->setTexture("u_decal_texture", it->first, 8);
+		mesh->renderInstanced(GL_TRIANGLES, &it->second[0], it->second.size());
+	}
+
+	glCullFace(GL_BACK);
+	if (!cull_face)
+		glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
 
-		Matrix44 imodel = decal->model;
-		imodel.inverse();
+	decals_fbo.unbind();
+	shader->disable();
+}
 
-		shader->setUniform("u_model", decal->model);
-		shader->setUniform("u_iModel", imodel);
-		shader->setTexture("u_decal_texture", decal->albedo, 8);
+void GTR::Renderer::renderTransparentsOIT(GTR::Scene* scene, Camera* camera)
+{
+	GPU_SCOPE("transparency");
+	//render calls are already collected, transparents are the last ones
+	int first = renderCalls.size();
+	while (first > 0 && renderCalls[first - 1].material->alpha_mode == BLEND)
+		first--;
+	if (first == renderCalls.size())
+		return;
 
-		mesh->render(GL_TRIANGLES);
-		//mesh->renderBounding(decal->model);
+	oit_fbo.bind();
+
+	//accumulation starts at 0 with full revealage, weights at 0
+	oit_fbo.enableSingleBuffer(0);
+	glClearColor(0.0, 0.0, 0.0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	oit_fbo.enableSingleBuffer(1);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	oit_fbo.enableAllBuffers();
+
+	//test against the opaque depth but do not write, any order is valid
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(false);
+	glEnable(GL_BLEND);
+	//colors and weights add up, alpha keeps the product of (1 - alpha)
+	glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+
+	oit_pass = true;
+	for (int i = first; i < renderCalls.size(); ++i)
+	{
+		RenderCall& rc = renderCalls[i];
+		renderMeshWithMaterial(rc.model, rc.mesh, rc.material, camera, scene);
 	}
+	oit_pass = false;
 
+	glDepthMask(true);
+	oit_fbo.unbind();
+
+	//composite over the lit image
+	illumination_fbo.bind();
+
+	Mesh* quad = Mesh::getQuad();
+	Shader* s = Shader::Get("oit_composite");
+	s->enable();
+	s->setUniform("u_accum_texture", oit_fbo.color_textures[0], 0);
+	s->setUniform("u_weight_texture", oit_fbo.color_textures[1], 1);
+	s->setUniform("u_iRes", Vector2(1.0 / (float)oit_fbo.width, 1.0 / (float)oit_fbo.height));
+
+	glDisable(GL_DEPTH_TEST);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	quad->render(GL_TRIANGLES);
+	s->disable();
+
+	glDisable(GL_BLEND);
+	illumination_fbo.unbind();
 }
 
 void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
@@ -1171,6 +1633,8 @@ void Renderer::renderScene(GTR::Scene* scene, Camera* camera)
 		if (pipeline_mode == FORWARD)
 			renderMeshWithMaterial(render_call.model, render_call.mesh, render_call.material, camera);
 		else {
+			//transparents have their own pass after the lighting
+			if (oit && render_call.material->alpha_mode == BLEND) continue;
 			if (dithering) renderMeshDeferred(render_call.model, render_call.mesh, render_call.material, camera);
 			else {
 				if (render_call.material->alpha_mode == BLEND)
@@ -1220,31 +1684,51 @@ void GTR::Renderer::renderShadow(GTR::Scene* scene, Camera* camera)
 	}
 }
 
-void GTR::Renderer::generateShadowmaps(GTR::Scene* scene)
+void GTR::Renderer::generateShadowmaps(GTR::Scene* scene, Camera* camera)
 {
+	CPU_SCOPE("generateShadowmaps");
+	GPU_SCOPE("shadows");
+
+	//pick the lights first, rendering the shadows collects the lights again
+	std::vector<LightEntity*> casters;
 	for (int i = 0; i < scene->l_entities.size(); ++i) {
 		LightEntity* light = scene->l_entities[i];
+		light->shadow_buffer = NULL;
+		if (light->light_type == POINT || !light->cast_shadows || !light->visible || !light->light_camera)
+			continue;
+		if (light->light_type == SPOT && camera->testSphereInFrustum(light->model.getTranslation(), light->max_distance) == CLIP_OUTSIDE)
+			continue;
+		if (casters.size() < max_shadowmaps)
+			casters.push_back(light);
+	}
 
-		if (light->light_type != POINT) {
-			if (light->fbo.fbo_id == 0)
-			{
-				light->fbo = FBO();
-				light->fbo.setDepthOnly(2048, 2048);
-				light->shadow_buffer = new Texture();
-			}
+	//shadowmaps come from a pool so their memory does not grow with the lights of the scene
+	while (shadow_fbos.size() < casters.size())
+	{
+		FBO* fbo = new FBO();
+		fbo->setDepthOnly(2048, 2048);
+		fbo->name = "shadowmap " + std::to_string(shadow_fbos.size());
+		shadow_fbos.push_back(fbo);
+	}
 
-			light->fbo.bind();
-			glColorMask(false, false, false, false);
-			glClear(GL_DEPTH_BUFFER_BIT);
+	for (int i = 0; i < casters.size(); ++i) {
+		LightEntity* light = casters[i];
+		FBO* fbo = shadow_fbos[i];
 
-			renderShadow(scene, light->light_camera);
+		//every light is its own pass in the render stats
+		RenderStats::beginPass(("shadow " + light->name).c_str());
+		fbo->bind();
+		glColorMask(false, false, false, false);
+		glClear(GL_DEPTH_BUFFER_BIT);
 
-			light->fbo.unbind();
+		renderShadow(scene, light->light_camera);
 
-			glColorMask(true, true, true, true);
+		fbo->unbind();
 
-			light->shadow_buffer = light->fbo.depth_texture;
-		}
+		glColorMask(true, true, true, true);
+		RenderStats::endPass();
+
+		light->shadow_buffer = fbo->depth_texture;
 	}
 }
 
@@ -1276,14 +1760,20 @@ void Renderer::renderNode(const Matrix44& prefab_model, GTR::Node* node, Camera*
 		//if bounding box is inside the camera frustum then the object is probably visible
 		if (camera->testBoxInFrustum(world_bounding.center, world_bounding.halfsize))
 		{
+			RENDER_STATS_ADD(visible_nodes, 1);
 			//render node mesh
 			//renderMeshWithMaterial( node_model, node->mesh, node->material, camera );
 			float distance_to_camera = world_bounding.center.distance(camera->eye);
 			RenderCall render_Call = createRenderCall(node_model, node->mesh, node->material, distance_to_camera);
 			addRenderCall(render_Call);
 
+			//its textures only need the mips of the size it covers on screen
+			TextureResidency::markUsed(node->material, TextureResidency::getScreenSize(world_bounding, camera, Application::instance->window_height));
+
 			//node->mesh->renderBounding(node_model, true);
 		}
+		else
+			RENDER_STATS_ADD(culled_nodes, 1);
 	}
 
 	//iterate recursively with children
@@ -1325,12 +1815,14 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	//if (normal_texture == NULL) normal_texture = Texture::getWhiteTexture(); //a 1x1 white texture
 	if (normal_texture == NULL) have_normalmap = false;
 
-	//select the blending
-	if (material->alpha_mode == GTR::eAlphaMode::BLEND) {
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	//select the blending (the oit pass sets its own)
+	if (!oit_pass) {
+		if (material->alpha_mode == GTR::eAlphaMode::BLEND) {
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else glDisable(GL_BLEND);
 	}
-	else glDisable(GL_BLEND);
 
 	//select if render both sides of the triangles
 	if (material->two_sided) glDisable(GL_CULL_FACE);
@@ -1348,6 +1840,9 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 		case DEFAULT: shader = Shader::Get("light_singlepass"); break;
 		case SHOW_MULTI: shader = Shader::Get("light_multipass"); break;
 	}
+	//transparents are always lit in a single pass when accumulated
+	bool singlepass = render_mode == DEFAULT || oit_pass;
+	if (oit_pass) shader = Shader::Get("light_singlepass");
 
 	assert(glGetError() == GL_NO_ERROR);
 
@@ -1370,6 +1865,7 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	if (occ_texture) shader->setUniform("u_occ_texture", occ_texture, 3);
 	if (normal_texture) shader->setUniform("u_normal_texture", normal_texture, 4);
 	shader->setUniform("u_read_normal", have_normalmap);
+	shader->setUniform("u_oit", oit_pass);
 
 	//this is used to say which is the alpha threshold to what we should not paint a pixel on the screen (to cut polygons according to texture alpha)
 	shader->setUniform("u_alpha_cutoff", material->alpha_mode == GTR::eAlphaMode::MASK ? material->alpha_cutoff : 0);
@@ -1383,18 +1879,18 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	
 
 	// SINGLE PASS
-	if (render_mode == DEFAULT)
+	if (singlepass)
 	{
 		// lights
-		int num_lights = 5;
+		int num_lights = std::min(5, (int)scene->l_entities.size());
 		Vector3 light_position[5];
 		Vector3 light_color[5];
 		Vector3 light_vector[5];
 		int light_type[5] = {};
-		float max_distances[5];
-		float light_intensities[5];
-		float light_cos_cutoff[5];
-		float light_exponents[5];
+		float max_distances[5] = {};
+		float light_intensities[5] = {};
+		float light_cos_cutoff[5] = {};
+		float light_exponents[5] = {};
 
 		for (int j = 0; j < num_lights; ++j)
 		{
@@ -1474,7 +1970,7 @@ void Renderer::renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Mat
 	shader->disable();
 
 	//set the render state as it was before to avoid problems with future renders
-	glDisable(GL_BLEND);
+	if (!oit_pass) glDisable(GL_BLEND);
 	glDepthFunc(GL_LESS);
 }
 
@@ -1482,6 +1978,7 @@ void GTR::Renderer::resize(int width, int height)
 {
 	illumination_fbo.create(width, height, 3, GL_RGB, GL_FLOAT, false);
 	dof_fbo.create(width, height, 3, GL_RGB, GL_FLOAT, false);
+	invalidateCache();
 }
 
 void GTR::Renderer::getShadows(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera)
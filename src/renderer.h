@@ -77,6 +77,23 @@ namespace GTR {
 		}
 	};
 
+	//with weighted blended oit the transparents do not need a depth order, group them by state
+	struct sort_alpha_material
+	{
+		inline bool operator() (const RenderCall& a, const RenderCall& b)
+		{
+			bool a_blend = a.material->alpha_mode == BLEND;
+			bool b_blend = b.material->alpha_mode == BLEND;
+			if (a_blend != b_blend)
+				return b_blend;
+			if (!a_blend)
+				return (a.distance_to_camera < b.distance_to_camera);
+			if (a.material != b.material)
+				return (a.material < b.material);
+			return (a.mesh < b.mesh);
+		}
+	};
+
 	//struct to store probes
 	struct sProbe {
 		Vector3 pos; //where is located
@@ -119,6 +136,8 @@ namespace GTR {
 		bool show_glow;
 		bool show_chroma;
 		bool show_lens;
+		bool oit; //weighted blended transparency in deferred
+		bool oit_pass; //true while drawing into the oit targets
 		float irr_normal_distance;
 
 		FBO irr_fbo;
@@ -135,6 +154,7 @@ namespace GTR {
 		Texture* upsample_tex2;
 		FBO* upsample_fbo;
 		FBO postpo_fbo;
+		FBO oit_fbo;
 
 		float focus_plane;
 		float aperture;
@@ -144,6 +164,33 @@ namespace GTR {
 
 		float lens_power;
 
+		// DYNAMIC RESOLUTION
+		bool dynamic_resolution;
+		float render_scale; //scale picked by the controller
+		float frame_scale; //scale actually used this frame
+		float min_render_scale;
+		float max_render_scale;
+		float target_frame_ms;
+		float gpu_frame_ms; //last gpu time read back
+		float upscale_sharpness;
+		unsigned int frame_queries[4];
+		bool frame_query_scaled[4]; //the frame of every query used render_scale, only those can change it
+		int query_frame;
+
+		// RENDER CACHE
+		bool render_cache; //present the last frame when nothing changed
+		bool cache_valid;
+		unsigned long long cached_scene_hash;
+		unsigned long long cached_post_hash;
+		Texture* lit_texture; //lit image before post fx
+		int cached_frames; //frames presented from the cache
+		bool frame_cached; //the current frame was presented from the cache
+
+		// LARGE SCENES
+		int max_shadowmaps; //lights with a shadowmap in the same frame, the rest are lit without shadows
+		int max_reflection_probes; //reflection probes of the scene that get a cubemap
+		std::vector<FBO*> shadow_fbos; //shared by the lights that cast shadows in the frame
+
 		std::vector<Vector3> random_points;
 
 		std::vector<RenderCall> renderCalls;
@@ -183,9 +230,13 @@ namespace GTR {
 		void showIrradiance(GTR::Scene* scene, Camera* camera);
 		void showDoF(GTR::Scene* scene, Camera* camera);
 		void showReflection(Camera* camera);
+		void showUpscaled(Texture* texture, float scale);
+		void renderPostFX(GTR::Scene* scene, Camera* camera);
+		void presentFrame(Texture* texture);
 		void renderMeshDeferred(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
 
 		void renderDecals(GTR::Scene* scene, Camera* camera);
+		void renderTransparentsOIT(GTR::Scene* scene, Camera* camera);
 
 		//renders several elements of the scene
 		void illuminationDeferred(GTR::Scene* scene, Camera* camera);
@@ -197,7 +248,7 @@ namespace GTR {
 		void renderScene(GTR::Scene* scene, Camera* camera);
 		void renderSceneForward(GTR::Scene* scene, Camera* camera);
 		void renderShadow(GTR::Scene* scene, Camera* camera);
-		void generateShadowmaps(GTR::Scene* scene);
+		void generateShadowmaps(GTR::Scene* scene, Camera* camera);
 		void getShadows(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera);
 	
 		//to render a whole prefab (with all its nodes)
@@ -210,8 +261,18 @@ namespace GTR {
 		void renderMeshWithMaterial(const Matrix44 model, Mesh* mesh, GTR::Material* material, Camera* camera, Scene* scene = nullptr);
 
 		void resize(int width, int height);
+
+		// DYNAMIC RESOLUTION
+		void beginFrameTimer();
+		void endFrameTimer();
+		void updateRenderScale(float gpu_ms);
+
+		// RENDER CACHE
+		unsigned long long computeSceneHash(GTR::Scene* scene, Camera* camera);
+		unsigned long long computePostHash();
+		void invalidateCache();
 		};
 
 	Texture* CubemapFromHDRE(const char* filename);
 
-};
\ No newline at end of file
+};
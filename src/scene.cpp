@@ -6,8 +6,11 @@
 #include "extra/cJSON.h"
 #include "application.h"
 #include "shader.h"
+#include "profiler.h"
+#include "asset_loader.h"
 
 GTR::Scene* GTR::Scene::instance = NULL;
+bool GTR::Scene::parallel_load = true;
 
 GTR::Scene::Scene()
 {
@@ -32,6 +35,7 @@ void GTR::Scene::addEntity(BaseEntity* entity)
 
 bool GTR::Scene::load(const char* filename)
 {
+	CPU_SCOPE("Scene::load");
 	std::string content;
 
 	this->filename = filename;
@@ -61,6 +65,9 @@ bool GTR::Scene::load(const char* filename)
 	//entities
 	cJSON* entities_json = cJSON_GetObjectItemCaseSensitive(json, "entities");
 	cJSON* entity_json;
+	int num_entities = cJSON_GetArraySize(entities_json);
+	bool log_entities = num_entities <= 100; //big scenes would spend most of the loading printing
+	entities.reserve(entities.size() + num_entities);
 	cJSON_ArrayForEach(entity_json, entities_json)
 	{
 		std::string type_str = cJSON_GetObjectItem(entity_json, "type")->valuestring;
@@ -77,7 +84,8 @@ bool GTR::Scene::load(const char* filename)
 		if (cJSON_GetObjectItem(entity_json, "name"))
 		{
 			ent->name = cJSON_GetObjectItem(entity_json, "name")->valuestring;
-			stdlog(std::string(" + entity: ") + ent->name);
+			if (log_entities)
+				stdlog(std::string(" + entity: ") + ent->name);
 		}
 
 		//read transform
@@ -119,8 +127,14 @@ bool GTR::Scene::load(const char* filename)
 		ent->configure(entity_json);
 	}
 
+	//every prefab and texture of the scene is decoded at once in the worker threads
+	if (parallel_load)
+		AssetLoader::finishAll();
+
 	//free memory
 	cJSON_Delete(json);
+	if (!log_entities)
+		std::cout << " + " << num_entities << " entities, " << l_entities.size() << " lights" << std::endl;
 	
 	float x, y, z;
 
@@ -159,6 +173,8 @@ GTR::BaseEntity* GTR::Scene::createEntity(std::string type)
 		return new GTR::LightEntity();
 	else if (type == "DECAL")
 		return new GTR::DecalEntity();
+	else if (type == "REFLECTION_PROBE")
+		return new GTR::ReflectionProbeEntity();
 	return NULL;
 }
 
@@ -188,7 +204,8 @@ void GTR::PrefabEntity::configure(cJSON* json)
 	if (cJSON_GetObjectItem(json, "filename"))
 	{
 		filename = cJSON_GetObjectItem(json, "filename")->valuestring;
-		prefab = GTR::Prefab::Get((std::string("data/") + filename).c_str());
+		std::string path = std::string("data/") + filename;
+		prefab = Scene::parallel_load ? AssetLoader::getPrefabAsync(path.c_str()) : GTR::Prefab::Get(path.c_str());
 	}
 }
 
@@ -215,8 +232,17 @@ GTR::LightEntity::LightEntity()
 {
 	entity_type = LIGHT;
 	//light_camera = new Camera();
-	//fbo = FBO();
+	color.set(1, 1, 1);
+	intensity = 1;
+	light_type = NOLIGHT;
+	max_distance = 100;
+	cone_angle = 45;
+	area_size = 1000;
+	exponent = 1;
 	bias = 0.001;
+	cast_shadows = true;
+	light_camera = NULL;
+	shadow_buffer = NULL;
 }
 
 void GTR::LightEntity::renderInMenu()
@@ -251,7 +277,6 @@ void GTR::LightEntity::renderInMenu()
 
 void GTR::LightEntity::configure(cJSON* json)
 {
-	this->fbo = FBO();
 	this->light_camera = new Camera();
 	if (cJSON_GetObjectItem(json, "color"))
 	{
@@ -271,6 +296,9 @@ void GTR::LightEntity::configure(cJSON* json)
 		this->bias = shadow_bias;
 	}
 
+	if (cJSON_GetObjectItem(json, "cast_shadows"))
+		this->cast_shadows = cJSON_IsTrue(cJSON_GetObjectItem(json, "cast_shadows"));
+
 	if (cJSON_GetObjectItem(json, "cone_exp"))
 	{
 		float cone_exp = cJSON_GetObjectItem(json, "cone_exp")->valuedouble;
@@ -321,7 +349,8 @@ void GTR::LightEntity::setUniforms(Shader* shader)
 {
 	if (this->light_type != POINT)
 	{
-		Texture* shadowmap = this->shadow_buffer;
+		//lights without shadowmap read a white one, so nothing is in shadow
+		Texture* shadowmap = this->shadow_buffer ? this->shadow_buffer : Texture::getWhiteTexture();
 		shader->setTexture("shadowmap", shadowmap, 5);
 		Matrix44 shadow_proj = this->light_camera->viewprojection_matrix;
 		shader->setUniform("u_shadow_viewproj", shadow_proj);
@@ -367,5 +396,13 @@ void GTR::DecalEntity::configure(cJSON* json)
 {
 	std::string filename = readJSONString(json, "albedo", "");
 	if (filename.size())
-		albedo = Texture::Get( (std::string("data/") +  filename).c_str() );
+	{
+		std::string path = std::string("data/") + filename;
+		albedo = Scene::parallel_load ? AssetLoader::getTextureAsync(path.c_str(), true, true, TEXTURE_COMPRESS_COLOR) : Texture::Get(path.c_str(), true, true, TEXTURE_COMPRESS_COLOR);
+	}
+}
+
+GTR::ReflectionProbeEntity::ReflectionProbeEntity()
+{
+	entity_type = REFLECTION_PROBE;
 }
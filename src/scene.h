@@ -71,11 +71,11 @@ namespace GTR {
 		float area_size;
 		float exponent;
 		float bias;
+		bool cast_shadows;
 		Vector3 target;
 
 		Camera* light_camera;
-		FBO fbo;
-		Texture* shadow_buffer;
+		Texture* shadow_buffer; //NULL when it has no shadowmap this frame
 
 		LightEntity();
 		virtual void renderInMenu();
@@ -93,12 +93,20 @@ namespace GTR {
 		virtual void configure(cJSON* json);
 	};
 
+	//position where the renderer captures a reflection cubemap
+	class ReflectionProbeEntity : public GTR::BaseEntity
+	{
+	public:
+		ReflectionProbeEntity();
+	};
+
 
 	//contains all entities of the scene
 	class Scene
 	{
 	public:
 		static Scene* instance;
+		static bool parallel_load; //entities request prefabs and textures to the AssetLoader, load waits for all of them at the end
 
 		Vector3 background_color;
 		Vector3 ambient_light;
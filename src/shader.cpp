@@ -8,6 +8,7 @@
 #include <locale>
 
 #include "texture.h"
+#include "stats.h"
 
 std::string Shader::s_shader_atlas_filename;
 std::map<std::string, std::string> Shader::s_shaders_atlas;
@@ -446,6 +447,7 @@ void Shader::enable()
 	current = this;
 
 	glUseProgram(program);
+	RENDER_STATS_ADD(shader_binds, 1);
     GLuint err = glGetError();
 	assert (err == GL_NO_ERROR);
 
@@ -536,6 +538,7 @@ GLint Shader::getLocation(const char* varname,loctable* table)
 	{
 		loc = (*cur).second;
 	}
+	RENDER_STATS_ADD(uniforms, 1); //every upload looks for its location first
 	return loc;
 }
 
@@ -566,6 +569,7 @@ void Shader::setTexture(const char* varname, Texture* tex, int slot)
 {
 	glActiveTexture(GL_TEXTURE0 + slot);
 	glBindTexture(tex->texture_type, tex->texture_id);
+	RENDER_STATS_ADD(texture_binds, 1);
 	setUniform1(varname, slot);
 	glActiveTexture(GL_TEXTURE0 + slot);
 }
@@ -798,6 +802,8 @@ Shader* Shader::getDefaultShader(std::string name)
 	vs = "attribute vec3 a_vertex; attribute vec3 a_normal; attribute vec2 a_uv; attribute vec4 a_color; \
 	uniform mat4 u_model;\n\
 	uniform mat4 u_viewprojection;\n\
+	uniform vec3 u_vertex_scale;\n\
+	uniform vec3 u_vertex_offset;\n\
 	varying vec3 v_position;\n\
 	varying vec3 v_world_position;\n\
 	varying vec4 v_color;\n\
@@ -806,9 +812,9 @@ Shader* Shader::getDefaultShader(std::string name)
 	void main()\n\
 	{\n\
 		v_normal = (u_model * vec4(a_normal, 0.0)).xyz;\n\
-		v_position = a_vertex;\n\
+		v_position = a_vertex * u_vertex_scale + u_vertex_offset;\n\
 		v_color = a_color;\n\
-		v_world_position = (u_model * vec4(a_vertex, 1.0)).xyz;\n\
+		v_world_position = (u_model * vec4(v_position, 1.0)).xyz;\n\
 		v_uv = a_uv;\n\
 		gl_Position = u_viewprojection * vec4(v_world_position, 1.0);\n\
 	}";
@@ -0,0 +1,183 @@
+#include "stats.h"
+#include "utils.h"
+#include "extra/cJSON.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+bool RenderStats::show_overlay = false;
+sRenderCounters RenderStats::outside;
+sRenderCounters* RenderStats::current = &RenderStats::outside;
+std::vector<sPassCounters> RenderStats::last_passes;
+sRenderCounters RenderStats::last_total;
+bool RenderStats::recording = false;
+std::vector<sPassCounters> RenderStats::passes;
+std::vector<int> RenderStats::stack;
+
+void sRenderCounters::clear()
+{
+	draw_calls = triangles = instances = 0;
+	shader_binds = texture_binds = uniforms = fbo_binds = copies = 0;
+	visible_nodes = culled_nodes = visible_lights = 0;
+}
+
+void sRenderCounters::add(const sRenderCounters& c)
+{
+	draw_calls += c.draw_calls;
+	triangles += c.triangles;
+	instances += c.instances;
+	shader_binds += c.shader_binds;
+	texture_binds += c.texture_binds;
+	uniforms += c.uniforms;
+	fbo_binds += c.fbo_binds;
+	copies += c.copies;
+	visible_nodes += c.visible_nodes;
+	culled_nodes += c.culled_nodes;
+	visible_lights += c.visible_lights;
+}
+
+cJSON* sRenderCounters::toJSON() const
+{
+	cJSON* json = cJSON_CreateObject();
+	cJSON_AddNumberToObject(json, "draw_calls", draw_calls);
+	cJSON_AddNumberToObject(json, "triangles", triangles);
+	cJSON_AddNumberToObject(json, "instances", instances);
+	cJSON_AddNumberToObject(json, "shader_binds", shader_binds);
+	cJSON_AddNumberToObject(json, "texture_binds", texture_binds);
+	cJSON_AddNumberToObject(json, "uniforms", uniforms);
+	cJSON_AddNumberToObject(json, "fbo_binds", fbo_binds);
+	cJSON_AddNumberToObject(json, "copies", copies);
+	cJSON_AddNumberToObject(json, "visible_nodes", visible_nodes);
+	cJSON_AddNumberToObject(json, "culled_nodes", culled_nodes);
+	cJSON_AddNumberToObject(json, "visible_lights", visible_lights);
+	return json;
+}
+
+void RenderStats::beginFrame()
+{
+	passes.clear();
+	stack.clear();
+	recording = true;
+	beginPass("frame");
+}
+
+void RenderStats::endFrame()
+{
+	if (!recording)
+		return;
+	while (stack.size())
+		endPass();
+	recording = false;
+
+	last_passes.swap(passes);
+	last_total.clear();
+	for (int i = 0; i < last_passes.size(); ++i)
+		last_total.add(last_passes[i]);
+}
+
+void RenderStats::beginPass(const char* name)
+{
+	if (!recording)
+		return;
+
+	//a pass opened again in the same frame keeps adding to the same counters
+	int pass = -1;
+	for (int i = 0; i < passes.size(); ++i)
+		if (passes[i].name == name)
+		{
+			pass = i;
+			break;
+		}
+
+	if (pass == -1)
+	{
+		sPassCounters counters;
+		counters.name = name;
+		counters.depth = stack.size();
+		pass = passes.size();
+		passes.push_back(counters);
+	}
+
+	stack.push_back(pass);
+	current = &passes[pass]; //the vector may have moved, never keep the old pointer
+}
+
+void RenderStats::endPass()
+{
+	if (!recording || stack.empty())
+		return;
+	stack.pop_back();
+	current = stack.size() ? &passes[stack.back()] : &outside;
+}
+
+std::string RenderStats::getText()
+{
+	std::string str = "Stats                  DCs   Tris(K) Inst  Shd  Tex  Unif  FBO Copy  Vis Cull Lights\n";
+	char line[256];
+	for (int i = 0; i <= last_passes.size(); ++i)
+	{
+		bool total = i == last_passes.size();
+		const sRenderCounters& c = total ? last_total : last_passes[i];
+		const char* name = total ? "total" : last_passes[i].name.c_str();
+		int indent = total ? 0 : last_passes[i].depth * 2;
+		snprintf(line, sizeof(line), "%*s%-*s %5ld %8.1f %5ld %4ld %4ld %5ld %4ld %4ld %4ld %4ld %6ld\n", indent, "", 20 - indent, name,
+			c.draw_calls, c.triangles * 0.001, c.instances, c.shader_binds, c.texture_binds, c.uniforms, c.fbo_binds, c.copies,
+			c.visible_nodes, c.culled_nodes, c.visible_lights);
+		str += line;
+	}
+	return str;
+}
+
+void RenderStats::renderOverlay(float x, float y)
+{
+	//one line at a time, the whole table does not fit in the buffer of drawText
+	std::string text = getText();
+	size_t start = 0;
+	while (start < text.size())
+	{
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos)
+			end = text.size();
+		drawText(x, y, text.substr(start, end - start), Vector3(1, 1, 0.5), 1.5);
+		y += 18; //stb_easy_font lines are 12 pixels
+		start = end + 1;
+	}
+}
+
+cJSON* RenderStats::toJSON()
+{
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddItemToObject(root, "total", last_total.toJSON());
+	cJSON* list = cJSON_AddArrayToObject(root, "passes");
+	for (int i = 0; i < last_passes.size(); ++i)
+	{
+		cJSON* pass = last_passes[i].toJSON();
+		cJSON_AddStringToObject(pass, "name", last_passes[i].name.c_str());
+		cJSON_AddNumberToObject(pass, "depth", last_passes[i].depth);
+		cJSON_AddItemToArray(list, pass);
+	}
+	return root;
+}
+
+bool RenderStats::exportJSON(const char* filename)
+{
+	cJSON* root = toJSON();
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write render stats: " << filename << std::endl;
+		free(text);
+		return false;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	free(text);
+
+	std::cout << " + Render stats saved: " << filename << std::endl;
+	return true;
+}
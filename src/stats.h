@@ -0,0 +1,69 @@
+/*  Render stats, counts the work submitted in every pass of a frame: draw calls, triangles, binds, uploads...
+	The passes are the same scopes used by the GPU profiler (GPU_SCOPE), every counter goes to the innermost
+	open pass so the numbers of a pass never include its children. Work done outside of any pass goes to "frame".
+	The counters are plain increments, they are always enabled.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <vector>
+
+struct cJSON;
+
+struct sRenderCounters {
+	long draw_calls;
+	long triangles;
+	long instances; //instanced calls count all their instances, normal calls count one
+	long shader_binds;
+	long texture_binds;
+	long uniforms; //uniform uploads, textures included
+	long fbo_binds;
+	long copies; //full screen copies with Texture::copyTo
+	long visible_nodes; //nodes and decals that passed the frustum test
+	long culled_nodes;
+	long visible_lights; //lights whose range reaches the view of the pass
+
+	sRenderCounters() { clear(); }
+	void clear();
+	void add(const sRenderCounters& c);
+	cJSON* toJSON() const;
+};
+
+struct sPassCounters : public sRenderCounters {
+	std::string name;
+	int depth; //nesting level, used to indent
+};
+
+class RenderStats
+{
+public:
+	static bool show_overlay;
+
+	static sRenderCounters* current; //counters of the innermost open pass, never NULL
+
+	//results of the last finished frame
+	static std::vector<sPassCounters> last_passes;
+	static sRenderCounters last_total;
+
+	static void beginFrame();
+	static void endFrame();
+	static void beginPass(const char* name);
+	static void endPass();
+
+	static std::string getText();
+	static void renderOverlay(float x, float y);
+	static cJSON* toJSON(); //last frame, total and passes
+	static bool exportJSON(const char* filename);
+
+private:
+	static bool recording;
+	static std::vector<sPassCounters> passes; //frame being recorded, in the order they are opened
+	static std::vector<int> stack; //open passes
+	static sRenderCounters outside; //anything rendered between frames (gui, overlays)
+};
+
+#define RENDER_STATS_ADD(counter, amount) RenderStats::current->counter += (amount)
+
+#endif
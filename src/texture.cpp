@@ -8,6 +8,9 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "profiler.h"
+#include "texture_compressor.h"
+#include "texture_cache.h"
 #include "extra/picopng.h"
 #include "extra/jpgd.h"
 #include <cassert>
@@ -58,9 +61,12 @@ Vector4 Image::getPixelInterpolatedHigh(float x, float y, bool repeat) {
 
 
 std::map<std::string, Texture*> Texture::sTexturesLoaded;
+std::set<Texture*> Texture::sAllTextures;
 int Texture::default_mag_filter = GL_LINEAR;
 int Texture::default_min_filter = GL_LINEAR_MIPMAP_LINEAR;
 FBO* Texture::global_fbo = NULL;
+bool Texture::use_compression = true;
+bool Texture::use_cache = true;
 
 Texture::Texture()
 {
@@ -72,22 +78,26 @@ Texture::Texture()
 	format = 0;
 	type = 0;
 	texture_type = GL_TEXTURE_2D;
+	sAllTextures.insert(this);
 }
 
 Texture::Texture(unsigned int width, unsigned int height, unsigned int format, unsigned int type, bool mipmaps, Uint8* data, unsigned int internal_format)
 {
 	texture_id = 0;
+	sAllTextures.insert(this);
 	create(width, height, format, type, mipmaps, data, internal_format);
 }
 
 Texture::Texture(Image* img)
 {
 	texture_id = 0;
+	sAllTextures.insert(this);
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
 }
 
 Texture::~Texture()
 {
+	sAllTextures.erase(this);
 	clear();
 }
 
@@ -222,7 +232,7 @@ Texture* Texture::Find(const char* filename)
 	return NULL;
 }
 
-Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
+Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap, eTextureCompression compression)
 {
 	//load it
 	Texture* texture = Find(filename);
@@ -230,7 +240,7 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 		return texture;
 
 	texture = new Texture();
-	if (!texture->load(filename, mipmaps, wrap))
+	if (!texture->load(filename, mipmaps, wrap, GL_UNSIGNED_BYTE, compression))
 	{
 		delete texture;
 		return NULL;
@@ -239,37 +249,45 @@ Texture* Texture::Get(const char* filename, bool mipmaps, bool wrap)
 	return texture;
 }
 
-bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type)
+bool Texture::load(const char* filename, bool mipmaps, bool wrap, unsigned int type, eTextureCompression compression)
 {
-	std::string str = filename;
-	std::string ext = str.substr(str.size() - 4, 4);
-	Image* image = NULL;
+	CPU_SCOPE("Texture::load");
 	double time = getTime();
 
 	std::cout << " + Texture loading: " << filename << " ... ";
 
-	image = new Image();
-	bool found = false;
+	//the .tbin is baked the first time, if it fails the image is uploaded as it is
+	sCompressedImage compressed;
+	if (compression != TEXTURE_UNCOMPRESSED && type == GL_UNSIGNED_BYTE && canCompress() && loadCompressedImage(filename, compression, mipmaps, compressed))
+	{
+		loadFromCompressedImage(&compressed, wrap);
+		residency.streamable = residency.num_levels > 1;
+		residency.compression = compression;
+		setName(filename);
+		std::cout << "[" << getCompressionName(compressed.format) << "] Size: " << width << "x" << height << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
+	}
 
-	if (ext == ".tga" || ext == ".TGA")
-		found = image->loadTGA(filename);
-	else if (ext == ".png" || ext == ".PNG")
-		found = image->loadPNG(filename);
-	else if (ext == ".jpg" || ext == ".JPG" || ext == "JPEG" || ext == "jpeg")
-		found = image->loadJPG(filename);
-	else
+	//the decoded pixels and mips of the .rbin, mapped and uploaded as they are
+	sRawImage raw;
+	if (use_cache && type == GL_UNSIGNED_BYTE && loadRawImage(filename, mipmaps, compression != TEXTURE_COMPRESS_NORMALMAP, raw))
 	{
-		std::cout << "[ERROR]: unsupported format" << std::endl;
-		return false; //unsupported file type
+		loadFromRawImage(&raw, wrap);
+		residency.streamable = residency.num_levels > 1;
+		residency.compression = compression;
+		setName(filename);
+		std::cout << "[OK] Size: " << width << "x" << height << " Mips: " << raw.levels.size() << " Time: " << (getTime() - time) * 0.001 << "sec" << std::endl;
+		return true;
 	}
 
-	if (!found) //file not found
+	Image img;
+	if (!img.load(filename))
 	{
-		std::cout << " [ERROR]: Texture not found " << std::endl;
+		std::cout << " [ERROR]: Texture not found or unsupported format" << std::endl;
 		return false;
 	}
 
-	loadFromImage(image,mipmaps,wrap,type);
+	loadFromImage(&img,mipmaps,wrap,type);
 	this->filename = filename;
 	setName(filename);
 
@@ -299,6 +317,161 @@ void Texture::loadFromImage(Image* image, bool mipmaps, bool wrap, unsigned int
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void Texture::loadFromCompressedImage(sCompressedImage* image, bool wrap, int first_level)
+{
+	assert(image->levels.size() && image->getData());
+	int num_levels = (int)image->levels.size();
+	first_level = std::min(std::max(first_level, 0), num_levels - 1);
+	residency.num_levels = num_levels;
+	residency.level = first_level;
+	residency.full_width = image->width;
+	residency.full_height = image->height;
+	this->width = (float)std::max(image->width >> first_level, 1);
+	this->height = (float)std::max(image->height >> first_level, 1);
+	this->depth = 0;
+	this->internal_format = image->format;
+	this->type = GL_UNSIGNED_BYTE;
+	this->mipmaps = num_levels - first_level > 1;
+	switch (image->format)
+	{
+	case GL_COMPRESSED_RED_RGTC1: this->format = GL_RED; break;
+	case GL_COMPRESSED_RG_RGTC2: this->format = GL_RG; break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: this->format = GL_RGBA; break;
+	default: this->format = GL_RGB;
+	}
+
+	//only the GL texture is replaced, clear would remove it from the manager
+	if (texture_id != 0)
+		glDeleteTextures(1, &texture_id);
+	this->texture_type = GL_TEXTURE_2D;
+	glGenTextures(1, &texture_id);
+	glBindTexture(this->texture_type, texture_id);
+
+	//the mips come baked, generateMipmaps cannot work on compressed textures
+	for (int level = first_level; level < num_levels; ++level)
+	{
+		int w = std::max(image->width >> level, 1);
+		int h = std::max(image->height >> level, 1);
+		size_t size = getCompressedLevelSize(image->format, w, h);
+		glCompressedTexImage2D(this->texture_type, level - first_level, image->format, w, h, 0, (GLsizei)size, image->getData() + image->levels[level]);
+	}
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1 - first_level);
+
+	//the wrap is kept when the top levels are dropped, so it is the same when they come back
+	this->wrapS = this->wrapT = (num_levels > 1 && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->wrapS);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->wrapT);
+
+	//grayscale images are stored in red only, they are read as gray
+	if (image->format == GL_COMPRESSED_RED_RGTC1)
+	{
+		glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_G, GL_RED);
+		glTexParameteri(this->texture_type, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error uploading compressed texture");
+}
+
+void Texture::loadFromRawImage(sRawImage* image, bool wrap, int first_level)
+{
+	assert(image->levels.size() && image->data);
+	int num_levels = (int)image->levels.size();
+	first_level = std::min(std::max(first_level, 0), num_levels - 1);
+	residency.num_levels = num_levels;
+	residency.level = first_level;
+	residency.full_width = image->width;
+	residency.full_height = image->height;
+	this->width = (float)std::max(image->width >> first_level, 1);
+	this->height = (float)std::max(image->height >> first_level, 1);
+	this->depth = 0;
+	this->format = image->num_channels == 3 ? GL_RGB : GL_RGBA;
+	this->internal_format = 0;
+	this->type = GL_UNSIGNED_BYTE;
+	this->mipmaps = num_levels - first_level > 1;
+
+	//only the GL texture is replaced, clear would remove it from the manager
+	if (texture_id != 0)
+		glDeleteTextures(1, &texture_id);
+	this->texture_type = GL_TEXTURE_2D;
+	glGenTextures(1, &texture_id);
+	glBindTexture(this->texture_type, texture_id);
+
+	//the rows are packed, the small mips of RGB images are not 4 bytes aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int level = first_level; level < num_levels; ++level)
+	{
+		int w = std::max(image->width >> level, 1);
+		int h = std::max(image->height >> level, 1);
+		glTexImage2D(this->texture_type, level - first_level, this->format, w, h, 0, this->format, GL_UNSIGNED_BYTE, image->data + image->levels[level]);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAX_LEVEL, num_levels - 1 - first_level);
+
+	//the wrap is kept when the top levels are dropped, so it is the same when they come back
+	this->wrapS = this->wrapT = (num_levels > 1 && wrap) ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+	glTexParameteri(this->texture_type, GL_TEXTURE_MAG_FILTER, Texture::default_mag_filter);
+	glTexParameteri(this->texture_type, GL_TEXTURE_MIN_FILTER, this->mipmaps ? Texture::default_min_filter : GL_LINEAR);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_S, this->wrapS);
+	glTexParameteri(this->texture_type, GL_TEXTURE_WRAP_T, this->wrapT);
+
+	glBindTexture(this->texture_type, 0);
+	assert(checkGLErrors() && "Error uploading texture");
+}
+
+bool Texture::setResidentLevel(int level)
+{
+	if (!residency.streamable || !texture_id || filename.empty())
+		return false;
+	level = std::min(std::max(level, 0), residency.num_levels - 1);
+	if (level == residency.level)
+		return true;
+
+	//the cache is mapped again and the levels are uploaded from the mapping (or the OS file cache)
+	//it is never baked here, if it is gone or outdated the texture stays as it is
+	bool wrap = wrapS == GL_REPEAT;
+	if (getCompressedLevelSize(internal_format, 4, 4))
+	{
+		sCompressedImage compressed;
+		if (!mapCompressedImage((filename + ".tbin").c_str(), filename.c_str(), residency.compression, true, compressed) || (int)compressed.levels.size() != residency.num_levels)
+			return false;
+		loadFromCompressedImage(&compressed, wrap, level);
+	}
+	else
+	{
+		sRawImage raw;
+		if (!readRawImage((filename + ".rbin").c_str(), filename.c_str(), true, residency.compression != TEXTURE_COMPRESS_NORMALMAP, raw) || (int)raw.levels.size() != residency.num_levels)
+			return false;
+		loadFromRawImage(&raw, wrap, level);
+	}
+
+	//the handle is the same, frames cached with the old levels are outdated
+	markResourcesChanged();
+	return true;
+}
+
+bool Texture::canCompress()
+{
+	//the extension is checked once, it needs the GL context
+	static int supported = -1;
+	if (supported == -1)
+	{
+		supported = 0;
+		GLint num_extensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+		for (GLint i = 0; i < num_extensions && !supported; ++i)
+		{
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			supported = name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0;
+		}
+		if (!supported)
+			std::cout << "[WARN] GL_EXT_texture_compression_s3tc not supported, textures will not be compressed" << std::endl;
+	}
+	return use_compression && supported;
+}
+
 void Texture::upload(Image* img)
 {
 	create(img->width, img->height, img->num_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, true, img->data);
@@ -495,6 +668,7 @@ void Texture::bind()
 {
 	//glEnable(this->texture_type); //enable the textures 
 	glBindTexture(this->texture_type, texture_id );	//enable the id of the texture we are going to use
+	RENDER_STATS_ADD(texture_binds, 1);
 }
 
 void Texture::unbind()
@@ -554,7 +728,10 @@ void Texture::toViewport(Shader* shader)
 FBO* Texture::getGlobalFBO(Texture* texture)
 {
 	if (!global_fbo)
+	{
 		global_fbo = new FBO();
+		global_fbo->name = "global";
+	}
 	global_fbo->setTexture(texture);
 	return global_fbo;
 }
@@ -581,6 +758,7 @@ Texture* Texture::getWhiteTexture()
 
 void Texture::copyTo(Texture* destination, Shader* shader)
 {
+	RENDER_STATS_ADD(copies, 1);
 	if (!destination) //to current viewport
 	{
 		if (format == GL_DEPTH_COMPONENT) //to clone depth buffer
@@ -633,6 +811,7 @@ void Image::fromScreen(int width, int height)
 		this->height = height;
 		data = new uint8[width * height * 4];
 	}
+	num_channels = 4;
 
 	glReadPixels(0,0,width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
 }
@@ -657,6 +836,19 @@ void Image::fromTexture(Texture* texture)
 
 //TGA format from: http://www.paulbourke.net/dataformats/tga/
 //also on https://gshaw.ca/closecombat/formats/tga.html
+bool Image::load(const char* filename)
+{
+	std::string str = filename;
+	std::string ext = str.size() >= 4 ? str.substr(str.size() - 4, 4) : "";
+	if (ext == ".tga" || ext == ".TGA")
+		return loadTGA(filename);
+	if (ext == ".png" || ext == ".PNG")
+		return loadPNG(filename);
+	if (ext == ".jpg" || ext == ".JPG" || ext == "JPEG" || ext == "jpeg")
+		return loadJPG(filename);
+	return false; //unsupported file type
+}
+
 bool Image::loadTGA(const char* filename)
 {
 	GLubyte TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -866,10 +1058,7 @@ bool Image::saveTGA(const char* filename, bool flip_y)
 #endif
 	FILE *file = fopen(filename, "wb");
 	if (file == NULL)
-	{
-		fclose(file);
 		return false;
-	}
 
 	unsigned short header_short[3];
 	header_short[0] = width;
@@ -898,6 +1087,7 @@ bool Image::saveTGA(const char* filename, bool flip_y)
 
 	fwrite(bytes, 1, width*height * 4, file);
 	fclose(file);
+	delete[] bytes;
 	return true;
 }
 
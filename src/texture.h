@@ -7,12 +7,22 @@
 #include "includes.h"
 #include "framework.h"
 #include <map>
+#include <set>
 #include <string>
 #include <cassert>
 
 class Shader;
 class FBO;
 class Texture;
+struct sCompressedImage;
+struct sRawImage;
+
+//block compression of the textures loaded from files, baked once and cached in a .tbin next to the image
+enum eTextureCompression {
+	TEXTURE_UNCOMPRESSED,
+	TEXTURE_COMPRESS_COLOR, //BC1, BC3 if it has alpha, BC4 if it is grayscale
+	TEXTURE_COMPRESS_NORMALMAP //BC5, shaders rebuild z from x and y
+};
 
 #ifndef OPENGL_ES3
 #define GL_RGBA32F 0x8814
@@ -65,6 +75,7 @@ public:
 	void fromTexture(Texture* texture);
 	void fromScreen(int width, int height);
 
+	bool load(const char* filename); //by the extension, it only touches the CPU so it can run in any thread
 	bool loadTGA(const char* filename);
 	bool loadPNG(const char* filename, bool flip_y = true);
 	bool loadPNG(std::vector<unsigned char>& buffer, bool flip_y = false);
@@ -103,11 +114,14 @@ public:
 	static int default_mag_filter;
 	static int default_min_filter;
 	static FBO* global_fbo;
+	static bool use_compression; //textures loaded with an eTextureCompression are block compressed if the GPU supports it
+	static bool use_cache; //uncompressed textures loaded from files keep their pixels and mips in a .rbin
 
 	//a general struct to store all the information about a TGA file
 
 	//textures manager
 	static std::map<std::string, Texture*> sTexturesLoaded;
+	static std::set<Texture*> sAllTextures; //every texture alive, loaded or not, for the memory report
 
 	GLuint texture_id; // GL id to identify the texture in opengl, every texture must have its own id
 	float width;
@@ -127,6 +141,18 @@ public:
 	//original data info
 	Image image;
 
+	//textures loaded from files with their mips in a .rbin or .tbin can drop the top levels and get them back, see TextureResidency
+	struct sResidency {
+		bool streamable = false;
+		eTextureCompression compression = TEXTURE_UNCOMPRESSED; //as it was requested, to find the cache again
+		int num_levels = 1; //of the whole chain
+		int level = 0; //first level of the chain in VRAM, width and height are its size
+		int full_width = 0;
+		int full_height = 0;
+		long last_used_frame = -1;
+		float required_size = 0; //biggest size in pixels it was sampled at the last frame it was used
+	} residency;
+
 	Texture();
 	Texture(unsigned int width, unsigned int height, unsigned int format = GL_RGB, unsigned int type = GL_UNSIGNED_BYTE, bool mipmaps = true, Uint8* data = NULL, unsigned int internal_format = 0);
 	Texture(Image* img);
@@ -158,11 +184,15 @@ public:
 	void operator = (const Texture& tex) { assert("textures cannot be cloned like this!");  }
 
 	//load without using the manager
-	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	bool load(const char* filename, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE, eTextureCompression compression = TEXTURE_UNCOMPRESSED);
 	void loadFromImage(Image* image, bool mipmaps = true, bool wrap = true, unsigned int type = GL_UNSIGNED_BYTE);
+	void loadFromCompressedImage(sCompressedImage* image, bool wrap = true, int first_level = 0); //with all its mips from first_level
+	void loadFromRawImage(sRawImage* image, bool wrap = true, int first_level = 0); //with all its mips from first_level, no glGenerateMipmap
+	bool setResidentLevel(int level); //reloads it from its cache with the mips from level, false if it is not streamable
+	static bool canCompress(); //use_compression and the GPU supports S3TC, only from the GL thread
 
 	//load using the manager (caching loaded ones to avoid reloading them)
-	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true);
+	static Texture* Get(const char* filename, bool mipmaps = true, bool wrap = true, eTextureCompression compression = TEXTURE_UNCOMPRESSED);
 	static Texture* Find(const char* filename);
 	void setName(const char* name) {
 		filename = name;
@@ -0,0 +1,252 @@
+#include "texture_cache.h"
+#include "texture.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+
+#ifdef USE_SSE_MATH
+	#include <emmintrin.h>
+#endif
+
+//.rbin: "RBIN", sRawTextureBinInfo, then the levels from the biggest
+#define RAW_TEXTURE_BIN_VERSION 1
+
+struct sRawTextureBinInfo {
+	int version;
+	int header_bytes;
+	int width;
+	int height;
+	int num_channels;
+	int num_levels;
+	int mipmaps; //as it was requested, another one bakes it again
+	int srgb;
+	unsigned long long source_size;
+	long long source_time;
+	unsigned long long source_hash; //checked only when the time changed
+	char extra[32]; //unused
+};
+
+//conversions between the 8 bits values and linear light, built once by the first thread that needs them
+struct sGammaTables {
+	float srgb_to_linear[256];
+	float unorm_to_float[256];
+	unsigned char linear_to_srgb[4096]; //indexed by sqrt(linear) * 4095, so the darks get more entries
+
+	sGammaTables()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			float c = i / 255.0f;
+			srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			unorm_to_float[i] = c;
+		}
+		for (int i = 0; i < 4096; ++i)
+		{
+			float l = (i / 4095.0f) * (i / 4095.0f);
+			float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			linear_to_srgb[i] = (unsigned char)(std::min(std::max(s, 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const sGammaTables& getGammaTables()
+{
+	static sGammaTables tables;
+	return tables;
+}
+
+int getNumMipLevels(int width, int height)
+{
+	int num_levels = 1;
+	while ((width >> (num_levels - 1)) > 1 || (height >> (num_levels - 1)) > 1)
+		num_levels++;
+	return num_levels;
+}
+
+void downsampleImage(const unsigned char* src, int width, int height, int num_channels, bool srgb, unsigned char* dst)
+{
+	assert(num_channels > 0 && num_channels <= 4);
+	const sGammaTables& tables = getGammaTables();
+	const float* to_linear[4];
+	for (int j = 0; j < 4; ++j)
+		to_linear[j] = (srgb && j < 3) ? tables.srgb_to_linear : tables.unorm_to_float;
+
+	//the last row and column repeat when the size is odd or 1
+	int next_w = std::max(width / 2, 1);
+	int next_h = std::max(height / 2, 1);
+	for (int y = 0; y < next_h; ++y)
+	{
+		const unsigned char* row0 = src + (size_t)std::min(y * 2, height - 1) * width * num_channels;
+		const unsigned char* row1 = src + (size_t)std::min(y * 2 + 1, height - 1) * width * num_channels;
+		unsigned char* out = dst + (size_t)y * next_w * num_channels;
+		for (int x = 0; x < next_w; ++x, out += num_channels)
+		{
+			int x0 = std::min(x * 2, width - 1) * num_channels;
+			int x1 = std::min(x * 2 + 1, width - 1) * num_channels;
+			const unsigned char* texels[4] = { row0 + x0, row0 + x1, row1 + x0, row1 + x1 };
+
+			//the channels of a pixel go in the lanes, the color index is sqrt(linear) and the rest is linear
+			int color_index[4];
+			int unorm[4];
+#ifdef USE_SSE_MATH
+			__m128 sum = _mm_setzero_ps();
+			for (int i = 0; i < 4; ++i)
+			{
+				float values[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+				for (int j = 0; j < num_channels; ++j)
+					values[j] = to_linear[j][texels[i][j]];
+				sum = _mm_add_ps(sum, _mm_loadu_ps(values));
+			}
+			sum = _mm_mul_ps(sum, _mm_set1_ps(0.25f));
+			_mm_storeu_si128((__m128i*)color_index, _mm_cvtps_epi32(_mm_mul_ps(_mm_sqrt_ps(sum), _mm_set1_ps(4095.0f))));
+			_mm_storeu_si128((__m128i*)unorm, _mm_cvtps_epi32(_mm_mul_ps(sum, _mm_set1_ps(255.0f))));
+#else
+			for (int j = 0; j < num_channels; ++j)
+			{
+				float average = (to_linear[j][texels[0][j]] + to_linear[j][texels[1][j]] + to_linear[j][texels[2][j]] + to_linear[j][texels[3][j]]) * 0.25f;
+				color_index[j] = (int)(sqrtf(average) * 4095.0f + 0.5f);
+				unorm[j] = (int)(average * 255.0f + 0.5f);
+			}
+#endif
+			for (int j = 0; j < num_channels; ++j)
+				out[j] = (srgb && j < 3) ? tables.linear_to_srgb[color_index[j]] : (unsigned char)unorm[j];
+		}
+	}
+}
+
+bool buildRawImage(Image* image, bool mipmaps, bool srgb, sRawImage& result)
+{
+	if (!image || !image->data || !image->width || !image->height || (image->num_channels != 3 && image->num_channels != 4))
+		return false;
+
+	int width = image->width;
+	int height = image->height;
+	int num_channels = image->num_channels;
+	int num_levels = (mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height)) ? getNumMipLevels(width, height) : 1;
+
+	result.file.close();
+	result.width = width;
+	result.height = height;
+	result.num_channels = num_channels;
+	result.levels.resize(num_levels);
+	size_t total = 0;
+	for (int level = 0; level < num_levels; ++level)
+	{
+		result.levels[level] = total;
+		total += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * num_channels;
+	}
+	result.pixels.resize(total);
+	memcpy(&result.pixels[0], image->data, (size_t)width * height * num_channels);
+	for (int level = 1; level < num_levels; ++level)
+		downsampleImage(&result.pixels[result.levels[level - 1]], std::max(width >> (level - 1), 1), std::max(height >> (level - 1), 1), num_channels, srgb, &result.pixels[result.levels[level]]);
+	result.data = &result.pixels[0];
+	return true;
+}
+
+bool readRawImage(const char* filename, const char* source, bool mipmaps, bool srgb, sRawImage& result)
+{
+	MappedFile& file = result.file;
+	if (!file.open(filename))
+		return false;
+
+	sRawTextureBinInfo info;
+	if (file.size < 4 + sizeof(info) || memcmp(file.data, "RBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading texture BIN: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	memcpy(&info, file.data + 4, sizeof(info));
+
+	//outdated if the source changed: size first, then time, and the content only if the time is different
+	unsigned long long size;
+	long long modification_time;
+	if (info.version != RAW_TEXTURE_BIN_VERSION || info.header_bytes != sizeof(info) || info.mipmaps != (int)mipmaps || info.srgb != (int)srgb ||
+		!getFileStats(source, size, modification_time) || size != info.source_size ||
+		(modification_time != info.source_time && hashFile(source) != info.source_hash))
+	{
+		file.close();
+		return false;
+	}
+
+	size_t total = 0;
+	result.levels.resize(std::max(info.num_levels, 0));
+	for (int level = 0; level < info.num_levels; ++level)
+	{
+		result.levels[level] = total;
+		total += (size_t)std::max(info.width >> level, 1) * std::max(info.height >> level, 1) * info.num_channels;
+	}
+	if (!total || (info.num_channels != 3 && info.num_channels != 4) || file.size < 4 + sizeof(info) + total)
+	{
+		std::cout << "[ERROR] loading texture BIN: truncated or corrupted: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	//the pixels stay in the mapping, they are read from the disk when uploaded
+	result.width = info.width;
+	result.height = info.height;
+	result.num_channels = info.num_channels;
+	result.data = file.data + 4 + sizeof(info);
+	std::vector<unsigned char>().swap(result.pixels);
+	return true;
+}
+
+bool writeRawImage(const char* filename, const char* source, bool mipmaps, bool srgb, const sRawImage& image)
+{
+	sRawTextureBinInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = RAW_TEXTURE_BIN_VERSION;
+	info.header_bytes = sizeof(info);
+	info.width = image.width;
+	info.height = image.height;
+	info.num_channels = image.num_channels;
+	info.num_levels = (int)image.levels.size();
+	info.mipmaps = mipmaps;
+	info.srgb = srgb;
+	if (!image.data || !getFileStats(source, info.source_size, info.source_time))
+		return false;
+	info.source_hash = hashFile(source);
+
+	size_t total = 0;
+	for (int level = 0; level < info.num_levels; ++level)
+		total += (size_t)std::max(info.width >> level, 1) * std::max(info.height >> level, 1) * info.num_channels;
+
+	//written aside and renamed, another texture may be reading the old one
+	std::string temp_filename = std::string(filename) + ".tmp";
+	FILE* f = fopen(temp_filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write texture BIN: " << filename << std::endl;
+		return false;
+	}
+	fwrite("RBIN", sizeof(char), 4, f);
+	fwrite(&info, sizeof(info), 1, f);
+	fwrite(image.data, 1, total, f);
+	fclose(f);
+
+	remove(filename);
+	if (rename(temp_filename.c_str(), filename) != 0)
+	{
+		std::cout << "[ERROR] cannot write texture BIN: " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool loadRawImage(const char* filename, bool mipmaps, bool srgb, sRawImage& result)
+{
+	std::string binfilename = std::string(filename) + ".rbin";
+	if (readRawImage(binfilename.c_str(), filename, mipmaps, srgb, result))
+		return true;
+
+	Image image;
+	if (!image.load(filename) || !buildRawImage(&image, mipmaps, srgb, result))
+		return false;
+	writeRawImage(binfilename.c_str(), filename, mipmaps, srgb, result);
+	return true;
+}
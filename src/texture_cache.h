@@ -0,0 +1,43 @@
+/*  Texture cache, keeps the decoded pixels of an image with its whole mip chain in a .rbin next to the source,
+	so the next loads only map the file and upload it: no png/jpg decoding and no glGenerateMipmap.
+	The mips are built when baking with a gamma correct 2x2 filter (color is averaged in linear light, alpha and
+	data as they are), the same filter the texture compressor uses before encoding the blocks.
+	The .rbin is valid while the source keeps its size and time (or its content) and the options match.
+*/
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "utils.h"
+
+class Image;
+
+//pixels of every mip one after another, from the biggest, rows packed without padding
+struct sRawImage {
+	int width = 0;
+	int height = 0;
+	int num_channels = 0; //3 or 4
+	std::vector<size_t> levels; //offset of every mip in data
+	const unsigned char* data = NULL; //inside the mapped .rbin or in pixels
+	MappedFile file;
+	std::vector<unsigned char> pixels; //only when it was just baked
+};
+
+int getNumMipLevels(int width, int height); //down to 1x1
+
+//half the size of src (at least 1 pixel), srgb averages the first three channels in linear light
+void downsampleImage(const unsigned char* src, int width, int height, int num_channels, bool srgb, unsigned char* dst);
+
+//mips only for power of two sizes, like Texture::create
+bool buildRawImage(Image* image, bool mipmaps, bool srgb, sRawImage& result);
+
+//the .rbin of the source if it is valid, otherwise the source is decoded and cached
+//it does not use GL, so it can run in any thread
+bool loadRawImage(const char* filename, bool mipmaps, bool srgb, sRawImage& result);
+bool readRawImage(const char* filename, const char* source, bool mipmaps, bool srgb, sRawImage& result);
+bool writeRawImage(const char* filename, const char* source, bool mipmaps, bool srgb, const sRawImage& image);
+
+#endif
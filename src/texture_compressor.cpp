@@ -0,0 +1,474 @@
+#include "texture_compressor.h"
+#include "includes.h"
+#include "utils.h"
+#include "texture_cache.h"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+	#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+	#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RED_RGTC1
+	#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+	#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+
+//.tbin: "TBIN", sTextureBinInfo, then the levels from the biggest
+#define TEXTURE_BIN_VERSION 2 //2 filters the mips in linear light
+
+struct sTextureBinInfo {
+	int version;
+	int header_bytes;
+	unsigned int format;
+	int width;
+	int height;
+	int num_levels;
+	int compression; //as it was requested, another one bakes it again
+	int mipmaps;
+	unsigned long long source_size;
+	long long source_time;
+	unsigned long long source_hash; //checked only when the time changed
+	char extra[32]; //unused
+};
+
+size_t getCompressedLevelSize(unsigned int format, int width, int height)
+{
+	size_t blocks = (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4);
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RED_RGTC1: return blocks * 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RG_RGTC2: return blocks * 16;
+	}
+	return 0;
+}
+
+const char* getCompressionName(unsigned int format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+	case GL_COMPRESSED_RED_RGTC1: return "BC4";
+	case GL_COMPRESSED_RG_RGTC2: return "BC5";
+	}
+	return "";
+}
+
+static unsigned short packRGB565(const float* color)
+{
+	int r = std::min(std::max((int)(color[0] * (31.0f / 255.0f) + 0.5f), 0), 31);
+	int g = std::min(std::max((int)(color[1] * (63.0f / 255.0f) + 0.5f), 0), 63);
+	int b = std::min(std::max((int)(color[2] * (31.0f / 255.0f) + 0.5f), 0), 31);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(unsigned short c, float* color)
+{
+	int r = (c >> 11) & 31;
+	int g = (c >> 5) & 63;
+	int b = c & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+//nearest color of the palette for every texel, returns the squared error
+static float fitBC1Indices(const unsigned char* texels, unsigned short c0, unsigned short c1, unsigned int& indices)
+{
+	float palette[4][3];
+	unpackRGB565(c0, palette[0]);
+	unpackRGB565(c1, palette[1]);
+	for (int j = 0; j < 3; ++j)
+	{
+		palette[2][j] = (2.0f * palette[0][j] + palette[1][j]) / 3.0f;
+		palette[3][j] = (palette[0][j] + 2.0f * palette[1][j]) / 3.0f;
+	}
+
+	indices = 0;
+	float error = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		const unsigned char* texel = texels + i * 4;
+		int best = 0;
+		float best_distance = FLT_MAX;
+		for (int k = 0; k < 4; ++k)
+		{
+			float dr = texel[0] - palette[k][0];
+			float dg = texel[1] - palette[k][1];
+			float db = texel[2] - palette[k][2];
+			float distance = dr * dr + dg * dg + db * db;
+			if (distance < best_distance)
+			{
+				best = k;
+				best_distance = distance;
+			}
+		}
+		indices |= (unsigned int)best << (2 * i);
+		error += best_distance;
+	}
+	return error;
+}
+
+void encodeBC1Block(const unsigned char* texels, unsigned char* block)
+{
+	//principal axis of the colors, by power iteration on the covariance
+	float mean[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+		for (int j = 0; j < 3; ++j)
+			mean[j] += texels[i * 4 + j];
+	for (int j = 0; j < 3; ++j)
+		mean[j] /= 16.0f;
+
+	float cov[6] = { 0, 0, 0, 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		float r = texels[i * 4] - mean[0];
+		float g = texels[i * 4 + 1] - mean[1];
+		float b = texels[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	//starts from the column of the channel that varies most, (1,1,1) could be orthogonal to the axis
+	static const int columns[3][3] = { { 0, 1, 2 }, { 1, 3, 4 }, { 2, 4, 5 } }; //of the symmetric matrix in cov
+	int channel = cov[0] >= cov[3] && cov[0] >= cov[5] ? 0 : (cov[3] >= cov[5] ? 1 : 2);
+	float axis[3] = { 1, 1, 1 };
+	if (cov[columns[channel][channel]] > 0)
+		for (int j = 0; j < 3; ++j)
+			axis[j] = cov[columns[channel][j]];
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+		if (length < 1e-6f)
+			break; //flat block, any axis works
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+
+	//endpoints at the extremes of the projections
+	float min_t = FLT_MAX, max_t = -FLT_MAX;
+	for (int i = 0; i < 16; ++i)
+	{
+		float t = 0;
+		for (int j = 0; j < 3; ++j)
+			t += (texels[i * 4 + j] - mean[j]) * axis[j];
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+	float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	float e0[3], e1[3];
+	for (int j = 0; j < 3; ++j)
+	{
+		e0[j] = mean[j] + axis[j] * max_t / length2;
+		e1[j] = mean[j] + axis[j] * min_t / length2;
+	}
+	unsigned short c0 = packRGB565(e0);
+	unsigned short c1 = packRGB565(e1);
+	unsigned int indices;
+	float error = fitBC1Indices(texels, c0, c1, indices);
+
+	//least squares endpoints for the chosen indices, kept if they fit better
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; //of c0 for every index
+	float aa = 0, bb = 0, ab = 0, ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		float a = weights[(indices >> (2 * i)) & 3];
+		float b = 1.0f - a;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int j = 0; j < 3; ++j)
+		{
+			ax[j] += a * texels[i * 4 + j];
+			bx[j] += b * texels[i * 4 + j];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (fabsf(det) > 1e-6f)
+	{
+		for (int j = 0; j < 3; ++j)
+		{
+			e0[j] = (ax[j] * bb - bx[j] * ab) / det;
+			e1[j] = (bx[j] * aa - ax[j] * ab) / det;
+		}
+		unsigned short n0 = packRGB565(e0);
+		unsigned short n1 = packRGB565(e1);
+		unsigned int new_indices;
+		if (fitBC1Indices(texels, n0, n1, new_indices) < error)
+		{
+			c0 = n0;
+			c1 = n1;
+			indices = new_indices;
+		}
+	}
+
+	//c0 > c1 selects the 4 colors mode, swapping the endpoints swaps the indices 0-1 and 2-3
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		indices ^= 0x55555555;
+	}
+	else if (c0 == c1)
+		indices = 0;
+
+	block[0] = c0 & 255;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 255;
+	block[3] = c1 >> 8;
+	for (int i = 0; i < 4; ++i)
+		block[4 + i] = (indices >> (8 * i)) & 255;
+}
+
+void encodeBC4Block(const unsigned char* texels, int channel, unsigned char* block)
+{
+	int min_value = 255, max_value = 0;
+	for (int i = 0; i < 16; ++i)
+	{
+		min_value = std::min(min_value, (int)texels[i * 4 + channel]);
+		max_value = std::max(max_value, (int)texels[i * 4 + channel]);
+	}
+
+	//a0 > a1 selects the 8 values mode, evenly spaced so rounding finds the nearest
+	unsigned long long indices = 0;
+	if (max_value > min_value)
+		for (int i = 0; i < 16; ++i)
+		{
+			int step = (int)((texels[i * 4 + channel] - min_value) * 7.0f / (max_value - min_value) + 0.5f); //0 is a1, 7 is a0
+			int index = step == 7 ? 0 : (step == 0 ? 1 : 8 - step);
+			indices |= (unsigned long long)index << (3 * i);
+		}
+
+	block[0] = (unsigned char)max_value;
+	block[1] = (unsigned char)min_value;
+	for (int i = 0; i < 6; ++i)
+		block[2 + i] = (indices >> (8 * i)) & 255;
+}
+
+void encodeBC3Block(const unsigned char* texels, unsigned char* block)
+{
+	encodeBC4Block(texels, 3, block);
+	encodeBC1Block(texels, block + 8);
+}
+
+void encodeBC5Block(const unsigned char* texels, unsigned char* block)
+{
+	encodeBC4Block(texels, 0, block);
+	encodeBC4Block(texels, 1, block + 8);
+}
+
+bool compressImage(Image* image, eTextureCompression compression, bool mipmaps, sCompressedImage& result)
+{
+	if (!image || !image->data || !image->width || !image->height || compression == TEXTURE_UNCOMPRESSED)
+		return false;
+
+	//RGBA8 copy, the format is chosen from what it contains
+	int width = image->width;
+	int height = image->height;
+	std::vector<unsigned char> texels((size_t)width * height * 4);
+	bool has_alpha = false;
+	bool grayscale = true;
+	for (size_t i = 0; i < (size_t)width * height; ++i)
+	{
+		const unsigned char* src = image->data + i * image->num_channels;
+		unsigned char* dst = &texels[i * 4];
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+		dst[3] = image->num_channels == 4 ? src[3] : 255;
+		has_alpha = has_alpha || dst[3] != 255;
+		grayscale = grayscale && src[0] == src[1] && src[1] == src[2];
+	}
+
+	if (compression == TEXTURE_COMPRESS_NORMALMAP)
+		result.format = GL_COMPRESSED_RG_RGTC2;
+	else if (has_alpha)
+		result.format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	else if (grayscale)
+		result.format = GL_COMPRESSED_RED_RGTC1;
+	else
+		result.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	result.width = width;
+	result.height = height;
+
+	//same rule as Texture::create, only power of two sizes get mips
+	int num_levels = (mipmaps && isPowerOfTwo(width) && isPowerOfTwo(height)) ? getNumMipLevels(width, height) : 1;
+
+	result.levels.resize(num_levels);
+	size_t total = 0;
+	for (int level = 0; level < num_levels; ++level)
+	{
+		result.levels[level] = total;
+		total += getCompressedLevelSize(result.format, std::max(width >> level, 1), std::max(height >> level, 1));
+	}
+	result.data.resize(total);
+
+	size_t block_bytes = getCompressedLevelSize(result.format, 4, 4);
+	std::vector<unsigned char> next;
+	int w = width, h = height;
+	for (int level = 0; level < num_levels; ++level)
+	{
+		//from the previous level, normal maps are not colors so they are averaged as they are
+		if (level)
+		{
+			int next_w = std::max(w / 2, 1);
+			int next_h = std::max(h / 2, 1);
+			next.resize((size_t)next_w * next_h * 4);
+			downsampleImage(&texels[0], w, h, 4, compression != TEXTURE_COMPRESS_NORMALMAP, &next[0]);
+			texels.swap(next);
+			w = next_w;
+			h = next_h;
+		}
+
+		//blocks out of the image repeat the last row and column
+		unsigned char* block = &result.data[result.levels[level]];
+		unsigned char block_texels[16 * 4];
+		for (int by = 0; by < h; by += 4)
+			for (int bx = 0; bx < w; bx += 4)
+			{
+				for (int i = 0; i < 16; ++i)
+				{
+					int x = std::min(bx + (i & 3), w - 1);
+					int y = std::min(by + (i >> 2), h - 1);
+					memcpy(block_texels + i * 4, &texels[((size_t)y * w + x) * 4], 4);
+				}
+				switch (result.format)
+				{
+				case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: encodeBC1Block(block_texels, block); break;
+				case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: encodeBC3Block(block_texels, block); break;
+				case GL_COMPRESSED_RED_RGTC1: encodeBC4Block(block_texels, 0, block); break;
+				case GL_COMPRESSED_RG_RGTC2: encodeBC5Block(block_texels, block); break;
+				}
+				block += block_bytes;
+			}
+	}
+	return true;
+}
+
+bool mapCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, sCompressedImage& result)
+{
+	MappedFile& file = result.file;
+	result.mapped = NULL;
+	if (!file.open(filename))
+		return false;
+
+	sTextureBinInfo info;
+	if (file.size < 4 + sizeof(info) || memcmp(file.data, "TBIN", 4) != 0)
+	{
+		std::cout << "[ERROR] loading texture BIN: invalid content: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+	memcpy(&info, file.data + 4, sizeof(info));
+
+	//old, baked with other settings or outdated if the source changed: size first, then time, and the content only if the time is different
+	unsigned long long size;
+	long long modification_time;
+	if (info.version != TEXTURE_BIN_VERSION || info.header_bytes != sizeof(info) || info.compression != compression || info.mipmaps != (int)mipmaps ||
+		!getFileStats(source, size, modification_time) || size != info.source_size ||
+		(modification_time != info.source_time && hashFile(source) != info.source_hash))
+	{
+		file.close();
+		return false;
+	}
+
+	size_t total = 0;
+	result.levels.resize(std::max(info.num_levels, 0));
+	for (int level = 0; level < info.num_levels; ++level)
+	{
+		result.levels[level] = total;
+		total += getCompressedLevelSize(info.format, std::max(info.width >> level, 1), std::max(info.height >> level, 1));
+	}
+	if (!total || file.size < 4 + sizeof(info) + total)
+	{
+		std::cout << "[ERROR] loading texture BIN: truncated or corrupted: " << filename << std::endl;
+		file.close();
+		return false;
+	}
+
+	result.format = info.format;
+	result.width = info.width;
+	result.height = info.height;
+	result.mapped = file.data + 4 + sizeof(info);
+	std::vector<unsigned char>().swap(result.data);
+	return true;
+}
+
+bool readCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, sCompressedImage& result)
+{
+	if (!mapCompressedImage(filename, source, compression, mipmaps, result))
+		return false;
+
+	//copied, so it does not depend on the file once loaded
+	int last = (int)result.levels.size() - 1;
+	size_t total = result.levels[last] + getCompressedLevelSize(result.format, std::max(result.width >> last, 1), std::max(result.height >> last, 1));
+	result.data.assign(result.mapped, result.mapped + total);
+	result.mapped = NULL;
+	result.file.close();
+	return true;
+}
+
+bool writeCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, const sCompressedImage& image)
+{
+	sTextureBinInfo info;
+	memset(&info, 0, sizeof(info));
+	info.version = TEXTURE_BIN_VERSION;
+	info.header_bytes = sizeof(info);
+	info.format = image.format;
+	info.width = image.width;
+	info.height = image.height;
+	info.num_levels = (int)image.levels.size();
+	info.compression = compression;
+	info.mipmaps = mipmaps;
+	if (!getFileStats(source, info.source_size, info.source_time))
+		return false;
+	info.source_hash = hashFile(source);
+
+	//written aside and renamed, another texture may be reading the old one
+	std::string temp_filename = std::string(filename) + ".tmp";
+	FILE* f = fopen(temp_filename.c_str(), "wb");
+	if (f == NULL)
+	{
+		std::cout << "[ERROR] cannot write texture BIN: " << filename << std::endl;
+		return false;
+	}
+	fwrite("TBIN", sizeof(char), 4, f);
+	fwrite(&info, sizeof(info), 1, f);
+	if (image.data.size())
+		fwrite(&image.data[0], 1, image.data.size(), f);
+	fclose(f);
+
+	remove(filename);
+	if (rename(temp_filename.c_str(), filename) != 0)
+	{
+		std::cout << "[ERROR] cannot write texture BIN: " << filename << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool loadCompressedImage(const char* filename, eTextureCompression compression, bool mipmaps, sCompressedImage& result)
+{
+	std::string binfilename = std::string(filename) + ".tbin";
+	if (readCompressedImage(binfilename.c_str(), filename, compression, mipmaps, result))
+		return true;
+
+	Image image;
+	if (!image.load(filename) || !compressImage(&image, compression, mipmaps, result))
+		return false;
+	writeCompressedImage(binfilename.c_str(), filename, compression, mipmaps, result);
+	return true;
+}
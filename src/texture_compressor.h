@@ -0,0 +1,50 @@
+/*  Texture compressor, bakes images to GPU block compression so they take 4 to 8 times less VRAM:
+	BC1 for opaque color, BC3 for color with alpha, BC4 for grayscale (sampled as RRR1) and BC5 for normal maps.
+	Every 4x4 block is fitted on the principal axis of its colors and refined once with least squares, the mips
+	are built before compressing. The result is cached in a .tbin next to the source image, valid while the
+	source keeps its size and time (or its content), so the encoder only runs the first time.
+*/
+
+#ifndef TEXTURE_COMPRESSOR_H
+#define TEXTURE_COMPRESSOR_H
+
+#include <cstddef>
+#include <vector>
+
+#include "texture.h"
+#include "utils.h"
+
+//a compressed image with its mip chain, the levels one after another in data (or in the mapped .tbin)
+struct sCompressedImage {
+	unsigned int format = 0; //GL_COMPRESSED_*
+	int width = 0;
+	int height = 0;
+	std::vector<size_t> levels; //offset of every mip in data
+	std::vector<unsigned char> data; //empty when it was only mapped
+	MappedFile file;
+	const unsigned char* mapped = NULL; //inside file
+
+	const unsigned char* getData() const { return data.size() ? &data[0] : mapped; }
+};
+
+//bytes of a level, 0 if the format is not one of the block compressed ones
+size_t getCompressedLevelSize(unsigned int format, int width, int height);
+const char* getCompressionName(unsigned int format);
+
+//texels are 16 RGBA8 in rows
+void encodeBC1Block(const unsigned char* texels, unsigned char* block); //8 bytes, always in the 4 colors mode
+void encodeBC4Block(const unsigned char* texels, int channel, unsigned char* block); //8 bytes, one channel of the texels
+void encodeBC3Block(const unsigned char* texels, unsigned char* block); //16 bytes, BC4 alpha and BC1 color
+void encodeBC5Block(const unsigned char* texels, unsigned char* block); //16 bytes, BC4 red and BC4 green
+
+//the format is chosen from the content, mips only for power of two sizes
+bool compressImage(Image* image, eTextureCompression compression, bool mipmaps, sCompressedImage& result);
+
+//the .tbin of the source if it is valid, otherwise the source is decoded, compressed and cached
+//it does not use GL, so it can run in any thread
+bool loadCompressedImage(const char* filename, eTextureCompression compression, bool mipmaps, sCompressedImage& result);
+bool readCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, sCompressedImage& result);
+bool mapCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, sCompressedImage& result); //no copy, the levels stay in the mapping
+bool writeCompressedImage(const char* filename, const char* source, eTextureCompression compression, bool mipmaps, const sCompressedImage& image);
+
+#endif
@@ -0,0 +1,235 @@
+#include "texture_residency.h"
+#include "includes.h"
+#include "texture.h"
+#include "texture_compressor.h"
+#include "camera.h"
+#include "material.h"
+#include "memory_report.h"
+#include "asset_loader.h"
+#include "profiler.h"
+
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+
+bool TextureResidency::enabled = true;
+size_t TextureResidency::budget = (size_t)1024 * 1024 * 1024;
+int TextureResidency::unused_frames = 300;
+int TextureResidency::min_size = 64;
+int TextureResidency::lod_bias = 1;
+size_t TextureResidency::max_upload_bytes = 32 * 1024 * 1024;
+long TextureResidency::frame = 0;
+bool TextureResidency::frame_cached = false;
+size_t TextureResidency::used_bytes = 0;
+size_t TextureResidency::streamable_bytes = 0;
+int TextureResidency::num_streamable = 0;
+int TextureResidency::num_reduced = 0;
+
+void TextureResidency::markUsed(Texture* texture, float screen_size)
+{
+	if (!texture)
+		return;
+	Texture::sResidency& residency = texture->residency;
+	if (residency.last_used_frame != frame)
+	{
+		residency.last_used_frame = frame;
+		residency.required_size = screen_size;
+	}
+	else
+		residency.required_size = std::max(residency.required_size, screen_size);
+}
+
+void TextureResidency::markUsed(GTR::Material* material, float screen_size)
+{
+	if (!material)
+		return;
+	markUsed(material->color_texture.texture, screen_size);
+	markUsed(material->emissive_texture.texture, screen_size);
+	markUsed(material->opacity_texture.texture, screen_size);
+	markUsed(material->metallic_roughness_texture.texture, screen_size);
+	markUsed(material->occlusion_texture.texture, screen_size);
+	markUsed(material->normal_texture.texture, screen_size);
+}
+
+float TextureResidency::getScreenSize(const BoundingBox& world_box, Camera* camera, float viewport_height)
+{
+	//the diameter of the bounding sphere projected at its center, the texture is assumed to cover the object once
+	float radius = world_box.halfsize.length();
+	if (camera->type == Camera::ORTHOGRAPHIC)
+		return 2.0f * radius / std::max(fabsf(camera->top - camera->bottom), 0.0001f) * viewport_height;
+	float distance = world_box.center.distance(camera->eye);
+	if (distance <= radius)
+		return FLT_MAX; //inside it, any level can be seen
+	return radius / (distance * tanf(camera->fov * 0.5f * DEG2RAD)) * viewport_height;
+}
+
+size_t TextureResidency::getBytesFromLevel(Texture* texture, int level)
+{
+	//same estimation as the memory report, RGB is stored as RGBA
+	const Texture::sResidency& residency = texture->residency;
+	bool compressed = getCompressedLevelSize(texture->internal_format, 4, 4) != 0;
+	size_t bytes = 0;
+	for (int i = level; i < residency.num_levels; ++i)
+	{
+		int w = std::max(residency.full_width >> i, 1);
+		int h = std::max(residency.full_height >> i, 1);
+		bytes += compressed ? getCompressedLevelSize(texture->internal_format, w, h) : (size_t)w * h * 4;
+	}
+	return bytes;
+}
+
+//smallest level allowed, its biggest side is not under min_size
+static int getMinLevel(Texture* texture)
+{
+	const Texture::sResidency& residency = texture->residency;
+	int size = std::max(residency.full_width, residency.full_height);
+	int level = 0;
+	while (level + 1 < residency.num_levels && (size >> (level + 1)) >= TextureResidency::min_size)
+		level++;
+	return level;
+}
+
+//first level needed by the size it was sampled at
+static int getWantedLevel(Texture* texture, int min_level)
+{
+	const Texture::sResidency& residency = texture->residency;
+	if (residency.last_used_frame < 0 || TextureResidency::frame - residency.last_used_frame > TextureResidency::unused_frames)
+		return min_level;
+	float size = (float)std::max(residency.full_width, residency.full_height);
+	int level = 0;
+	while (level < min_level && size * 0.5f >= residency.required_size)
+	{
+		size *= 0.5f;
+		level++;
+	}
+	return std::max(level - TextureResidency::lod_bias, 0);
+}
+
+struct sResidencyCandidate {
+	Texture* texture;
+	int min_level;
+	int wanted;
+	int target;
+};
+
+void TextureResidency::update()
+{
+	CPU_SCOPE("TextureResidency::update");
+
+	std::vector<sResidencyCandidate> candidates;
+	size_t total = 0;
+	used_bytes = 0;
+	streamable_bytes = 0;
+	num_streamable = 0;
+	num_reduced = 0;
+	for (auto it = Texture::sAllTextures.begin(); it != Texture::sAllTextures.end(); ++it)
+	{
+		Texture* texture = *it;
+		size_t bytes = getTextureGPUBytes(texture);
+		used_bytes += bytes;
+		if (!texture->residency.streamable || texture->residency.num_levels <= 1 || AssetLoader::isLoading(texture))
+		{
+			total += bytes;
+			continue;
+		}
+		streamable_bytes += bytes;
+		num_streamable++;
+
+		//the levels it has over what it needs are kept while they fit, disabled it gets them all back
+		sResidencyCandidate candidate;
+		candidate.texture = texture;
+		candidate.min_level = enabled ? getMinLevel(texture) : 0;
+		candidate.wanted = enabled ? getWantedLevel(texture, candidate.min_level) : 0;
+		candidate.target = std::min(texture->residency.level, candidate.wanted);
+		total += getBytesFromLevel(texture, candidate.target);
+		candidates.push_back(candidate);
+	}
+	//the textures on screen were not marked in a cached frame, the time stops until something is rendered again
+	if (!frame_cached)
+		frame++;
+	frame_cached = false;
+	if (candidates.empty())
+		return;
+
+	//over the budget: the ones used longest ago (the biggest first if they were used in the same frame) lose the levels
+	//they do not need, then the ones they need down to the smallest allowed
+	std::sort(candidates.begin(), candidates.end(), [](const sResidencyCandidate& a, const sResidencyCandidate& b) {
+		if (a.texture->residency.last_used_frame != b.texture->residency.last_used_frame)
+			return a.texture->residency.last_used_frame < b.texture->residency.last_used_frame;
+		return a.texture->residency.full_width * a.texture->residency.full_height > b.texture->residency.full_width * b.texture->residency.full_height;
+	});
+	for (int pass = 0; pass < 2 && total > budget; ++pass)
+		for (int i = 0; i < (int)candidates.size() && total > budget; ++i)
+		{
+			sResidencyCandidate& candidate = candidates[i];
+			int level = pass == 0 ? std::max(candidate.target, candidate.wanted) : candidate.min_level;
+			if (level <= candidate.target)
+				continue;
+			total -= getBytesFromLevel(candidate.texture, candidate.target) - getBytesFromLevel(candidate.texture, level);
+			candidate.target = level;
+		}
+
+	//a drop uploads the levels it keeps too, both count in max_upload_bytes and the rest waits for the next frames
+	//levels dropped first, the ones used longest ago, the memory is freed before anything is brought back
+	size_t uploaded = 0;
+	bool drops_pending = false;
+	for (int i = 0; i < (int)candidates.size(); ++i)
+	{
+		sResidencyCandidate& candidate = candidates[i];
+		if (candidate.target <= candidate.texture->residency.level)
+			continue;
+		size_t bytes = getBytesFromLevel(candidate.texture, candidate.target);
+		if (uploaded && uploaded + bytes > max_upload_bytes)
+		{
+			drops_pending = true;
+			continue;
+		}
+		if (candidate.texture->setResidentLevel(candidate.target))
+			uploaded += bytes;
+		else
+			candidate.texture->residency.streamable = false; //its cache is gone or outdated, it stays as it is
+	}
+
+	//levels brought back, the most recently used first, not while the budget still waits for drops
+	for (int i = (int)candidates.size() - 1; i >= 0 && !drops_pending; --i)
+	{
+		sResidencyCandidate& candidate = candidates[i];
+		if (candidate.target >= candidate.texture->residency.level)
+			continue;
+		size_t bytes = getBytesFromLevel(candidate.texture, candidate.target);
+		if (uploaded && uploaded + bytes > max_upload_bytes)
+			continue;
+		if (candidate.texture->setResidentLevel(candidate.target))
+			uploaded += bytes;
+		else
+			candidate.texture->residency.streamable = false; //its cache is gone or outdated, it stays as it is
+	}
+
+	for (int i = 0; i < (int)candidates.size(); ++i)
+		if (candidates[i].texture->residency.level > 0)
+			num_reduced++;
+}
+
+std::string TextureResidency::getText()
+{
+	char str[256];
+	snprintf(str, sizeof(str), "Textures VRAM: %.2f MB of %.2f MB budget (%s), streamable %.2f MB in %d, %d reduced",
+		used_bytes / (1024.0 * 1024.0), budget / (1024.0 * 1024.0), used_bytes > budget ? "OVER" : "ok",
+		streamable_bytes / (1024.0 * 1024.0), num_streamable, num_reduced);
+	return str;
+}
+
+void TextureResidency::renderInMenu()
+{
+	#ifndef SKIP_IMGUI
+		ImGui::Checkbox("Texture Residency", &enabled);
+		int budget_mb = (int)(budget / (1024 * 1024));
+		if (ImGui::SliderInt("VRAM Budget (MB)", &budget_mb, 64, 8192))
+			budget = (size_t)budget_mb * 1024 * 1024;
+		ImGui::SliderInt("Min Size", &min_size, 1, 1024);
+		ImGui::SliderInt("LOD Bias", &lod_bias, 0, 4);
+		ImGui::Text("%s", getText().c_str());
+	#endif
+}
@@ -0,0 +1,51 @@
+/*  Texture residency, keeps the textures in VRAM under a budget by dropping the top mips of the ones that do not need them.
+	The renderer marks every frame the textures it uses with the size in pixels they cover on screen, update() then
+	picks for every streamable texture (loaded from a file with its mips in a .rbin or .tbin) the first level it needs.
+	Textures not used for a while go down to min_size. When the total is over the budget the ones used longest ago lose
+	their levels first, and the levels come back from the cache, the most recently used first, when they are needed again.
+	Other textures (FBOs, generated ones) count in the budget but are never reduced.
+*/
+
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <cstddef>
+#include <string>
+
+class Texture;
+class Camera;
+class BoundingBox;
+namespace GTR { class Material; }
+
+class TextureResidency
+{
+public:
+	static bool enabled;
+	static size_t budget; //bytes of VRAM for every texture
+	static int unused_frames; //frames without being used before a texture goes down to min_size
+	static int min_size; //texels of the biggest side of the smallest level kept
+	static int lod_bias; //levels kept over the size it is sampled at, the uvs may tile
+	static size_t max_upload_bytes; //per frame for the levels dropped or brought back, at least one texture changes every frame
+
+	static long frame;
+	static bool frame_cached; //set by the renderer when it presents a cached frame, nothing is marked so nothing ages
+
+	//render side, screen_size in pixels, FLT_MAX if unknown (it needs the whole chain)
+	static void markUsed(Texture* texture, float screen_size);
+	static void markUsed(GTR::Material* material, float screen_size);
+	static float getScreenSize(const BoundingBox& world_box, Camera* camera, float viewport_height);
+
+	static void update(); //main thread, once per frame after rendering
+
+	//last update
+	static size_t used_bytes; //every texture
+	static size_t streamable_bytes;
+	static int num_streamable;
+	static int num_reduced; //streamable textures without their top level
+
+	static size_t getBytesFromLevel(Texture* texture, int level); //VRAM of a streamable texture with its mips from level
+	static std::string getText();
+	static void renderInMenu();
+};
+
+#endif
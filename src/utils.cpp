@@ -2,8 +2,12 @@
 
 #ifdef WIN32
 	#include <windows.h>
+	#include <sys/stat.h>
 #else
 	#include <sys/time.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
 #endif
 
 #include "includes.h"
@@ -15,6 +19,8 @@
 
 #include "extra/stb_easy_font.h"
 
+#include <thread>
+
 long getTime()
 {
 	#ifdef WIN32
@@ -137,6 +143,146 @@ bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer
 	return true;
 }
 
+bool getFileStats(const char* filename, unsigned long long& size, long long& modification_time)
+{
+	struct stat info;
+	if (stat(filename, &info) != 0)
+		return false;
+	size = (unsigned long long)info.st_size;
+	modification_time = (long long)info.st_mtime;
+	return true;
+}
+
+unsigned long long hashFile(const char* filename)
+{
+	MappedFile file;
+	if (!file.open(filename))
+		return 0;
+	unsigned long long hash = 14695981039346656037ull; //FNV-1a 64
+	for (size_t i = 0; i < file.size; ++i)
+		hash = (hash ^ file.data[i]) * 1099511628211ull;
+	return hash;
+}
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+	file_handle = mapping_handle = NULL;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!view)
+	{
+		if (mapping)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	mapping_handle = mapping;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+		return false;
+	madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+	size = (size_t)info.st_size;
+#endif
+	data = (const unsigned char*)view;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping_handle);
+	CloseHandle((HANDLE)file_handle);
+#else
+	munmap((void*)data, size);
+#endif
+	data = NULL;
+	size = 0;
+	file_handle = mapping_handle = NULL;
+}
+
+//the sum of the bytes read is kept so the compiler does not remove the reads
+static volatile unsigned int prefetch_sink = 0;
+
+void MappedFile::prefetch()
+{
+	if (!data)
+		return;
+#ifndef WIN32
+	madvise((void*)data, size, MADV_WILLNEED);
+#endif
+	unsigned int sum = 0;
+	for (size_t i = 0; i < size; i += 4096)
+		sum += data[i];
+	prefetch_sink = prefetch_sink + sum;
+}
+
+static unsigned int resources_generation = 0;
+
+unsigned int getResourcesGeneration()
+{
+	return resources_generation;
+}
+
+void markResourcesChanged()
+{
+	resources_generation++;
+}
+
+void parallelFor(int count, const std::function<void(int)>& job)
+{
+	std::vector<std::thread> threads;
+	for (int i = 1; i < count; ++i)
+		threads.push_back(std::thread(job, i));
+	if (count > 0)
+		job(0);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+int getNumWorkerThreads()
+{
+	int num = (int)std::thread::hardware_concurrency();
+	return num > 0 ? num : 1;
+}
+
 bool checkGLErrors()
 {
 	#ifndef _DEBUG
@@ -7,6 +7,7 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <functional>
 #include "extra/cJSON.h"
 
 
@@ -18,6 +19,35 @@ long getTime();
 float * snapshot();
 bool readFile(const std::string& filename, std::string& content);
 bool readFileBin(const std::string& filename, std::vector<unsigned char>& buffer);
+bool getFileStats(const char* filename, unsigned long long& size, long long& modification_time); //false if it does not exist
+unsigned long long hashFile(const char* filename); //of the content, 0 if it cannot be read
+
+//changes every time a resource already in use gets new content in place (async loads, texture mips),
+//so whoever caches what was rendered with them knows it is outdated. Main thread only
+unsigned int getResourcesGeneration();
+void markResourcesChanged();
+
+//read only view of a whole file, the OS loads the pages when they are touched and can drop them under pressure
+class MappedFile
+{
+public:
+	const unsigned char* data;
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+	bool open(const char* filename);
+	void close();
+	void prefetch(); //reads every page now, so later accesses (from another thread too) do not wait for the disk
+
+private:
+	void* file_handle; //only used in windows
+	void* mapping_handle;
+};
+
+//calls job(i) for every i in [0,count), each one in its own thread (the first one in the caller), and waits for all
+void parallelFor(int count, const std::function<void(int)>& job);
+int getNumWorkerThreads(); //hardware threads, at least 1
 
 //generic purposes fuctions
 void drawGrid();
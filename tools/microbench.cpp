@@ -0,0 +1,464 @@
+/*  Microbenchmarks of the CPU hot paths, it does not create any window or GL context.
+	Every benchmark is calibrated so a sample takes some ms, warmed up and then sampled several times,
+	the table shows the time per call and the throughput. Build with "make microbench".
+
+	usage: ./microbench [--filter text] [--samples N] [--json report.json]
+*/
+
+#include "../src/framework.h"
+#include "../src/camera.h"
+#include "../src/mesh.h"
+#include "../src/animation.h"
+#include "../src/texture.h"
+#include "../src/sphericalharmonics.h"
+#include "../src/utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+struct sBenchResult {
+	std::string name;
+	double ns_mean;
+	double ns_p50;
+	double ns_p95;
+	double ns_min;
+	double per_second; //throughput in units per second
+	const char* unit;
+};
+
+//not sBenchOptions, the one of the headless benchmark is linked in the same binary
+struct sMicrobenchOptions {
+	std::string filter;
+	std::string json;
+	int samples = 30;
+	double sample_ms = 5; //target time of one sample
+};
+
+static sMicrobenchOptions options;
+static std::vector<sBenchResult> results;
+static volatile float sink = 0; //results go here so the compiler cannot remove the work
+
+double nowNs()
+{
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//units is how many items one call processes (matrices, bytes, pixels...), used for the throughput
+void bench(const char* name, double units, const char* unit, std::function<void()> func)
+{
+	if (options.filter.size() && !strstr(name, options.filter.c_str()))
+		return;
+
+	//calibrate how many calls fit in one sample, this also warms up caches and lazy inits
+	int calls = 1;
+	while (true)
+	{
+		double start = nowNs();
+		for (int i = 0; i < calls; ++i)
+			func();
+		double elapsed = nowNs() - start;
+		if (elapsed > options.sample_ms * 1000000.0 || calls >= (1 << 24))
+			break;
+		calls *= 2;
+	}
+
+	std::vector<double> samples;
+	for (int s = 0; s < options.samples; ++s)
+	{
+		double start = nowNs();
+		for (int i = 0; i < calls; ++i)
+			func();
+		samples.push_back((nowNs() - start) / calls);
+	}
+	std::sort(samples.begin(), samples.end());
+
+	sBenchResult result;
+	result.name = name;
+	double sum = 0;
+	for (int i = 0; i < (int)samples.size(); ++i)
+		sum += samples[i];
+	result.ns_mean = sum / samples.size();
+	result.ns_p50 = samples[samples.size() / 2];
+	result.ns_p95 = samples[std::min((int)(samples.size() * 0.95), (int)samples.size() - 1)];
+	result.ns_min = samples[0];
+	result.per_second = units / (result.ns_p50 * 1e-9);
+	result.unit = unit;
+	results.push_back(result);
+
+	printf("%-32s %12.1f %12.1f %12.1f %12.1f %14.3g %s/s\n", name, result.ns_mean, result.ns_p50, result.ns_p95, result.ns_min, result.per_second, unit);
+	fflush(stdout);
+}
+
+std::mt19937 rng(1234); //fixed seed, every run uses the same data
+
+float randomFloat(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+Matrix44 randomTransform()
+{
+	Matrix44 m;
+	m.setRotation(randomFloat(0, 6.28f), normalize(Vector3(randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1)) + Vector3(0, 0.01f, 0)));
+	m.translateGlobal(randomFloat(-500, 500), randomFloat(-50, 50), randomFloat(-500, 500));
+	m.scale(randomFloat(0.5, 2), randomFloat(0.5, 2), randomFloat(0.5, 2));
+	return m;
+}
+
+Quaternion randomRotation()
+{
+	return Quaternion(normalize(Vector3(randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(-1, 1)) + Vector3(0, 0.01f, 0)), randomFloat(0, 6.28f));
+}
+
+//relative to the reference, translations of hundreds of units lose the same bits as rotations of one
+float maxError(const float* a, const float* b, int num)
+{
+	float error = 0;
+	for (int i = 0; i < num; ++i)
+		error = std::max(error, fabsf(a[i] - b[i]) / (1.0f + fabsf(b[i])));
+	return error;
+}
+
+//compares the SIMD math against the scalar references, false if they differ more than float rounding
+bool checkMath()
+{
+	float errors[3] = { 0, 0, 0 };
+	for (int i = 0; i < 10000; ++i)
+	{
+		Matrix44 a = randomTransform(), b = randomTransform();
+		Matrix44 r1 = a * b, r2 = multiplyScalar(a, b);
+		errors[0] = std::max(errors[0], maxError(r1.m, r2.m, 16));
+
+		r1 = a;
+		r2 = a;
+		r1.inverse();
+		inverseScalar(r2);
+		errors[1] = std::max(errors[1], maxError(r1.m, r2.m, 16));
+
+		BoundingBox box(Vector3(randomFloat(-10, 10), randomFloat(0, 10), randomFloat(-10, 10)), Vector3(randomFloat(1, 10), randomFloat(1, 10), randomFloat(1, 10)));
+		BoundingBox b1 = transformAABB(a, box), b2 = transformBoundingBoxScalar(a, box);
+		errors[2] = std::max(errors[2], std::max(maxError(b1.center.v, b2.center.v, 3), maxError(b1.halfsize.v, b2.halfsize.v, 3)));
+	}
+
+	const char* names[3] = { "operator*", "inverse", "transformAABB" };
+	bool ok = true;
+	for (int i = 0; i < 3; ++i)
+		if (errors[i] > 1e-4f)
+		{
+			std::cout << "[ERROR] " << getMathBackend() << " math differs from the scalar reference in " << names[i] << ": " << errors[i] << std::endl;
+			ok = false;
+		}
+	return ok;
+}
+
+void benchMath()
+{
+	const int N = 1024;
+	std::vector<Matrix44> a(N), b(N), r(N);
+	std::vector<BoundingBox> boxes(N);
+	for (int i = 0; i < N; ++i)
+	{
+		a[i] = randomTransform();
+		b[i] = randomTransform();
+		boxes[i].center = Vector3(randomFloat(-10, 10), randomFloat(0, 10), randomFloat(-10, 10));
+		boxes[i].halfsize = Vector3(randomFloat(1, 10), randomFloat(1, 10), randomFloat(1, 10));
+	}
+
+	bench("Matrix44::operator*", N, "mat", [&]() {
+		for (int i = 0; i < N; ++i)
+			r[i] = a[i] * b[i];
+		sink = r[N - 1].m[0];
+	});
+
+	bench("Matrix44::operator* scalar", N, "mat", [&]() {
+		for (int i = 0; i < N; ++i)
+			r[i] = multiplyScalar(a[i], b[i]);
+		sink = r[N - 1].m[0];
+	});
+
+	bench("Matrix44::inverse", N, "mat", [&]() {
+		for (int i = 0; i < N; ++i)
+		{
+			r[i] = a[i];
+			r[i].inverse();
+		}
+		sink = r[N - 1].m[0];
+	});
+
+	bench("Matrix44::inverse scalar", N, "mat", [&]() {
+		for (int i = 0; i < N; ++i)
+		{
+			r[i] = a[i];
+			inverseScalar(r[i]);
+		}
+		sink = r[N - 1].m[0];
+	});
+
+	bench("transformBoundingBox", N, "box", [&]() {
+		float acc = 0;
+		for (int i = 0; i < N; ++i)
+			acc += transformBoundingBox(a[i], boxes[i]).halfsize.x;
+		sink = acc;
+	});
+
+	bench("transformBoundingBox scalar", N, "box", [&]() {
+		float acc = 0;
+		for (int i = 0; i < N; ++i)
+			acc += transformBoundingBoxScalar(a[i], boxes[i]).halfsize.x;
+		sink = acc;
+	});
+
+	std::vector<Quaternion> qa(N), qb(N), qr(N);
+	for (int i = 0; i < N; ++i)
+	{
+		qa[i] = randomRotation();
+		qb[i] = randomRotation();
+	}
+
+	bench("Quaternion operator*", N, "quat", [&]() {
+		for (int i = 0; i < N; ++i)
+			qr[i] = qa[i] * qb[i];
+		sink = qr[N - 1].x;
+	});
+
+	bench("Qlerp", N, "quat", [&]() {
+		for (int i = 0; i < N; ++i)
+			qr[i] = Qlerp(qa[i], qb[i], 0.35f);
+		sink = qr[N - 1].x;
+	});
+
+	Camera camera;
+	camera.lookAt(Vector3(-300, 90, -150), Vector3(0, 40, 0), Vector3(0, 1, 0));
+	camera.setPerspective(60, 16 / 9.0f, 1, 10000);
+	std::vector<BoundingBox> world_boxes(N);
+	for (int i = 0; i < N; ++i)
+		world_boxes[i] = transformBoundingBox(a[i], boxes[i]);
+
+	bench("Camera::testBoxInFrustum", N, "box", [&]() {
+		int visible = 0;
+		for (int i = 0; i < N; ++i)
+			visible += camera.testBoxInFrustum(world_boxes[i].center, world_boxes[i].halfsize) != CLIP_OUTSIDE;
+		sink = visible;
+	});
+}
+
+void benchSH(int size)
+{
+	FloatImage faces[6];
+	for (int f = 0; f < 6; ++f)
+	{
+		faces[f].resize(size, size, 3);
+		for (int i = 0; i < size * size * 3; ++i)
+			faces[f].data[i] = randomFloat(0, 4);
+	}
+
+	std::string name = "computeSH " + std::to_string(size) + "x" + std::to_string(size);
+	bench(name.c_str(), 6.0 * size * size, "px", [&]() {
+		SphericalHarmonics sh = computeSH(faces);
+		sink = sh.coeffs[0].x;
+	});
+}
+
+void benchMeshes()
+{
+	//sphere.obj is the biggest obj we ship
+	const char* obj_filename = "data/meshes/sphere.obj";
+	std::string content;
+	if (!readFile(obj_filename, content))
+	{
+		std::cout << "[WARN] " << obj_filename << " not found, run from the root folder of the project" << std::endl;
+		return;
+	}
+
+	bench("Mesh::loadOBJ sphere.obj", content.size(), "B", [&]() {
+		Mesh mesh;
+		mesh.loadOBJ(obj_filename);
+		sink = mesh.vertices.size();
+	});
+
+	//the binary is written to a temp file so the bundled data is not touched
+	Mesh source;
+	source.loadOBJ(obj_filename);
+	std::string bin_filename = "/tmp/microbench_sphere";
+	if (!source.writeBin(bin_filename.c_str()))
+		return;
+	bin_filename += ".mbin";
+	std::vector<unsigned char> bin;
+	readFileBin(bin_filename, bin);
+
+	bench("Mesh::readBin sphere.mbin", bin.size(), "B", [&]() {
+		Mesh mesh;
+		mesh.readBin(bin_filename.c_str(), false);
+		sink = mesh.vertices.size();
+	});
+	remove(bin_filename.c_str());
+}
+
+void benchJSON()
+{
+	std::string scene;
+	if (!readFile("data/scene.json", scene))
+	{
+		std::cout << "[WARN] data/scene.json not found, run from the root folder of the project" << std::endl;
+		return;
+	}
+
+	bench("cJSON_Parse scene.json", scene.size(), "B", [&]() {
+		cJSON* json = cJSON_Parse(scene.c_str());
+		sink = json != NULL;
+		cJSON_Delete(json);
+	});
+
+	//a big scene, like the ones of the stress tests
+	std::string big = "{\"entities\":[";
+	for (int i = 0; i < 20000; ++i)
+	{
+		char entity[256];
+		snprintf(entity, sizeof(entity), "%s{\"name\":\"tree%d\",\"type\":\"PREFAB\",\"filename\":\"prefabs/tree/scene.gltf\",\"position\":[%.3f,0,%.3f],\"angle\":%.2f}",
+			i ? "," : "", i, randomFloat(-1000, 1000), randomFloat(-1000, 1000), randomFloat(0, 360));
+		big += entity;
+	}
+	big += "]}";
+
+	bench("cJSON_Parse 20k entities", big.size(), "B", [&]() {
+		cJSON* json = cJSON_Parse(big.c_str());
+		sink = json != NULL;
+		cJSON_Delete(json);
+	});
+}
+
+//skeleton like the ones of our characters, a spine with limbs
+void createSkeleton(Skeleton& skeleton, int num_bones)
+{
+	skeleton.num_bones = num_bones;
+	for (int i = 0; i < num_bones; ++i)
+	{
+		Skeleton::Bone& bone = skeleton.bones[i];
+		bone = Skeleton::Bone();
+		bone.parent = i ? (i < 8 ? i - 1 : (i % 8)) : -1;
+		snprintf(bone.name, sizeof(bone.name), "bone%d", i);
+		bone.model = randomTransform();
+		bone.layer = 1 << (i % 8);
+		skeleton.bones_by_name[bone.name] = i;
+	}
+	for (int i = 1; i < num_bones; ++i)
+	{
+		Skeleton::Bone& parent = skeleton.bones[(unsigned char)skeleton.bones[i].parent];
+		if (parent.num_children < 16)
+			parent.children[parent.num_children++] = i;
+	}
+	skeleton.updateGlobalMatrices();
+}
+
+void benchAnimation()
+{
+	const int num_bones = 64;
+	Animation anim;
+	createSkeleton(anim.skeleton, num_bones);
+	anim.samples_per_second = 30;
+	anim.num_keyframes = 90;
+	anim.duration = anim.num_keyframes / anim.samples_per_second;
+	anim.num_animated_bones = num_bones;
+	for (int i = 0; i < num_bones; ++i)
+		anim.bones_map[i] = i;
+	anim.keyframes = new Matrix44[anim.num_keyframes * num_bones];
+	for (int i = 0; i < anim.num_keyframes * num_bones; ++i)
+		anim.keyframes[i] = randomTransform();
+
+	float t = 0;
+	bench("Animation::assignTime 64 bones", num_bones, "bone", [&]() {
+		t += 0.0167f;
+		anim.assignTime(t);
+		sink = anim.skeleton.global_bone_matrices[num_bones - 1].m[0];
+	});
+
+	Skeleton a, b, result;
+	createSkeleton(a, num_bones);
+	createSkeleton(b, num_bones);
+	bench("blendSkeleton 64 bones", num_bones, "bone", [&]() {
+		blendSkeleton(&a, &b, 0.35f, &result);
+		sink = result.bones[num_bones - 1].model.m[0];
+	});
+	bench("blendSkeleton 64 bones layer", num_bones, "bone", [&]() {
+		blendSkeleton(&a, &b, 0.35f, &result, UPPER_BODY);
+		sink = result.bones[num_bones - 1].model.m[0];
+	});
+}
+
+bool saveJSON(const char* filename)
+{
+	cJSON* root = cJSON_CreateObject();
+	cJSON_AddNumberToObject(root, "samples", options.samples);
+	cJSON_AddStringToObject(root, "math", getMathBackend());
+	cJSON* list = cJSON_AddArrayToObject(root, "benchmarks");
+	for (int i = 0; i < (int)results.size(); ++i)
+	{
+		sBenchResult& result = results[i];
+		cJSON* item = cJSON_CreateObject();
+		cJSON_AddStringToObject(item, "name", result.name.c_str());
+		cJSON_AddNumberToObject(item, "ns_mean", result.ns_mean);
+		cJSON_AddNumberToObject(item, "ns_p50", result.ns_p50);
+		cJSON_AddNumberToObject(item, "ns_p95", result.ns_p95);
+		cJSON_AddNumberToObject(item, "ns_min", result.ns_min);
+		cJSON_AddNumberToObject(item, "per_second", result.per_second);
+		cJSON_AddStringToObject(item, "unit", result.unit);
+		cJSON_AddItemToArray(list, item);
+	}
+
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write microbenchmark report: " << filename << std::endl;
+		free(text);
+		return false;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	free(text);
+	std::cout << " + Microbenchmark report saved: " << filename << std::endl;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "--filter") == 0)
+			options.filter = argv[i + 1];
+		else if (strcmp(argv[i], "--samples") == 0)
+			options.samples = std::max(atoi(argv[i + 1]), 1);
+		else if (strcmp(argv[i], "--json") == 0)
+			options.json = argv[i + 1];
+		else
+		{
+			std::cout << "usage: microbench [--filter text] [--samples N] [--json report.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	printf("math: %s\n", getMathBackend());
+	if (!checkMath())
+		return 1;
+
+	printf("%-32s %12s %12s %12s %12s %14s\n", "benchmark", "mean ns", "p50 ns", "p95 ns", "min ns", "throughput");
+
+	benchMath();
+	benchSH(64);
+	benchSH(256);
+	benchMeshes();
+	benchJSON();
+	benchAnimation();
+
+	if (options.json.size() && !saveJSON(options.json.c_str()))
+		return 1;
+	return 0;
+}
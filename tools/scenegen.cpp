@@ -0,0 +1,297 @@
+/*  Stress scene generator, writes big scenes in the format of data/scene.json to test how the renderer scales.
+	Everything comes from a seeded random generator so the same options always give the same scene.
+	Build with "make scenegen", for example:
+
+	./scenegen --entities 10000 --layout grid --point 500 --spot 50 --decals 200 --probes 4 --out data/stress_10k.json
+*/
+
+#include "../src/extra/cJSON.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct sPrefabInfo {
+	std::string filename; //relative to data/ like in the scenes
+	float scale;
+};
+
+struct sGeneratorOptions {
+	int entities = 1000; //prefab instances
+	bool grid = true; //grid or random layout
+	float spacing = 60; //distance between instances in the grid, the random layout uses the same area
+	int point_lights = 100;
+	int spot_lights = 10;
+	int directional_lights = 1;
+	int shadows = 2; //lights that cast shadows, besides the first directional
+	int decals = 50;
+	int probes = 4;
+	unsigned int seed = 1234;
+	std::string output;
+	std::vector<sPrefabInfo> prefabs;
+};
+
+std::mt19937 rng;
+
+float randomFloat(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+//two decimals are enough and keep the files smaller
+double round2(float v)
+{
+	return std::round(v * 100.0) / 100.0;
+}
+
+void addVector3(cJSON* obj, const char* name, float x, float y, float z)
+{
+	double v[3] = { round2(x), round2(y), round2(z) };
+	cJSON_AddItemToObject(obj, name, cJSON_CreateDoubleArray(v, 3));
+}
+
+//cJSON walks the whole list on every append, the entities are linked here instead
+cJSON* last_entity = NULL;
+
+void addEntity(cJSON* array, cJSON* item)
+{
+	if (!last_entity)
+		cJSON_AddItemToArray(array, item);
+	else
+	{
+		last_entity->next = item;
+		item->prev = last_entity;
+	}
+	last_entity = item;
+}
+
+cJSON* createEntity(const char* type, const std::string& name)
+{
+	cJSON* entity = cJSON_CreateObject();
+	cJSON_AddStringToObject(entity, "name", name.c_str());
+	cJSON_AddStringToObject(entity, "type", type);
+	return entity;
+}
+
+void randomColor(cJSON* obj)
+{
+	//saturated colors, one channel always at full
+	float c[3] = { randomFloat(0.1, 1), randomFloat(0.1, 1), randomFloat(0.1, 1) };
+	c[rng() % 3] = 1;
+	addVector3(obj, "color", c[0], c[1], c[2]);
+}
+
+bool parseOptions(int argc, char** argv, sGeneratorOptions& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!value)
+		{
+			std::cout << "[ERROR] missing value for " << arg << std::endl;
+			return false;
+		}
+		i++;
+
+		if (strcmp(arg, "--entities") == 0)
+			options.entities = atoi(value);
+		else if (strcmp(arg, "--layout") == 0)
+			options.grid = strcmp(value, "random") != 0;
+		else if (strcmp(arg, "--spacing") == 0)
+			options.spacing = atof(value);
+		else if (strcmp(arg, "--point") == 0)
+			options.point_lights = atoi(value);
+		else if (strcmp(arg, "--spot") == 0)
+			options.spot_lights = atoi(value);
+		else if (strcmp(arg, "--directional") == 0)
+			options.directional_lights = atoi(value);
+		else if (strcmp(arg, "--shadows") == 0)
+			options.shadows = atoi(value);
+		else if (strcmp(arg, "--decals") == 0)
+			options.decals = atoi(value);
+		else if (strcmp(arg, "--probes") == 0)
+			options.probes = atoi(value);
+		else if (strcmp(arg, "--seed") == 0)
+			options.seed = atoi(value);
+		else if (strcmp(arg, "--out") == 0)
+			options.output = value;
+		else if (strcmp(arg, "--prefabs") == 0)
+		{
+			//comma separated list of files relative to data/
+			std::string list = value;
+			size_t start = 0;
+			while (start < list.size())
+			{
+				size_t end = list.find(',', start);
+				if (end == std::string::npos)
+					end = list.size();
+				if (end > start)
+					options.prefabs.push_back({ list.substr(start, end - start), 1.0f });
+				start = end + 1;
+			}
+		}
+		else
+		{
+			std::cout << "usage: scenegen [--entities N] [--layout grid|random] [--spacing units] [--point N] [--spot N]" << std::endl;
+			std::cout << "                [--directional N] [--shadows N] [--decals N] [--probes N] [--seed N]" << std::endl;
+			std::cout << "                [--prefabs a.gltf,b.glb] [--out file.json]" << std::endl;
+			return false;
+		}
+	}
+
+	if (options.prefabs.empty())
+	{
+		//the prefabs we ship, with the scales used in data/scene.json
+		options.prefabs.push_back({ "prefabs/gmc/scene.gltf", 1.0f });
+		options.prefabs.push_back({ "prefabs/house_test/scene.gltf", 0.4f });
+		options.prefabs.push_back({ "prefabs/trash_can/scene.gltf", 0.5f });
+		options.prefabs.push_back({ "prefabs/tree/scene.gltf", 0.8f });
+	}
+	if (options.output.empty())
+		options.output = "data/stress_" + std::to_string(options.entities) + ".json";
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	sGeneratorOptions options;
+	if (!parseOptions(argc, argv, options))
+		return 1;
+	rng.seed(options.seed);
+
+	//square area that fits the instances
+	int side = std::max((int)ceil(sqrt((double)options.entities)), 1);
+	float half_size = side * options.spacing * 0.5f;
+
+	cJSON* root = cJSON_CreateObject();
+	addVector3(root, "background_color", 0.01, 0.01, 0.1);
+	addVector3(root, "ambient_light", 0.1, 0.1, 0.2);
+	cJSON_AddStringToObject(root, "environment", "night.hdre");
+	addVector3(root, "camera_position", -half_size, 150, -half_size);
+	addVector3(root, "camera_target", 0, 40, 0);
+	cJSON_AddNumberToObject(root, "camera_fov", 60);
+	cJSON* entities = cJSON_AddArrayToObject(root, "entities");
+
+	//the floor prefab is 1000 units wide
+	cJSON* floor = createEntity("PREFAB", "floor");
+	cJSON_AddStringToObject(floor, "filename", "prefabs/floor.glb");
+	addVector3(floor, "position", 0, 0, 0);
+	float floor_scale = std::max(half_size * 2 / 1000.0f, 1.0f);
+	addVector3(floor, "scale", floor_scale, 1, floor_scale);
+	addEntity(entities, floor);
+
+	for (int i = 0; i < options.entities; ++i)
+	{
+		float x, z;
+		if (options.grid)
+		{
+			x = (i % side + 0.5f) * options.spacing - half_size;
+			z = (i / side + 0.5f) * options.spacing - half_size;
+		}
+		else
+		{
+			x = randomFloat(-half_size, half_size);
+			z = randomFloat(-half_size, half_size);
+		}
+
+		sPrefabInfo& info = options.prefabs[rng() % options.prefabs.size()];
+		cJSON* entity = createEntity("PREFAB", "prefab" + std::to_string(i));
+		cJSON_AddStringToObject(entity, "filename", info.filename.c_str());
+		addVector3(entity, "position", x, 0, z);
+		cJSON_AddNumberToObject(entity, "angle", round2(randomFloat(0, 360)));
+		float scale = info.scale * randomFloat(0.8, 1.2);
+		addVector3(entity, "scale", scale, scale, scale);
+		addEntity(entities, entity);
+	}
+
+	int shadows = options.shadows;
+	for (int i = 0; i < options.directional_lights; ++i)
+	{
+		//the first one is the moon, the volumetric pass scatters it
+		cJSON* light = createEntity("LIGHT", i == 0 ? "moonlight" : "directional" + std::to_string(i));
+		cJSON_AddStringToObject(light, "light_type", "DIRECTIONAL");
+		addVector3(light, "position", randomFloat(-half_size, half_size) * 0.5f, 300, randomFloat(-half_size, half_size) * 0.5f);
+		addVector3(light, "target", 0, 0, 0);
+		if (i == 0)
+			addVector3(light, "color", 0.1, 0.2, 0.4);
+		else
+			randomColor(light);
+		cJSON_AddNumberToObject(light, "intensity", i == 0 ? 1.5 : 0.5);
+		cJSON_AddNumberToObject(light, "area_size", round2(std::max(half_size, 500.0f)));
+		cJSON_AddNumberToObject(light, "max_dist", 1000);
+		cJSON_AddBoolToObject(light, "cast_shadows", i == 0 || shadows-- > 0);
+		addEntity(entities, light);
+	}
+
+	for (int i = 0; i < options.spot_lights; ++i)
+	{
+		float x = randomFloat(-half_size, half_size), z = randomFloat(-half_size, half_size);
+		cJSON* light = createEntity("LIGHT", "spot" + std::to_string(i));
+		cJSON_AddStringToObject(light, "light_type", "SPOT");
+		addVector3(light, "position", x, randomFloat(40, 100), z);
+		addVector3(light, "target", x + randomFloat(-50, 50), 0, z + randomFloat(-50, 50));
+		randomColor(light);
+		cJSON_AddNumberToObject(light, "intensity", round2(randomFloat(2, 10)));
+		cJSON_AddNumberToObject(light, "max_dist", round2(randomFloat(150, 400)));
+		cJSON_AddNumberToObject(light, "cone_angle", round2(randomFloat(20, 50)));
+		cJSON_AddNumberToObject(light, "cone_exp", round2(randomFloat(10, 60)));
+		cJSON_AddNumberToObject(light, "shadow_bias", 0.001);
+		cJSON_AddBoolToObject(light, "cast_shadows", shadows-- > 0);
+		addEntity(entities, light);
+	}
+
+	for (int i = 0; i < options.point_lights; ++i)
+	{
+		cJSON* light = createEntity("LIGHT", "point" + std::to_string(i));
+		cJSON_AddStringToObject(light, "light_type", "POINT");
+		addVector3(light, "position", randomFloat(-half_size, half_size), randomFloat(20, 60), randomFloat(-half_size, half_size));
+		randomColor(light);
+		cJSON_AddNumberToObject(light, "intensity", round2(randomFloat(1, 5)));
+		cJSON_AddNumberToObject(light, "max_dist", round2(randomFloat(40, 150)));
+		addEntity(entities, light);
+	}
+
+	for (int i = 0; i < options.decals; ++i)
+	{
+		cJSON* decal = createEntity("DECAL", "decal" + std::to_string(i));
+		cJSON_AddStringToObject(decal, "albedo", "textures/garfield.png");
+		addVector3(decal, "position", randomFloat(-half_size, half_size), 0, randomFloat(-half_size, half_size));
+		cJSON_AddNumberToObject(decal, "angle", round2(randomFloat(0, 360)));
+		float scale = randomFloat(10, 30);
+		addVector3(decal, "scale", scale, scale, scale);
+		addEntity(entities, decal);
+	}
+
+	for (int i = 0; i < options.probes; ++i)
+	{
+		cJSON* probe = createEntity("REFLECTION_PROBE", "probe" + std::to_string(i));
+		addVector3(probe, "position", randomFloat(-half_size, half_size), randomFloat(10, 30), randomFloat(-half_size, half_size));
+		addEntity(entities, probe);
+	}
+
+	char* text = cJSON_Print(root);
+	cJSON_Delete(root);
+
+	FILE* file = fopen(options.output.c_str(), "wb");
+	if (!file)
+	{
+		std::cout << "[ERROR] cannot write scene: " << options.output << std::endl;
+		free(text);
+		return 1;
+	}
+	fwrite(text, 1, strlen(text), file);
+	fclose(file);
+	free(text);
+
+	int num_lights = options.directional_lights + options.spot_lights + options.point_lights;
+	std::cout << " + Scene saved: " << options.output << " (" << options.entities << " prefabs, " << num_lights << " lights, "
+		<< options.decals << " decals, " << options.probes << " probes, seed " << options.seed << ")" << std::endl;
+	return 0;
+}